@@ -0,0 +1,229 @@
+import net from 'net'
+import EventEmitter from 'events'
+import LocalConnector from '../src/local-connector'
+
+const RS = '\x1e'
+const MSG_TYPE_JSON = 0x10
+
+/*
+  Helper Function Start
+*/
+function textFrame(msg) {
+  return Buffer.from(msg + RS)
+}
+
+function binaryFrame(msg, type = MSG_TYPE_JSON) {
+  const payload = Buffer.from(msg)
+  const header = Buffer.alloc(5)
+  header.writeUInt32BE(payload.length + 1, 0)
+  header[4] = type
+  return Buffer.concat([header, payload])
+}
+
+function chunks(buf, size) {
+  const ret = []
+  for (let i = 0; i < buf.length; i += size) {
+    ret.push(buf.slice(i, i + size))
+  }
+  return ret
+}
+
+const framingAccept = JSON.stringify({
+  type: 'framing',
+  framing: { mode: 'binary' }
+})
+/*
+  Helper Function End
+*/
+
+describe('Local Connector Test', () => {
+  let connectionListener
+  let connector
+  let localConnector
+  let socket
+
+  beforeEach(async () => {
+    jest.spyOn(net, 'createServer').mockImplementation(listener => {
+      connectionListener = listener
+      const server = new EventEmitter()
+      server.listen = jest.fn()
+      server.close = jest.fn()
+      return server
+    })
+
+    connector = {
+      updateActiveState: jest.fn(),
+      updateConnectionState: jest.fn(),
+      updateRegistrationState: jest.fn(),
+      sendMessage: jest.fn(),
+      sendCtrlMessage: jest.fn()
+    }
+
+    localConnector = new LocalConnector()
+    localConnector._agent = {
+      log: { log: jest.fn() },
+      config: { get: () => '/tmp/enebular-local-connector-test.socket' }
+    }
+    await localConnector._startLocalServer(connector)
+
+    socket = new EventEmitter()
+    socket.write = jest.fn()
+    connectionListener(socket)
+  })
+
+  afterEach(() => {
+    jest.restoreAllMocks()
+  })
+
+  function receive(...data) {
+    data.forEach(d => socket.emit('data', d))
+  }
+
+  function switchToBinary() {
+    receive(textFrame(framingAccept))
+    socket.write.mockClear()
+  }
+
+  test('Handshake - text framed, offering binary framing', () => {
+    expect(socket.write.mock.calls.map(call => call[0])).toEqual([
+      'ok' + RS,
+      expect.stringMatching(/^agent: \{.*\}\x1e$/),
+      'capabilities: logs' + RS,
+      'framing: binary' + RS
+    ])
+    expect(connector.updateActiveState).toHaveBeenCalledWith(true)
+  })
+
+  test('Text framing - messages split across data events', () => {
+    const stream = Buffer.concat([
+      textFrame('{"type":"connect"}'),
+      textFrame('{"type":"ctrlMessage","message":{"seq":1}}'),
+      textFrame(
+        '{"type":"registration","registration":{"registered":true,"deviceId":"dev"}}'
+      )
+    ])
+
+    receive(...chunks(stream, 7))
+
+    expect(connector.updateConnectionState).toHaveBeenCalledWith(true)
+    expect(connector.sendCtrlMessage).toHaveBeenCalledWith({ seq: 1 })
+    expect(connector.updateRegistrationState).toHaveBeenCalledWith(true, 'dev')
+  })
+
+  test('Text framing - empty messages are skipped', () => {
+    receive(Buffer.from(RS + RS + '{"type":"disconnect"}' + RS + RS))
+
+    expect(connector.updateConnectionState).toHaveBeenCalledTimes(1)
+    expect(connector.updateConnectionState).toHaveBeenCalledWith(false)
+  })
+
+  test('Mode switch - binary frames in the same data event as the accept', () => {
+    receive(
+      Buffer.concat([
+        textFrame('{"type":"connect"}'),
+        textFrame(framingAccept),
+        binaryFrame('{"type":"ctrlMessage","message":{"seq":2}}'),
+        binaryFrame('{"type":"disconnect"}')
+      ])
+    )
+
+    expect(socket.write).toHaveBeenCalledWith('framing: active' + RS)
+    expect(localConnector._clientSendBinary).toBe(true)
+    expect(connector.updateConnectionState.mock.calls).toEqual([[true], [false]])
+    expect(connector.sendCtrlMessage).toHaveBeenCalledWith({ seq: 2 })
+  })
+
+  test('Mode switch - accept split across data events with binary frames', () => {
+    const stream = Buffer.concat([
+      textFrame(framingAccept),
+      binaryFrame('{"type":"connect"}')
+    ])
+
+    receive(...chunks(stream, 10))
+
+    expect(localConnector._clientSendBinary).toBe(true)
+    expect(connector.updateConnectionState).toHaveBeenCalledWith(true)
+  })
+
+  test('Binary framing - frames split byte by byte', () => {
+    switchToBinary()
+
+    const stream = Buffer.concat([
+      binaryFrame('{"type":"ctrlMessage","message":{"seq":3}}'),
+      binaryFrame('{"type":"connect"}')
+    ])
+
+    receive(...chunks(stream, 1))
+
+    expect(connector.sendCtrlMessage).toHaveBeenCalledWith({ seq: 3 })
+    expect(connector.updateConnectionState).toHaveBeenCalledWith(true)
+  })
+
+  test('Binary framing - zero length and non-JSON frames are skipped', () => {
+    switchToBinary()
+
+    receive(
+      Buffer.concat([
+        Buffer.alloc(4),
+        binaryFrame('ignored', 0x03),
+        binaryFrame('{"type":"connect"}')
+      ])
+    )
+
+    expect(connector.updateConnectionState).toHaveBeenCalledTimes(1)
+    expect(connector.updateConnectionState).toHaveBeenCalledWith(true)
+  })
+
+  test('Binary framing - messages are sent binary framed', () => {
+    switchToBinary()
+
+    localConnector._clientSendMessage('connect')
+
+    expect(socket.write).toHaveBeenCalledWith(Buffer.from([0, 0, 0, 1, 0x05]))
+  })
+
+  test('Logs - records are logged at their own time', () => {
+    const ts = Date.UTC(2019, 0, 1)
+
+    receive(
+      textFrame(
+        JSON.stringify({
+          type: 'logs',
+          logs: [{ level: 'info', ts: ts, message: 'hello' }]
+        })
+      )
+    )
+
+    expect(localConnector._agent.log.log).toHaveBeenCalledWith(
+      'info',
+      'conntector: hello',
+      { module: 'local', timestamp: new Date(ts).toISOString() }
+    )
+  })
+
+  test('Stats - request resolves with the reply', async () => {
+    switchToBinary()
+
+    const request = localConnector.requestConnectorStats()
+
+    expect(socket.write).toHaveBeenCalledWith(Buffer.from([0, 0, 0, 1, 0x08]))
+
+    receive(binaryFrame('{"type":"stats","stats":{"metric":1}}'))
+
+    await expect(request).resolves.toEqual({ metric: 1 })
+  })
+
+  test('Stats - request times out without a reply', async () => {
+    await expect(localConnector.requestConnectorStats(10)).rejects.toThrow(
+      'timed out'
+    )
+  })
+
+  test('Stats - request fails when the connector disconnects', async () => {
+    const request = localConnector.requestConnectorStats()
+
+    socket.emit('close')
+
+    await expect(request).rejects.toThrow('disconnected')
+  })
+})
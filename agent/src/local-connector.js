@@ -7,19 +7,56 @@ import ConnectorService from './connector-service'
 
 const MODULE_NAME = 'local'
 const END_OF_MSG_MARKER = 0x1e // RS (Record Separator)
+const FRAME_LEN_SIZE = 4
+
+/**
+ * Messages sent to the client. In text framing mode a message is identified by
+ * its prefix, and in binary framing mode by its type tag.
+ */
+const ClientMessageTypes = {
+  ok: { type: 0x01, prefix: 'ok' },
+  agent: { type: 0x02, prefix: 'agent: ' },
+  ctrlMessage: { type: 0x03, prefix: 'ctrlMessage: ' },
+  register: { type: 0x04, prefix: 'register' },
+  connect: { type: 0x05, prefix: 'connect' },
+  disconnect: { type: 0x06, prefix: 'disconnect' },
+  framing: { type: 0x07, prefix: 'framing: ' },
+  stats: { type: 0x08, prefix: 'stats' },
+  capabilities: { type: 0x09, prefix: 'capabilities: ' }
+}
+const CLIENT_MSG_TYPE_JSON = 0x10
+const STATS_REQUEST_TIMEOUT_MS = 5000
+
+type StatsRequest = {
+  resolve: (stats: Object) => void,
+  reject: (err: Error) => void,
+  timer: TimeoutID
+}
 
 export default class LocalConnector {
   _agent: EnebularAgent
   _connector: ConnectorService
   _localServer: net.Server
   _clientSocket: ?net.Socket
+  _clientSendBinary: boolean
   _moduleName: ?string
+  _statsRequests: Array<StatsRequest> = []
 
   _log(level: string, msg: string, ...args: Array<mixed>) {
     args.push({ module: this._moduleName || MODULE_NAME })
     this._agent.log.log(level, msg, ...args)
   }
 
+  // Logs a connector log record at the time it was logged by the connector
+  // (ms since the epoch), rather than when it was received.
+  _logRecord(level: string, msg: string, ts: ?number) {
+    const meta: Object = { module: this._moduleName || MODULE_NAME }
+    if (typeof ts === 'number') {
+      meta.timestamp = new Date(ts).toISOString()
+    }
+    this._agent.log.log(level, msg, meta)
+  }
+
   _debug(msg: string, ...args: Array<mixed>) {
     this._log('debug', msg, ...args)
   }
@@ -42,19 +79,29 @@ export default class LocalConnector {
     }
   }
 
-  _clientSendMessage(message: string) {
-    if (this._clientSocket) {
-      this._clientSocket.write(message + String.fromCharCode(END_OF_MSG_MARKER))
+  _clientSendMessage(messageType: string, content: string = '') {
+    if (!this._clientSocket) {
+      return
+    }
+    const { type, prefix } = ClientMessageTypes[messageType]
+    if (this._clientSendBinary) {
+      const payload = Buffer.from(content, 'utf8')
+      const header = Buffer.alloc(FRAME_LEN_SIZE + 1)
+      header.writeUInt32BE(payload.length + 1, 0)
+      header[FRAME_LEN_SIZE] = type
+      this._clientSocket.write(Buffer.concat([header, payload]))
+    } else {
+      this._clientSocket.write(
+        prefix + content + String.fromCharCode(END_OF_MSG_MARKER)
+      )
     }
   }
 
   async _startLocalServer(connector: ConnectorService): net.Server {
     const localPort = this
-    function handleClientMessage(clientMessage: string) {
-      localPort._debug(`client message: [${clientMessage}]`)
-      let message
+    function handleClientMessage(message: Object) {
+      localPort._debug(`client message: [${JSON.stringify(message)}]`)
       try {
-        message = JSON.parse(clientMessage)
         switch (message.type) {
           case 'connect':
             connector.updateConnectionState(true)
@@ -83,6 +130,21 @@ export default class LocalConnector {
               'conntector: ' + message.log.message
             )
             break
+          case 'logs':
+            // A batch of log messages (each with its 'ts' in ms since the
+            // epoch), sent as we advertise the 'logs' capability.
+            message.logs.forEach(log => {
+              localPort._logRecord(
+                log.level,
+                'conntector: ' + log.message,
+                log.ts
+              )
+            })
+            break
+          case 'stats':
+            // The connector's metrics, in response to requestConnectorStats().
+            localPort._settleStatsRequests(null, message.stats)
+            break
           default:
             localPort._info('unsupported client message type: ' + message.type)
             break
@@ -95,35 +157,88 @@ export default class LocalConnector {
     const server = net.createServer(socket => {
       this._info('client connected')
 
-      socket.setEncoding('utf8')
-
       this._clientSocket = socket
+      this._clientSendBinary = false
 
-      let messages = ''
+      let recvBinary = false
+      let pending = Buffer.alloc(0)
+
+      function handleFramingMessage(framing: Object) {
+        if (framing.mode !== 'binary') {
+          localPort._info('unsupported client framing: ' + framing.mode)
+          return
+        }
+        // Everything after the client's accept is binary framed, and our
+        // confirmation is the last text framed message we send.
+        recvBinary = true
+        localPort._clientSendMessage('framing', 'active')
+        localPort._clientSendBinary = true
+        localPort._debug('client using binary framing')
+      }
+
+      function handleMessage(clientMessage: string) {
+        let message
+        try {
+          message = JSON.parse(clientMessage)
+        } catch (err) {
+          localPort._error('client message: failed to parse: ' + err)
+          return
+        }
+        if (message.type === 'framing') {
+          handleFramingMessage(message.framing)
+        } else {
+          handleClientMessage(message)
+        }
+      }
 
       socket.on('data', data => {
-        messages += data
-        if (messages.charCodeAt(messages.length - 1) === END_OF_MSG_MARKER) {
-          let msgs = messages.split(String.fromCharCode(END_OF_MSG_MARKER))
-          for (let msg of msgs) {
-            if (msg.length > 0) {
-              handleClientMessage(msg)
+        pending = pending.length > 0 ? Buffer.concat([pending, data]) : data
+        let offset = 0
+        while (offset < pending.length) {
+          if (recvBinary) {
+            if (pending.length - offset < FRAME_LEN_SIZE) {
+              break
+            }
+            const len = pending.readUInt32BE(offset)
+            if (pending.length - offset < FRAME_LEN_SIZE + len) {
+              break
+            }
+            const start = offset + FRAME_LEN_SIZE
+            offset = start + len
+            if (len === 0) {
+              continue
+            }
+            if (pending[start] !== CLIENT_MSG_TYPE_JSON) {
+              this._info('unsupported client message type: ' + pending[start])
+              continue
+            }
+            handleMessage(pending.toString('utf8', start + 1, offset))
+          } else {
+            const end = pending.indexOf(END_OF_MSG_MARKER, offset)
+            if (end < 0) {
+              break
+            }
+            const start = offset
+            offset = end + 1
+            if (end > start) {
+              handleMessage(pending.toString('utf8', start, end))
             }
           }
-          messages = ''
         }
+        pending = pending.slice(offset)
       })
 
       socket.on('end', () => {
-        if (messages.length > 0) {
-          this._info('client ended with partial message: ' + messages)
-          messages = ''
+        if (pending.length > 0) {
+          this._info('client ended with partial message: ' + pending.toString())
+          pending = Buffer.alloc(0)
         }
       })
 
       socket.on('close', () => {
         this._info('client disconnected')
         this._clientSocket = null
+        this._settleStatsRequests(new Error('Connector disconnected'))
         connector.updateConnectionState(false)
         connector.updateActiveState(false)
       })
@@ -134,8 +249,11 @@ export default class LocalConnector {
 
       this._clientSendMessage('ok')
       this._clientSendMessage(
-        `agent: {"v": "${agentVer}", "type": "enebular-agent"}`
+        'agent',
+        `{"v": "${agentVer}", "type": "enebular-agent"}`
       )
+      this._clientSendMessage('capabilities', 'logs')
+      this._clientSendMessage('framing', 'binary')
 
       connector.updateActiveState(true)
     })
@@ -160,6 +278,49 @@ export default class LocalConnector {
     return server
   }
 
+  /**
+   * Requests the connector's metrics.
+   *
+   * Resolves with the metrics keyed by name (labelled metrics are objects
+   * keyed by label value, and histograms have their count, sum and buckets).
+   */
+  requestConnectorStats(
+    timeout: number = STATS_REQUEST_TIMEOUT_MS
+  ): Promise<Object> {
+    return new Promise((resolve, reject) => {
+      if (!this._clientSocket) {
+        reject(new Error('Connector not connected'))
+        return
+      }
+      const request: StatsRequest = {
+        resolve: resolve,
+        reject: reject,
+        timer: setTimeout(() => {
+          this._statsRequests = this._statsRequests.filter(r => r !== request)
+          reject(new Error('Connector stats request timed out'))
+        }, timeout)
+      }
+      // Requests made before a reply share it.
+      if (this._statsRequests.length === 0) {
+        this._clientSendMessage('stats')
+      }
+      this._statsRequests.push(request)
+    })
+  }
+
+  _settleStatsRequests(err: ?Error, stats: ?Object) {
+    const requests = this._statsRequests
+    this._statsRequests = []
+    requests.forEach(request => {
+      clearTimeout(request.timer)
+      if (err) {
+        request.reject(err)
+      } else {
+        request.resolve(stats || {})
+      }
+    })
+  }
+
   onConnectorRegisterConfig() {
     this._agent.config.addItem(
       'ENEBULAR_LOCAL_CONNECTOR_SOCKET_PATH',
@@ -183,7 +344,7 @@ export default class LocalConnector {
     })
 
     this._agent.on('connectorCtrlMessageSend', msg => {
-      this._clientSendMessage('ctrlMessage: ' + JSON.stringify(msg))
+      this._clientSendMessage('ctrlMessage', JSON.stringify(msg))
     })
 
     this._localServer = await this._startLocalServer(this._connector)
@@ -84,7 +84,13 @@ export default class LogManager {
           filename: config.get('ENEBULAR_LOG_FILE_PATH'),
           handleExceptions: true,
           format: winston.format.combine(
-            winston.format.timestamp(),
+            // keep the time of records logged elsewhere (e.g. by a connector)
+            winston.format(info => {
+              if (!info.timestamp) {
+                info.timestamp = new Date().toISOString()
+              }
+              return info
+            })(),
             logFormat
           )
         })
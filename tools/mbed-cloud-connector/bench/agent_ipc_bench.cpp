@@ -0,0 +1,803 @@
+/*
+ * End-to-end benchmark of the connector <-> agent IPC path.
+ *
+ * Runs the whole connector (host build, with the simulated Mbed Cloud client)
+ * against a mock of the agent's Unix socket server, and measures messages in
+ * one direction at a time:
+ *
+ *   to-agent:   Mbed Cloud resource update -> client -> main loop -> agent
+ *               (the simulated client PUTs to_device, the mock agent receives
+ *               the ctrlMessage)
+ *   from-agent: agent -> main loop -> client -> Mbed Cloud notification
+ *               (the mock agent sends ctrlMessages, which the connector sets
+ *               as the from_device value)
+ *
+ * Each message carries its send time (CLOCK_MONOTONIC), so the latency is
+ * measured from the moment it was sent to the moment it arrived. To-agent
+ * messages are held back while too many are in flight, as the client drops
+ * messages it cannot queue for the main loop, so that the results are for
+ * messages that all arrived. Cases that still lose messages are marked. Each case
+ * runs in its own process. Without a direction or size, a matrix of both
+ * directions and sizes from 100 B to 1 MB is run.
+ *
+ * CPU per message is reported for the connector's main loop thread and for
+ * the whole process (which includes the mock agent and simulated client).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include "enebular_agent_mbed_cloud_connector.h"
+
+#define END_OF_MSG_MARKER       (0x1E)
+#define DEFAULT_SOCKET_PATH     "/tmp/enebular-agent-ipc-bench.socket"
+#define DEFAULT_TOTAL_BYTES     (64 * 1024 * 1024)
+#define MIN_COUNT               (50)
+#define MAX_COUNT               (20000)
+#define IDLE_TIMEOUT_MS         (3000)
+#define RECV_BUF_SIZE           (2 * 1024 * 1024)
+
+/* to-agent messages in flight, well within the client's queue and send queue */
+#define MAX_IN_FLIGHT           (AGENT_MAN_MSG_RING_SIZE / 2)
+#define MAX_IN_FLIGHT_BYTES     (AGENT_SEND_QUEUE_DEFAULT_MAX_BYTES / 2)
+
+/* the message fields before the padding, with the longest values */
+#define MSG_OVERHEAD            (sizeof("{\"t\":18446744073709551615,\"n\":4294967295,\"p\":\"\"}") - 1)
+
+#define RESOURCE_TO_DEVICE      "26248/0/26241"
+#define RESOURCE_FROM_DEVICE    "26248/0/26242"
+
+#define NSEC_PER_SEC    (1000000000ULL)
+
+enum bench_direction {
+    DIR_TO_AGENT,
+    DIR_FROM_AGENT,
+    DIR_CNT
+};
+
+static const char *direction_names[DIR_CNT] = {
+    "to-agent",
+    "from-agent",
+};
+
+static const size_t default_sizes[] = {
+    100, 1000, 10 * 1000, 100 * 1000, 1000 * 1000
+};
+
+struct bench_config {
+    int direction;
+    size_t size;
+    uint32_t count;
+    double rate;
+    bool text;
+    const char *socket_path;
+};
+
+/* results, filled in by the mock agent and (from-agent latencies) the main loop */
+struct bench_state {
+    struct bench_config config;
+    EnebularAgentMbedCloudConnector *connector;
+    pthread_t main_thread;
+    uint64_t *latencies;
+    std::atomic<uint32_t> received;
+    /* to-agent backpressure */
+    uint32_t put_cnt;
+    uint32_t max_in_flight;
+    std::atomic<bool> put_waiting;
+    pthread_mutex_t put_lock;
+    pthread_cond_t put_cond;
+    uint64_t first_sent;
+    uint64_t last_received;
+    uint64_t loop_cpu_start;
+    uint64_t loop_cpu_end;
+    uint64_t proc_cpu_start;
+    uint64_t proc_cpu_end;
+};
+
+static struct bench_state state;
+
+static uint64_t now_ns(clockid_t clock = CLOCK_MONOTONIC)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t main_loop_cpu_ns()
+{
+    clockid_t clock;
+
+    if (pthread_getcpuclockid(state.main_thread, &clock) != 0) {
+        return 0;
+    }
+
+    return now_ns(clock);
+}
+
+static void sample_cpu_start()
+{
+    state.loop_cpu_start = main_loop_cpu_ns();
+    state.proc_cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static void sample_cpu_end()
+{
+    state.loop_cpu_end = main_loop_cpu_ns();
+    state.proc_cpu_end = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/* builds a message of the configured size. "{t}"/"{n}" are left for the sim. */
+static char *create_msg(uint64_t t, uint32_t n, size_t *len)
+{
+    size_t pad = (state.config.size > MSG_OVERHEAD) ? state.config.size - MSG_OVERHEAD : 0;
+    size_t size = MSG_OVERHEAD + pad + 1;
+    char *msg;
+    int cnt;
+
+    msg = (char *)malloc(size);
+    if (!msg) {
+        return NULL;
+    }
+
+    if (t == 0) {
+        cnt = snprintf(msg, size, "{\"t\":{t},\"n\":{n},\"p\":\"");
+    } else {
+        cnt = snprintf(msg, size, "{\"t\":%llu,\"n\":%u,\"p\":\"", (unsigned long long)t, n);
+    }
+    memset(msg + cnt, 'x', pad);
+    cnt += pad;
+    msg[cnt++] = '"';
+    msg[cnt++] = '}';
+    msg[cnt] = '\0';
+
+    *len = cnt;
+
+    return msg;
+}
+
+/* finds the send time in a message */
+static uint64_t msg_sent_time(const char *msg)
+{
+    const char *t = strstr(msg, "{\"t\":");
+
+    return t ? strtoull(t + 5, NULL, 10) : 0;
+}
+
+static void record_latency(uint64_t sent)
+{
+    uint64_t now = now_ns();
+    uint32_t i = state.received.load(std::memory_order_relaxed);
+
+    if (sent == 0 || i >= state.config.count) {
+        return;
+    }
+    if (i == 0 && state.config.direction == DIR_TO_AGENT) {
+        state.first_sent = sent;
+    }
+    state.latencies[i] = now - sent;
+    state.last_received = now;
+    state.received.store(i + 1, std::memory_order_seq_cst);
+
+    if (state.put_waiting.load(std::memory_order_seq_cst)) {
+        pthread_mutex_lock(&state.put_lock);
+        pthread_cond_signal(&state.put_cond);
+        pthread_mutex_unlock(&state.put_lock);
+    }
+}
+
+/* called from the simulated client before each put, holds it back while too many are in flight */
+static void resource_put_cb(M2MResourceInstance *res)
+{
+    struct timespec deadline;
+
+    if (strcmp(res->uri_path(), RESOURCE_TO_DEVICE) != 0) {
+        return;
+    }
+
+    if (state.put_cnt - state.received.load(std::memory_order_acquire) >= state.max_in_flight) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += IDLE_TIMEOUT_MS / 1000;
+
+        pthread_mutex_lock(&state.put_lock);
+        state.put_waiting.store(true, std::memory_order_seq_cst);
+        /* gives up on messages that were lost, after the idle timeout */
+        while (state.put_cnt - state.received.load(std::memory_order_seq_cst) >= state.max_in_flight) {
+            if (pthread_cond_timedwait(&state.put_cond, &state.put_lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        state.put_waiting.store(false, std::memory_order_relaxed);
+        pthread_mutex_unlock(&state.put_lock);
+    }
+
+    state.put_cnt++;
+}
+
+/* called from the connector's main loop */
+static void resource_notify_cb(M2MResourceInstance *res)
+{
+    if (strcmp(res->uri_path(), RESOURCE_FROM_DEVICE) == 0) {
+        record_latency(msg_sent_time((const char *)res->value()));
+    }
+}
+
+/* the agent side */
+class MockAgent {
+
+public:
+
+    MockAgent():
+        _listen_fd(-1),
+        _fd(-1),
+        _parser(END_OF_MSG_MARKER),
+        _send_binary(false),
+        _connected(false)
+    {
+    }
+
+    ~MockAgent()
+    {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+        if (_listen_fd >= 0) {
+            close(_listen_fd);
+            unlink(state.config.socket_path);
+        }
+    }
+
+    bool listen()
+    {
+        struct sockaddr_un addr;
+
+        if (!_parser.init(RECV_BUF_SIZE, RECV_BUF_SIZE)) {
+            return false;
+        }
+
+        _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listen_fd < 0) {
+            return false;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, state.config.socket_path, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+
+        if (bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+                ::listen(_listen_fd, 1) < 0) {
+            perror("mock agent: listen");
+            return false;
+        }
+
+        return true;
+    }
+
+    void run()
+    {
+        _fd = accept(_listen_fd, NULL, NULL);
+        if (_fd < 0) {
+            perror("mock agent: accept");
+            return;
+        }
+
+        send_text("ok");
+        send_text("agent: {\"v\": \"bench\", \"type\": \"enebular-agent\"}");
+        if (state.config.text) {
+            send_connect();
+        } else {
+            send_text("framing: binary");
+        }
+
+        /* wait for the client to connect */
+        while (!_connected) {
+            if (!recv_wait(IDLE_TIMEOUT_MS)) {
+                fprintf(stderr, "mock agent: timed out waiting for the connector\n");
+                return;
+            }
+        }
+
+        /* the client only starts sending a little after connecting */
+        sample_cpu_start();
+
+        if (state.config.direction == DIR_FROM_AGENT) {
+            send_msgs();
+        }
+
+        /* wait for everything to arrive (or stop arriving) */
+        uint32_t received = state.received.load(std::memory_order_acquire);
+        while (received < state.config.count) {
+            if (!recv_wait(IDLE_TIMEOUT_MS) &&
+                    state.received.load(std::memory_order_acquire) == received) {
+                break;
+            }
+            received = state.received.load(std::memory_order_acquire);
+        }
+
+        sample_cpu_end();
+    }
+
+private:
+
+    int _listen_fd;
+    int _fd;
+    AgentFrameParser _parser;
+    bool _send_binary;
+    bool _connected;
+
+    void send_iov(struct iovec *iov, int iovcnt)
+    {
+        while (iovcnt > 0) {
+            ssize_t cnt = writev(_fd, iov, iovcnt);
+            if (cnt < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("mock agent: write");
+                return;
+            }
+            while (iovcnt > 0 && (size_t)cnt >= iov->iov_len) {
+                cnt -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = (char *)iov->iov_base + cnt;
+                iov->iov_len -= cnt;
+            }
+        }
+    }
+
+    void send_text(const char *msg)
+    {
+        char term = END_OF_MSG_MARKER;
+        struct iovec iov[2];
+
+        iov[0].iov_base = (void *)msg;
+        iov[0].iov_len = strlen(msg);
+        iov[1].iov_base = &term;
+        iov[1].iov_len = 1;
+
+        send_iov(iov, 2);
+    }
+
+    void send_binary(AgentMsgType type, const char *content, size_t len)
+    {
+        uint8_t header[AGENT_FRAME_LEN_SIZE + 1];
+        uint32_t frame_len = len + 1;
+        struct iovec iov[2];
+
+        header[0] = frame_len >> 24;
+        header[1] = frame_len >> 16;
+        header[2] = frame_len >> 8;
+        header[3] = frame_len;
+        header[4] = type;
+
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = (void *)content;
+        iov[1].iov_len = len;
+
+        send_iov(iov, 2);
+    }
+
+    void send_connect()
+    {
+        if (_send_binary) {
+            send_binary(AGENT_MSG_CONNECT, "", 0);
+        } else {
+            send_text("connect");
+        }
+    }
+
+    void send_ctrl_message(const char *msg, size_t len)
+    {
+        static const char prefix[] = "ctrlMessage: ";
+        char term = END_OF_MSG_MARKER;
+        struct iovec iov[3];
+
+        if (_send_binary) {
+            send_binary(AGENT_MSG_CTRL_MESSAGE, msg, len);
+            return;
+        }
+
+        iov[0].iov_base = (void *)prefix;
+        iov[0].iov_len = sizeof(prefix) - 1;
+        iov[1].iov_base = (void *)msg;
+        iov[1].iov_len = len;
+        iov[2].iov_base = &term;
+        iov[2].iov_len = 1;
+
+        send_iov(iov, 3);
+    }
+
+    void send_msgs()
+    {
+        uint64_t start;
+        size_t len;
+
+        start = now_ns();
+        state.first_sent = start;
+
+        for (uint32_t n = 0; n < state.config.count; n++) {
+            if (state.config.rate > 0) {
+                uint64_t deadline = start + (uint64_t)(n * (NSEC_PER_SEC / state.config.rate));
+                struct timespec ts;
+                ts.tv_sec = deadline / NSEC_PER_SEC;
+                ts.tv_nsec = deadline % NSEC_PER_SEC;
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+                }
+            }
+            char *msg = create_msg(now_ns(), n, &len);
+            if (!msg) {
+                return;
+            }
+            send_ctrl_message(msg, len);
+            free(msg);
+
+            /* keep the connector's messages (logs) from backing up */
+            recv_wait(0);
+        }
+    }
+
+    void handle_msg(char *msg, size_t len)
+    {
+        static const char accept_msg[] = "{\"type\":\"framing\",\"framing\":{\"mode\":\"binary\"}}";
+
+        if (_parser.get_mode() == AGENT_FRAME_MODE_BINARY) {
+            if (len < 1 || (uint8_t)msg[0] != AGENT_MSG_JSON) {
+                return;
+            }
+            msg++;
+        }
+
+        if (strncmp(msg, "{\"type\":\"ctrlMessage\"", 21) == 0) {
+            record_latency(msg_sent_time(msg + 21));
+        } else if (strcmp(msg, accept_msg) == 0) {
+            _parser.set_mode(AGENT_FRAME_MODE_BINARY);
+            send_text("framing: active");
+            _send_binary = true;
+            send_connect();
+        } else if (strcmp(msg, "{\"type\":\"connect\"}") == 0) {
+            _connected = true;
+        }
+    }
+
+    /* waits for and handles data from the connector. false on timeout or error */
+    bool recv_wait(int timeout_ms)
+    {
+        struct pollfd pfd;
+        size_t avail;
+        size_t len;
+        ssize_t cnt;
+        char *msg;
+
+        pfd.fd = _fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return false;
+        }
+
+        do {
+            char *buf = _parser.get_write_buf(&avail);
+            cnt = recv(_fd, buf, avail, MSG_DONTWAIT);
+            if (cnt <= 0) {
+                return (cnt < 0 && (errno == EAGAIN || errno == EINTR));
+            }
+            _parser.commit(cnt);
+            while ((msg = _parser.next_frame(&len)) != NULL) {
+                handle_msg(msg, len);
+            }
+        } while ((size_t)cnt == avail);
+
+        return true;
+    }
+
+};
+
+static void *mock_agent_main(void *arg)
+{
+    MockAgent *agent = (MockAgent *)arg;
+
+    agent->run();
+
+    state.connector->halt();
+
+    return NULL;
+}
+
+static bool write_sim_script(char *path, size_t path_size)
+{
+    char *msg;
+    size_t len;
+    FILE *fp;
+    int fd;
+
+    snprintf(path, path_size, "/tmp/enebular-agent-ipc-bench-XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        return false;
+    }
+
+    msg = create_msg(0, 0, &len);
+    if (!msg) {
+        fclose(fp);
+        return false;
+    }
+
+    /* give the agent time to see the registration first */
+    fprintf(fp, "register\nsleep 100\nloop %u %g\nput %s %s\nend\n",
+        state.config.count, state.config.rate, RESOURCE_TO_DEVICE, msg);
+
+    free(msg);
+    fclose(fp);
+
+    return true;
+}
+
+static bool init_signals()
+{
+    struct sigaction sigact;
+    sigset_t mask;
+
+    /* as in main.cpp: the connector receives these via a signalfd */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+        return false;
+    }
+
+    sigact.sa_flags = 0;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_handler = SIG_IGN;
+
+    return sigaction(SIGPIPE, &sigact, NULL) == 0;
+}
+
+static uint64_t percentile(uint64_t *sorted, uint32_t cnt, double p)
+{
+    uint32_t i = (uint32_t)(p * cnt);
+
+    return sorted[(i < cnt) ? i : cnt - 1];
+}
+
+static void print_header()
+{
+    printf("%-10s %9s %6s %10s %9s %9s %9s %9s %10s %10s\n",
+        "direction", "size", "count", "msgs/s", "MB/s",
+        "p50(us)", "p99(us)", "p999(us)", "loop(us)", "proc(us)");
+}
+
+static void print_result()
+{
+    uint32_t cnt = state.received.load(std::memory_order_acquire);
+    const struct bench_config *c = &state.config;
+
+    /* throughput and latency over the messages that made it would be misleading */
+    if (cnt < c->count) {
+        printf("%-10s %9zu %6u  invalid: %u messages lost\n", direction_names[c->direction], c->size,
+            c->count, c->count - cnt);
+        return;
+    }
+
+    std::sort(state.latencies, state.latencies + cnt);
+
+    double secs = (double)(state.last_received - state.first_sent) / NSEC_PER_SEC;
+    double msgs_per_sec = (secs > 0) ? cnt / secs : 0;
+
+    printf("%-10s %9zu %6u %10.0f %9.2f %9.1f %9.1f %9.1f %10.2f %10.2f\n",
+        direction_names[c->direction], c->size, cnt,
+        msgs_per_sec,
+        msgs_per_sec * c->size / (1000 * 1000),
+        percentile(state.latencies, cnt, 0.50) / 1000.0,
+        percentile(state.latencies, cnt, 0.99) / 1000.0,
+        percentile(state.latencies, cnt, 0.999) / 1000.0,
+        (double)(state.loop_cpu_end - state.loop_cpu_start) / cnt / 1000.0,
+        (double)(state.proc_cpu_end - state.proc_cpu_start) / cnt / 1000.0);
+}
+
+static int run_case()
+{
+    static unsigned int iface = 0xFFFFFFFF;
+    char script_path[64] = { 0 };
+    MockAgent agent;
+    pthread_t agent_thread;
+
+    state.latencies = (uint64_t *)malloc(state.config.count * sizeof(uint64_t));
+    if (!state.latencies || !init_signals()) {
+        return EXIT_FAILURE;
+    }
+    state.main_thread = pthread_self();
+
+    if (state.config.direction == DIR_TO_AGENT) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&state.put_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&state.put_lock, NULL);
+        state.max_in_flight = std::max<size_t>(1, std::min<size_t>(MAX_IN_FLIGHT,
+            MAX_IN_FLIGHT_BYTES / state.config.size));
+        sim_set_put_callback(sim_put_callback(resource_put_cb));
+
+        if (!write_sim_script(script_path, sizeof(script_path))) {
+            fprintf(stderr, "Failed to write the client script\n");
+            return EXIT_FAILURE;
+        }
+        setenv("SIM_CLOUD_SCRIPT", script_path, 1);
+    } else {
+        unsetenv("SIM_CLOUD_SCRIPT");
+        sim_set_notify_callback(sim_notify_callback(resource_notify_cb));
+    }
+
+    if (!agent.listen()) {
+        return EXIT_FAILURE;
+    }
+
+    state.connector = new EnebularAgentMbedCloudConnector(state.config.socket_path, "");
+    if (!state.connector->startup(&iface)) {
+        fprintf(stderr, "Connector startup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (pthread_create(&agent_thread, NULL, mock_agent_main, &agent) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    state.connector->run();
+
+    pthread_join(agent_thread, NULL);
+
+    print_result();
+
+    state.connector->shutdown();
+    delete state.connector;
+
+    if (script_path[0] != '\0') {
+        unlink(script_path);
+    }
+    free(state.latencies);
+
+    return EXIT_SUCCESS;
+}
+
+/* runs a case in a child process, so that each starts from a clean state */
+static int fork_case()
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+
+    pid = fork();
+    if (pid < 0) {
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        exit(run_case());
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return EXIT_FAILURE;
+    }
+
+    return WEXITSTATUS(status);
+}
+
+static void print_usage(const char *name)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "\n"
+        "Without -d or -z, both directions are run for sizes from 100 B to 1 MB.\n"
+        "\n"
+        "Options:\n"
+        "  -d <direction>  to-agent or from-agent\n"
+        "  -z <bytes>      Message size\n"
+        "  -n <count>      Number of messages (default: 64 MB worth, 50 to 20000)\n"
+        "  -r <rate>       Messages per second (default: as fast as possible, with\n"
+        "                  backpressure for to-agent)\n"
+        "  -t              Use text (RS) framing instead of binary framing\n"
+        "  -s <path>       Mock agent socket path (default: %s)\n"
+        "  -h              Show this help\n",
+        name, DEFAULT_SOCKET_PATH);
+}
+
+int main(int argc, char **argv)
+{
+    int direction = -1;
+    size_t size = 0;
+    uint32_t count = 0;
+    int ret = EXIT_SUCCESS;
+    int opt;
+
+    state.config.rate = 0;
+    state.config.text = false;
+    state.config.socket_path = DEFAULT_SOCKET_PATH;
+
+    while ((opt = getopt(argc, argv, "d:z:n:r:ts:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                for (direction = 0; direction < DIR_CNT; direction++) {
+                    if (strcmp(optarg, direction_names[direction]) == 0) {
+                        break;
+                    }
+                }
+                if (direction == DIR_CNT) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'z':
+                size = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                state.config.rate = strtod(optarg, NULL);
+                break;
+            case 't':
+                state.config.text = true;
+                break;
+            case 's':
+                state.config.socket_path = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* keep the connector quiet */
+    Logger::get_instance()->set_level(ERROR);
+
+    print_header();
+
+    for (int d = 0; d < DIR_CNT; d++) {
+        if (direction >= 0 && d != direction) {
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]); i++) {
+            if (size > 0 && i > 0) {
+                break;
+            }
+            state.config.direction = d;
+            state.config.size = (size > 0) ? size : default_sizes[i];
+            state.config.count = count;
+            if (state.config.count == 0) {
+                state.config.count = std::min<size_t>(MAX_COUNT,
+                    std::max<size_t>(MIN_COUNT, DEFAULT_TOTAL_BYTES / state.config.size));
+            }
+            if (fork_case() != EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+            }
+        }
+    }
+
+    return ret;
+}
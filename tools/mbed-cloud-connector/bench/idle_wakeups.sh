@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Measures how often an idle connector process wakes up.
+#
+# Samples the voluntary context switch counts (one per sleep, so one per
+# wakeup) of each of the process's threads over an interval, and prints the
+# wakeups per second of the main thread (the connector's main loop) and of the
+# whole process. Leave the connector and agent idle while measuring.
+#
+# Usage: idle_wakeups.sh <pid> [seconds]
+#
+
+PID=$1
+SECS=${2:-10}
+
+if [ -z "$PID" ] || [ ! -d "/proc/$PID" ]; then
+    echo "Usage: $0 <pid> [seconds]" >&2
+    exit 1
+fi
+
+# prints "<tid> <voluntary_ctxt_switches>" for each thread
+sample() {
+    for task in /proc/$PID/task/*; do
+        tid=${task##*/}
+        cnt=$(awk '/^voluntary_ctxt_switches/ { print $2 }' "$task/status" 2>/dev/null)
+        [ -n "$cnt" ] && echo "$tid $cnt"
+    done
+}
+
+BEFORE=$(sample)
+sleep "$SECS"
+AFTER=$(sample)
+
+printf '%s\n--\n%s\n' "$BEFORE" "$AFTER" | awk -v pid="$PID" -v secs="$SECS" '
+    $1 == "--" { after = 1; next }
+    !after { before[$1] = $2; next }
+    ($1 in before) {
+        d = $2 - before[$1]
+        total += d
+        if ($1 == pid) main = d
+        printf "thread %-8s %8.2f wakeups/s\n", $1, d / secs
+    }
+    END {
+        printf "main loop:  %8.2f wakeups/s\n", main / secs
+        printf "process:    %8.2f wakeups/s\n", total / secs
+    }'
@@ -0,0 +1,703 @@
+/*
+ * Microbenchmarks of the connector's per-message paths.
+ *
+ * Each case is run for a number of rounds of a fixed duration (after a warm up
+ * round), and the time per operation of each round is recorded. The results
+ * are written as JSON, so that runs can be compared across releases:
+ *
+ *   {
+ *     "benchmarks": [
+ *       { "name": "...", "unit": "ns/op", "rounds": 10, "iterations": 123456,
+ *         "min": 12.3, "median": 12.5, "mean": 12.6, "max": 13.1 },
+ *       ...
+ *     ]
+ *   }
+ *
+ * Cases that send to the agent do so with the interface corked, against a
+ * local socket. The queued messages are written and drained between batches,
+ * outside of the measured time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "enebular_agent_mbed_cloud_connector.h"
+
+#define END_OF_MSG_MARKER       (0x1E)
+#define DEFAULT_ROUNDS          (10)
+#define DEFAULT_ROUND_MS        (200)
+#define CONNECT_TIMEOUT_MS      (3000)
+
+#define RESOURCE_TO_DEVICE      "26248/0/26241"
+
+#define NSEC_PER_SEC    (1000000000ULL)
+
+struct bench_case {
+    const char *name;
+    /* the number of operations to run between drains (0 for no limit) */
+    uint32_t max_batch;
+    bool (*setup)();
+    void (*run)(uint32_t cnt);
+    /* not measured */
+    void (*drain)();
+    void (*teardown)();
+};
+
+struct bench_result {
+    uint64_t iterations;
+    double min;
+    double median;
+    double mean;
+    double max;
+};
+
+/* the fixture shared by the cases */
+static EnebularAgentMbedCloudConnector *connector;
+static EnebularAgentInterface *agent;
+static char server_path[64];
+static char connector_path[64];
+static int listen_fd = -1;
+static int server_fd = -1;
+static bool framing_accepted;
+
+static char log_message[] = "Client: to_device: {\"type\":\"deploy\",\"downloadUrl\":\"https://example.com/flow\"}";
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void server_write(const char *msg)
+{
+    char buf[256];
+    size_t len = snprintf(buf, sizeof(buf), "%s%c", msg, END_OF_MSG_MARKER);
+
+    if (write(server_fd, buf, len) != (ssize_t)len) {
+        perror("microbench: write");
+    }
+}
+
+/* reads (and discards) everything the interface has sent */
+static void server_drain()
+{
+    static const char accept_msg[] = "{\"type\":\"framing\",\"framing\":{\"mode\":\"binary\"}}";
+    char buf[64 * 1024];
+    ssize_t cnt;
+
+    while ((cnt = recv(server_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        if (!framing_accepted && memmem(buf, cnt, accept_msg, sizeof(accept_msg) - 1)) {
+            framing_accepted = true;
+        }
+    }
+}
+
+static void agent_drain()
+{
+    agent->uncork();
+    server_drain();
+    agent->cork();
+}
+
+/* called from the main loop until the agent interface is connected */
+static void connect_wait_cb()
+{
+    static uint64_t start = now_ns();
+
+    server_drain();
+
+    if ((agent->is_connected() && framing_accepted) ||
+            now_ns() - start > CONNECT_TIMEOUT_MS * 1000000ULL) {
+        connector->halt();
+    }
+}
+
+/*
+ * Starts up a connector for its main loop, and connects an agent interface of
+ * our own to a local socket standing in for the agent.
+ */
+static bool fixture_setup()
+{
+    static unsigned int iface = 0xFFFFFFFF;
+    struct sockaddr_un addr;
+    sigset_t mask;
+
+    /* as in main.cpp: the connector receives these via a signalfd */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    snprintf(server_path, sizeof(server_path), "/tmp/enebular-microbench-%d.socket", getpid());
+    /* the connector's own interface is left trying to connect to nothing */
+    snprintf(connector_path, sizeof(connector_path), "/tmp/enebular-microbench-%d.none", getpid());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, server_path, sizeof(addr.sun_path) - 1);
+    unlink(addr.sun_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0) {
+        perror("microbench: listen");
+        return false;
+    }
+
+    connector = new EnebularAgentMbedCloudConnector(connector_path, "");
+    if (!connector->startup(&iface)) {
+        return false;
+    }
+
+    agent = new EnebularAgentInterface(connector, server_path);
+    if (!agent->connect()) {
+        return false;
+    }
+
+    /* the interface's connect is made immediately, so there is one to accept */
+    server_fd = accept(listen_fd, NULL, NULL);
+    if (server_fd < 0) {
+        perror("microbench: accept");
+        return false;
+    }
+    server_write("ok");
+    server_write("capabilities: logs");
+    server_write("framing: binary");
+
+    uint32_t timer = connector->add_timer(1, 1, "bench-connect-wait", TimerCB(connect_wait_cb));
+    connector->run();
+    connector->cancel_timer(timer);
+
+    if (!agent->is_connected() || !framing_accepted) {
+        fprintf(stderr, "microbench: agent interface failed to connect\n");
+        return false;
+    }
+
+    Logger::get_instance()->set_agent_interface(agent);
+    agent->cork();
+
+    return true;
+}
+
+static void fixture_teardown()
+{
+    if (agent) {
+        Logger::get_instance()->set_agent_interface(NULL);
+        agent->uncork();
+        agent->disconnect();
+        delete agent;
+    }
+    if (connector) {
+        connector->shutdown();
+        delete connector;
+    }
+    if (server_fd >= 0) {
+        close(server_fd);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(server_path);
+    }
+}
+
+/*
+ * Logger
+ */
+
+/* the writer thread's work is not measured */
+static void logger_drain()
+{
+    Logger::get_instance()->flush();
+    Logger::get_instance()->run();
+    agent_drain();
+}
+
+/* a filtered message with an argument that copies a payload (as a resource's get_value_string() would) */
+static void logger_filtered_run(uint32_t cnt)
+{
+    Logger *logger = Logger::get_instance();
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        logger->log_console(DEBUG, "Agent: received message: [%s]", String(log_message).c_str());
+    }
+}
+
+static void logger_filtered_lazy_run(uint32_t cnt)
+{
+    Logger *logger = Logger::get_instance();
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        LOGGER_LOG_CONSOLE(logger, DEBUG, "Agent: received message: [%s]", String(log_message).c_str());
+    }
+}
+
+static void logger_log_console_run(uint32_t cnt)
+{
+    Logger *logger = Logger::get_instance();
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        logger->log_console(INFO, "Agent: send message: type:%s (%u)", "deviceCommandSend", i);
+    }
+}
+
+static void logger_log_run(uint32_t cnt)
+{
+    Logger *logger = Logger::get_instance();
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        logger->log(INFO, "Client: %s: %u", log_message, i);
+    }
+}
+
+/*
+ * Frame parser (as used by the interface's recv())
+ */
+
+#define FRAMER_MSG_SIZE     (100)
+#define FRAMER_CHUNK_SIZE   (16 * 1024)
+
+static AgentFrameParser *framer;
+static char framer_text_chunk[FRAMER_CHUNK_SIZE];
+static char framer_binary_chunk[FRAMER_CHUNK_SIZE];
+static uint32_t framer_text_frame_cnt;
+static uint32_t framer_binary_frame_cnt;
+
+/* fills a chunk with whole frames of FRAMER_MSG_SIZE */
+static uint32_t framer_fill_chunk(char *chunk, bool binary)
+{
+    size_t frame_size = binary ? AGENT_FRAME_LEN_SIZE + 1 + FRAMER_MSG_SIZE : FRAMER_MSG_SIZE + 1;
+    uint32_t cnt = 0;
+    size_t off = 0;
+
+    while (off + frame_size <= FRAMER_CHUNK_SIZE) {
+        char *frame = chunk + off;
+        if (binary) {
+            uint32_t len = FRAMER_MSG_SIZE + 1;
+            frame[0] = len >> 24;
+            frame[1] = len >> 16;
+            frame[2] = len >> 8;
+            frame[3] = len;
+            frame[4] = AGENT_MSG_CTRL_MESSAGE;
+            memset(frame + AGENT_FRAME_LEN_SIZE + 1, 'x', FRAMER_MSG_SIZE);
+        } else {
+            memcpy(frame, "ctrlMessage: ", 13);
+            memset(frame + 13, 'x', FRAMER_MSG_SIZE - 13);
+            frame[FRAMER_MSG_SIZE] = END_OF_MSG_MARKER;
+        }
+        off += frame_size;
+        cnt++;
+    }
+    memset(chunk + off, 0, FRAMER_CHUNK_SIZE - off);
+
+    return cnt;
+}
+
+static bool framer_setup()
+{
+    framer = new AgentFrameParser(END_OF_MSG_MARKER);
+    if (!framer->init(64 * 1024, 1024 * 1024)) {
+        return false;
+    }
+    framer_text_frame_cnt = framer_fill_chunk(framer_text_chunk, false);
+    framer_binary_frame_cnt = framer_fill_chunk(framer_binary_chunk, true);
+
+    return true;
+}
+
+static void framer_teardown()
+{
+    delete framer;
+    framer = NULL;
+}
+
+/* feeds whole chunks until cnt frames have been parsed (one op is one frame) */
+static void framer_run(const char *chunk, uint32_t frames_per_chunk, uint32_t cnt)
+{
+    uint32_t frames = 0;
+    size_t avail;
+    size_t len;
+
+    while (frames < cnt) {
+        size_t off = 0;
+        uint32_t chunk_frames = 0;
+        while (off < FRAMER_CHUNK_SIZE && chunk_frames < frames_per_chunk) {
+            char *buf = framer->get_write_buf(&avail);
+            size_t n = std::min(avail, (size_t)FRAMER_CHUNK_SIZE - off);
+            memcpy(buf, chunk + off, n);
+            framer->commit(n);
+            off += n;
+            while (framer->next_frame(&len) != NULL) {
+                chunk_frames++;
+            }
+        }
+        frames += chunk_frames;
+    }
+}
+
+static bool framer_text_setup()
+{
+    if (!framer_setup()) {
+        return false;
+    }
+    framer->set_mode(AGENT_FRAME_MODE_TEXT);
+    return true;
+}
+
+static void framer_text_run(uint32_t cnt)
+{
+    framer_run(framer_text_chunk, framer_text_frame_cnt, cnt);
+}
+
+static bool framer_binary_setup()
+{
+    if (!framer_setup()) {
+        return false;
+    }
+    framer->set_mode(AGENT_FRAME_MODE_BINARY);
+    return true;
+}
+
+static void framer_binary_run(uint32_t cnt)
+{
+    framer_run(framer_binary_chunk, framer_binary_frame_cnt, cnt);
+}
+
+/*
+ * Agent interface messages
+ */
+
+static SharedBuffer *message_content;
+
+static bool send_message_setup()
+{
+    static const char content[] =
+        "{\"type\":\"deploy\",\"downloadUrl\":\"https://example.com/flow\",\"assetId\":\"0123456789\"}";
+
+    message_content = SharedBuffer::create(content, sizeof(content) - 1);
+
+    return message_content != NULL;
+}
+
+static void send_message_run(uint32_t cnt)
+{
+    for (uint32_t i = 0; i < cnt; i++) {
+        agent->send_message("deviceCommandSend", message_content);
+    }
+}
+
+static void send_message_teardown()
+{
+    message_content->unref();
+    message_content = NULL;
+}
+
+static void send_log_message_run(uint32_t cnt)
+{
+    for (uint32_t i = 0; i < cnt; i++) {
+        agent->send_log_message("info", "Mbed Cloud", log_message);
+    }
+}
+
+/*
+ * Client -> main loop hand-off (queue_agent_man_msg()/notify_agent_man_msgs())
+ */
+
+#define HAND_OFF_BATCH  (128)
+
+static EnebularAgentMbedCloudClient *client;
+static M2MResource *to_device;
+static uint32_t hand_off_cnt;
+
+static void agent_man_msg_cb(const char *type, SharedBuffer *content)
+{
+    hand_off_cnt++;
+}
+
+static bool hand_off_setup()
+{
+    static const char value[] = "{\"type\":\"deploy\",\"downloadUrl\":\"https://example.com/flow\"}";
+
+    client = new EnebularAgentMbedCloudClient(connector, "");
+    if (!client->setup()) {
+        return false;
+    }
+    client->on_agent_manager_message(AgentManagerMessageCB(agent_man_msg_cb));
+
+    to_device = sim_find_resource(RESOURCE_TO_DEVICE);
+    if (!to_device) {
+        return false;
+    }
+    to_device->set_value((const uint8_t *)value, sizeof(value) - 1);
+
+    return true;
+}
+
+/* the value updated callback is what the client's thread would call */
+static void hand_off_run(uint32_t cnt)
+{
+    uint32_t i = 0;
+
+    while (i < cnt) {
+        uint32_t batch = std::min<uint32_t>(HAND_OFF_BATCH, cnt - i);
+        for (uint32_t j = 0; j < batch; j++) {
+            to_device->execute_value_updated();
+        }
+        client->run();
+        i += batch;
+    }
+}
+
+static void hand_off_teardown()
+{
+    delete client;
+    client = NULL;
+    to_device = NULL;
+}
+
+/*
+ * Client object setup (add_resource())
+ */
+
+static void client_setup_run(uint32_t cnt)
+{
+    for (uint32_t i = 0; i < cnt; i++) {
+        EnebularAgentMbedCloudClient *c = new EnebularAgentMbedCloudClient(connector, "");
+        c->setup();
+        delete c;
+    }
+}
+
+/*
+ * Flight recorder
+ */
+
+static FlightRecorder *recorder;
+static char recorder_path[64];
+
+static bool recorder_setup()
+{
+    snprintf(recorder_path, sizeof(recorder_path), "/tmp/enebular-microbench-%d.recorder", getpid());
+    recorder = new FlightRecorder();
+
+    return recorder->open(recorder_path, FLIGHT_RECORDER_DEFAULT_SIZE);
+}
+
+static void recorder_run(uint32_t cnt)
+{
+    size_t len = strlen(log_message);
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        recorder->write(DEBUG, i, log_message, len);
+    }
+}
+
+static void recorder_teardown()
+{
+    delete recorder;
+    recorder = NULL;
+    unlink(recorder_path);
+}
+
+static const struct bench_case bench_cases[] = {
+    { "logger.filtered",            0,      NULL,                   logger_filtered_run,        NULL,           NULL },
+    { "logger.filtered_lazy",       0,      NULL,                   logger_filtered_lazy_run,   NULL,           NULL },
+    { "logger.log_console",         256,    NULL,                   logger_log_console_run,     logger_drain,   NULL },
+    { "logger.log",                 256,    NULL,                   logger_log_run,             logger_drain,   NULL },
+    { "framer.text",                0,      framer_text_setup,      framer_text_run,            NULL,           framer_teardown },
+    { "framer.binary",              0,      framer_binary_setup,    framer_binary_run,          NULL,           framer_teardown },
+    { "agent.send_message",         256,    send_message_setup,     send_message_run,           agent_drain,    send_message_teardown },
+    { "agent.send_log_message",     256,    NULL,                   send_log_message_run,       agent_drain,    NULL },
+    { "recorder.write",             0,      recorder_setup,         recorder_run,               NULL,           recorder_teardown },
+    { "client.hand_off",            0,      hand_off_setup,         hand_off_run,               NULL,           hand_off_teardown },
+    { "client.setup_objects",       64,     NULL,                   client_setup_run,           logger_drain,   NULL },
+};
+
+#define BENCH_CASE_CNT (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+/* runs cnt operations, returning the time taken (excluding drains) */
+static uint64_t run_ops(const struct bench_case *c, uint64_t cnt)
+{
+    uint64_t elapsed = 0;
+
+    while (cnt > 0) {
+        uint32_t batch = (c->max_batch > 0) ? std::min<uint64_t>(c->max_batch, cnt) :
+            std::min<uint64_t>(UINT32_MAX, cnt);
+        uint64_t start = now_ns();
+        c->run(batch);
+        elapsed += now_ns() - start;
+        if (c->drain) {
+            c->drain();
+        }
+        cnt -= batch;
+    }
+
+    return elapsed;
+}
+
+static void run_case(const struct bench_case *c, int rounds, uint32_t round_ms,
+        struct bench_result *result)
+{
+    uint64_t round_ns = (uint64_t)round_ms * 1000000;
+    vector<double> per_op;
+    uint64_t cnt = 1;
+    uint64_t elapsed;
+    double sum = 0;
+
+    /* calibrate the number of operations per round (and warm up) */
+    while ((elapsed = run_ops(c, cnt)) < round_ns / 10) {
+        cnt *= 2;
+    }
+    cnt = std::max<uint64_t>(1, cnt * round_ns / std::max<uint64_t>(1, elapsed));
+
+    for (int i = 0; i < rounds; i++) {
+        per_op.push_back((double)run_ops(c, cnt) / cnt);
+        sum += per_op.back();
+    }
+    std::sort(per_op.begin(), per_op.end());
+
+    result->iterations = cnt;
+    result->min = per_op.front();
+    result->max = per_op.back();
+    result->mean = sum / rounds;
+    result->median = (rounds % 2) ? per_op[rounds / 2] :
+        (per_op[rounds / 2 - 1] + per_op[rounds / 2]) / 2;
+}
+
+static void print_usage(const char *name)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  -f <filter>  Only run the cases whose name contains filter\n"
+        "  -r <rounds>  Measured rounds per case (default: %d)\n"
+        "  -t <ms>      Duration of each round (default: %d)\n"
+        "  -o <file>    Write the JSON results to file instead of stdout\n"
+        "  -l           List the cases\n"
+        "  -h           Show this help\n",
+        name, DEFAULT_ROUNDS, DEFAULT_ROUND_MS);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    const char *out_path = NULL;
+    int rounds = DEFAULT_ROUNDS;
+    uint32_t round_ms = DEFAULT_ROUND_MS;
+    bool first = true;
+    FILE *out;
+    int ret = EXIT_SUCCESS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:r:t:o:lh")) != -1) {
+        switch (opt) {
+            case 'f':
+                filter = optarg;
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 't':
+                round_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'l':
+                for (size_t i = 0; i < BENCH_CASE_CNT; i++) {
+                    printf("%s\n", bench_cases[i].name);
+                }
+                return EXIT_SUCCESS;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (rounds < 1 || round_ms < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (out_path) {
+        out = fopen(out_path, "w");
+    } else {
+        out = fdopen(dup(STDOUT_FILENO), "w");
+    }
+    if (!out) {
+        fprintf(stderr, "Failed to open %s: %s\n", out_path ? out_path : "stdout", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* the logger's console output (which goes to stdout) is discarded */
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Failed to redirect stdout: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    close(null_fd);
+
+    Logger::get_instance()->set_level(INFO);
+    Logger::get_instance()->enable_console(true);
+
+    if (!fixture_setup()) {
+        fprintf(stderr, "Benchmark setup failed\n");
+        fixture_teardown();
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "{\n  \"benchmarks\": [");
+
+    for (size_t i = 0; i < BENCH_CASE_CNT; i++) {
+        const struct bench_case *c = &bench_cases[i];
+        struct bench_result result;
+
+        if (filter && !strstr(c->name, filter)) {
+            continue;
+        }
+        if (c->setup && !c->setup()) {
+            fprintf(stderr, "%s: setup failed\n", c->name);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        run_case(c, rounds, round_ms, &result);
+
+        if (c->teardown) {
+            c->teardown();
+        }
+
+        fprintf(out, "%s\n    { \"name\": \"%s\", \"unit\": \"ns/op\", \"rounds\": %d, \"iterations\": %llu, "
+            "\"min\": %.1f, \"median\": %.1f, \"mean\": %.1f, \"max\": %.1f }",
+            first ? "" : ",", c->name, rounds, (unsigned long long)result.iterations,
+            result.min, result.median, result.mean, result.max);
+        first = false;
+
+        fprintf(stderr, "%-26s %10.1f ns/op\n", c->name, result.median);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    fclose(out);
+
+    fixture_teardown();
+
+    return ret;
+}
@@ -0,0 +1,36 @@
+#ifndef SIM_FACTORY_CONFIGURATOR_CLIENT_H
+#define SIM_FACTORY_CONFIGURATOR_CLIENT_H
+
+/*
+ * Factory configurator client for the host build.
+ *
+ * There are no credentials to configure, so the device is always reported as
+ * being configured.
+ */
+
+typedef enum {
+    FCC_STATUS_SUCCESS,
+    FCC_STATUS_ERROR,
+    FCC_STATUS_MEMORY_OUT,
+    FCC_STATUS_INVALID_PARAMETER,
+    FCC_STATUS_STORE_ERROR,
+    FCC_STATUS_INTERNAL_ITEM_ALREADY_EXIST,
+    FCC_STATUS_KCM_ERROR,
+    FCC_STATUS_KCM_STORAGE_ERROR,
+    FCC_STATUS_KCM_FILE_EXIST_ERROR,
+    FCC_STATUS_NOT_INITIALIZED,
+} fcc_status_e;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+fcc_status_e fcc_init(void);
+fcc_status_e fcc_finalize(void);
+fcc_status_e fcc_verify_device_configured_4mbed_cloud(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_FACTORY_CONFIGURATOR_CLIENT_H
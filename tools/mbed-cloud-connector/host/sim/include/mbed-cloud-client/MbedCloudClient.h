@@ -0,0 +1,536 @@
+#ifndef SIM_MBED_CLOUD_CLIENT_H
+#define SIM_MBED_CLOUD_CLIENT_H
+
+/*
+ * Simulated Mbed Cloud Client for the host build.
+ *
+ * This provides the subset of the Mbed Cloud Client API that the connector
+ * uses, with the same names and signatures, so that the connector's sources
+ * build unchanged. Instead of connecting to Mbed Cloud, the client runs a
+ * script of registration, resource update (PUT) and error events from its own
+ * thread (see mbed_cloud_client_sim.cpp for the script format).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/* the mbed client headers bring these in */
+using namespace std;
+
+typedef std::string String;
+
+/**
+ * Function pointer with no arguments (see mbed's FunctionPointer).
+ */
+template <typename R>
+class FP0 {
+
+public:
+
+    FP0(R (*function)() = NULL)
+    {
+        attach(function);
+    }
+
+    template <typename T>
+    FP0(T *object, R (T::*member)())
+    {
+        attach(object, member);
+    }
+
+    void attach(R (*function)())
+    {
+        _function = function;
+        _object = NULL;
+        _thunk = NULL;
+    }
+
+    template <typename T>
+    void attach(T *object, R (T::*member)())
+    {
+        _function = NULL;
+        _object = object;
+        memcpy(_member, (char *)&member, sizeof(member));
+        _thunk = &FP0::template member_thunk<T>;
+    }
+
+    R call()
+    {
+        if (_function) {
+            return _function();
+        }
+        if (_object) {
+            return _thunk(_object, _member);
+        }
+        return R();
+    }
+
+    R operator()()
+    {
+        return call();
+    }
+
+private:
+
+    class Dummy;
+
+    template <typename T>
+    static R member_thunk(void *object, const char *member)
+    {
+        R (T::*m)();
+        memcpy((char *)&m, member, sizeof(m));
+        return (((T *)object)->*m)();
+    }
+
+    R (*_function)();
+    void *_object;
+    char _member[sizeof(void (Dummy::*)())];
+    R (*_thunk)(void *, const char *);
+
+};
+
+/**
+ * Function pointer with one argument (see mbed's FunctionPointer).
+ */
+template <typename R, typename A1>
+class FP1 {
+
+public:
+
+    FP1(R (*function)(A1) = NULL)
+    {
+        attach(function);
+    }
+
+    template <typename T>
+    FP1(T *object, R (T::*member)(A1))
+    {
+        attach(object, member);
+    }
+
+    void attach(R (*function)(A1))
+    {
+        _function = function;
+        _object = NULL;
+        _thunk = NULL;
+    }
+
+    template <typename T>
+    void attach(T *object, R (T::*member)(A1))
+    {
+        _function = NULL;
+        _object = object;
+        memcpy(_member, (char *)&member, sizeof(member));
+        _thunk = &FP1::template member_thunk<T>;
+    }
+
+    R call(A1 a1)
+    {
+        if (_function) {
+            return _function(a1);
+        }
+        if (_object) {
+            return _thunk(_object, _member, a1);
+        }
+        return R();
+    }
+
+    R operator()(A1 a1)
+    {
+        return call(a1);
+    }
+
+private:
+
+    class Dummy;
+
+    template <typename T>
+    static R member_thunk(void *object, const char *member, A1 a1)
+    {
+        R (T::*m)(A1);
+        memcpy((char *)&m, member, sizeof(m));
+        return (((T *)object)->*m)(a1);
+    }
+
+    R (*_function)(A1);
+    void *_object;
+    char _member[sizeof(void (Dummy::*)())];
+    R (*_thunk)(void *, const char *, A1);
+
+};
+
+/**
+ * Function pointer with two arguments (see mbed's FunctionPointer).
+ */
+template <typename R, typename A1, typename A2>
+class FP2 {
+
+public:
+
+    FP2(R (*function)(A1, A2) = NULL)
+    {
+        attach(function);
+    }
+
+    template <typename T>
+    FP2(T *object, R (T::*member)(A1, A2))
+    {
+        attach(object, member);
+    }
+
+    void attach(R (*function)(A1, A2))
+    {
+        _function = function;
+        _object = NULL;
+        _thunk = NULL;
+    }
+
+    template <typename T>
+    void attach(T *object, R (T::*member)(A1, A2))
+    {
+        _function = NULL;
+        _object = object;
+        memcpy(_member, (char *)&member, sizeof(member));
+        _thunk = &FP2::template member_thunk<T>;
+    }
+
+    R call(A1 a1, A2 a2)
+    {
+        if (_function) {
+            return _function(a1, a2);
+        }
+        if (_object) {
+            return _thunk(_object, _member, a1, a2);
+        }
+        return R();
+    }
+
+    R operator()(A1 a1, A2 a2)
+    {
+        return call(a1, a2);
+    }
+
+private:
+
+    class Dummy;
+
+    template <typename T>
+    static R member_thunk(void *object, const char *member, A1 a1, A2 a2)
+    {
+        R (T::*m)(A1, A2);
+        memcpy((char *)&m, member, sizeof(m));
+        return (((T *)object)->*m)(a1, a2);
+    }
+
+    R (*_function)(A1, A2);
+    void *_object;
+    char _member[sizeof(void (Dummy::*)())];
+    R (*_thunk)(void *, const char *, A1, A2);
+
+};
+
+typedef FP1<void, const char *> value_updated_callback;
+typedef FP1<void, void *> execute_callback;
+
+class M2MObject;
+class M2MObjectInstance;
+class M2MResource;
+
+class M2MBase {
+
+public:
+
+    typedef enum {
+        Object = 0x0,
+        Resource = 0x1,
+        ObjectInstance = 0x2,
+        ResourceInstance = 0x3,
+        ObjectDirectory = 0x4
+    } BaseType;
+
+    typedef enum {
+        NOT_ALLOWED = 0x00,
+        GET_ALLOWED = 0x01,
+        PUT_ALLOWED = 0x02,
+        GET_PUT_ALLOWED = 0x03,
+        POST_ALLOWED = 0x04,
+        GET_POST_ALLOWED = 0x05,
+        PUT_POST_ALLOWED = 0x06,
+        GET_PUT_POST_ALLOWED = 0x07,
+        DELETE_ALLOWED = 0x08
+    } Operation;
+
+    M2MBase(const String &name, const String &uri_path);
+    virtual ~M2MBase();
+
+    const char *name() const;
+    int32_t name_id() const;
+    const char *uri_path() const;
+    Operation operation() const;
+    void set_operation(Operation operation);
+    uint32_t max_age() const;
+    void set_max_age(uint32_t max_age);
+    bool is_observable() const;
+    void set_observable(bool observable);
+
+private:
+
+    String _name;
+    String _uri_path;
+    Operation _operation;
+    uint32_t _max_age;
+    bool _observable;
+
+};
+
+class M2MResourceInstance : public M2MBase {
+
+public:
+
+    typedef enum {
+        STRING,
+        INTEGER,
+        FLOAT,
+        BOOLEAN,
+        OPAQUE,
+        TIME,
+        OBJLINK
+    } ResourceType;
+
+    M2MResourceInstance(const String &name, const String &uri_path,
+            const String &resource_type, ResourceType type);
+    virtual ~M2MResourceInstance();
+
+    const char *resource_type() const;
+    ResourceType resource_instance_type() const;
+
+    bool set_value(const uint8_t *value, const uint32_t value_length);
+    uint8_t *value() const;
+    uint32_t value_length() const;
+    String get_value_string() const;
+
+    bool set_value_updated_function(value_updated_callback callback);
+    bool set_execute_function(execute_callback callback);
+
+    /* simulation only: notifies the value updated function */
+    void execute_value_updated();
+
+private:
+
+    String _resource_type;
+    ResourceType _type;
+    uint8_t *_value;
+    uint32_t _value_length;
+    value_updated_callback _value_updated_cb;
+    execute_callback _execute_cb;
+
+};
+
+class M2MResource : public M2MResourceInstance {
+
+public:
+
+    M2MResource(const String &name, const String &uri_path, const String &resource_type,
+            ResourceType type, bool observable);
+
+};
+
+/**
+ * Simulation only: called whenever an observable resource's value is set (when
+ * the real client would notify Mbed Cloud), from the thread that set it.
+ */
+typedef FP1<void, M2MResourceInstance *> sim_notify_callback;
+
+void sim_set_notify_callback(sim_notify_callback callback);
+
+/**
+ * Simulation only: finds a resource by its path ("object/instance/resource").
+ * If more than one exists (with more than one client), the most recently
+ * created is returned.
+ */
+M2MResource *sim_find_resource(const char *path);
+
+class M2MObjectInstance : public M2MBase {
+
+public:
+
+    M2MObjectInstance(uint16_t instance_id, const String &uri_path);
+    virtual ~M2MObjectInstance();
+
+    uint16_t instance_id() const;
+
+    M2MResource *create_dynamic_resource(const String &resource_name,
+            const String &resource_type,
+            M2MResourceInstance::ResourceType type,
+            bool observable,
+            bool multiple_instance = false,
+            bool external_blockwise_store = false);
+
+    M2MResource *resource(const String &name) const;
+
+private:
+
+    uint16_t _instance_id;
+    vector<M2MResource *> _resources;
+
+};
+
+class M2MObject : public M2MBase {
+
+public:
+
+    M2MObject(const String &name);
+    virtual ~M2MObject();
+
+    M2MObjectInstance *create_object_instance(uint16_t instance_id = 0);
+    M2MObjectInstance *object_instance(uint16_t instance_id = 0) const;
+
+private:
+
+    vector<M2MObjectInstance *> _instances;
+
+};
+
+typedef vector<M2MObject *> M2MObjectList;
+
+class M2MInterfaceFactory {
+
+public:
+
+    static M2MObject *create_object(const String &name);
+
+};
+
+class ConnectorClientEndpointInfo {
+
+public:
+
+    String endpoint_name;
+    String internal_endpoint_name;
+    String account_id;
+
+};
+
+class MbedCloudClientCallback {
+
+public:
+
+    virtual void value_updated(M2MBase *base, M2MBase::BaseType type) = 0;
+    virtual ~MbedCloudClientCallback() {}
+
+};
+
+/**
+ * Simulation only: called before each scripted put, from the simulation
+ * thread, with the resource about to be set. It may block to hold the script
+ * back (e.g. to apply backpressure).
+ */
+typedef FP1<void, M2MResourceInstance *> sim_put_callback;
+
+void sim_set_put_callback(sim_put_callback callback);
+
+struct sim_event;
+
+class MbedCloudClient {
+
+public:
+
+    typedef enum {
+        ConnectErrorNone                        = 0x0,
+        ConnectAlreadyExists,
+        ConnectBootstrapFailed,
+        ConnectInvalidParameters,
+        ConnectNotRegistered,
+        ConnectTimeout,
+        ConnectNetworkError,
+        ConnectResponseParseFailed,
+        ConnectUnknownError,
+        ConnectMemoryConnectFail,
+        ConnectNotAllowed,
+        ConnectSecureConnectionFailed,
+        ConnectDnsResolvingFailed,
+        ConnectorFailedToStoreCredentials,
+        ConnectorFailedToReadCredentials,
+        ConnectorInvalidCredentials,
+    } Error;
+
+    MbedCloudClient();
+    ~MbedCloudClient();
+
+    void add_objects(const M2MObjectList &object_list);
+
+    template <typename T>
+    void on_registered(T *object, void (T::*member)(void))
+    {
+        _on_registered.attach(object, member);
+    }
+
+    template <typename T>
+    void on_registration_updated(T *object, void (T::*member)(void))
+    {
+        _on_registration_updated.attach(object, member);
+    }
+
+    template <typename T>
+    void on_unregistered(T *object, void (T::*member)(void))
+    {
+        _on_unregistered.attach(object, member);
+    }
+
+    template <typename T>
+    void on_error(T *object, void (T::*member)(int))
+    {
+        _on_error.attach(object, member);
+    }
+
+    void set_update_callback(MbedCloudClientCallback *callback);
+
+    /**
+     * Starts the simulation thread, which runs the event script.
+     */
+    bool setup(void *iface);
+
+    /**
+     * Stops the simulation thread.
+     */
+    void close();
+
+    const ConnectorClientEndpointInfo *endpoint_info() const;
+
+    const char *error_description() const;
+
+private:
+
+    M2MObjectList _objects;
+    FP0<void> _on_registered;
+    FP0<void> _on_registration_updated;
+    FP0<void> _on_unregistered;
+    FP1<void, int> _on_error;
+    MbedCloudClientCallback *_update_callback;
+    ConnectorClientEndpointInfo _endpoint_info;
+    const char *_error_description;
+
+    vector<struct sim_event> *_script;
+    pthread_t _thread;
+    bool _thread_started;
+    bool _registered;
+    bool _stop;
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+
+    static void *thread_main(void *arg);
+    void run_script();
+    bool run_events(size_t start, size_t end, uint32_t loop_n);
+    bool run_event(const struct sim_event &ev, uint32_t loop_n);
+    bool sleep_until(uint64_t deadline_ns);
+
+    /* not copyable */
+    MbedCloudClient(const MbedCloudClient &);
+    MbedCloudClient &operator=(const MbedCloudClient &);
+
+};
+
+#endif // SIM_MBED_CLOUD_CLIENT_H
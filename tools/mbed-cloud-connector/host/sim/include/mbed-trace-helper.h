@@ -0,0 +1,18 @@
+#ifndef SIM_MBED_TRACE_HELPER_H
+#define SIM_MBED_TRACE_HELPER_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool mbed_trace_helper_create_mutex(void);
+void mbed_trace_helper_mutex_wait(void);
+void mbed_trace_helper_mutex_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_MBED_TRACE_HELPER_H
@@ -0,0 +1,59 @@
+#ifndef SIM_MBED_TRACE_H
+#define SIM_MBED_TRACE_H
+
+/*
+ * mbed-trace for the host build.
+ *
+ * A subset of the real API, enough for the connector and the simulated client
+ * to trace with. Lines are formatted as the real mbed-trace does without
+ * color ("[LEVL][grp ]: message").
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_LEVEL_DEBUG           0x10
+#define TRACE_LEVEL_INFO            0x08
+#define TRACE_LEVEL_WARN            0x04
+#define TRACE_LEVEL_ERROR           0x02
+#define TRACE_LEVEL_CMD             0x01
+
+#define TRACE_ACTIVE_LEVEL_ALL      0x1F
+#define TRACE_ACTIVE_LEVEL_DEBUG    0x1F
+#define TRACE_ACTIVE_LEVEL_INFO     0x0F
+#define TRACE_ACTIVE_LEVEL_WARN     0x07
+#define TRACE_ACTIVE_LEVEL_ERROR    0x03
+#define TRACE_ACTIVE_LEVEL_CMD      0x01
+#define TRACE_ACTIVE_LEVEL_NONE     0x00
+
+#define TRACE_MODE_COLOR            0x80
+#define TRACE_MODE_PLAIN            0x40
+#define TRACE_CARRIAGE_RETURN       0x20
+#define TRACE_MASK_LEVEL            0x1F
+
+/* TRACE_GROUP must be defined before using these */
+#define tr_debug(...)   mbed_tracef(TRACE_LEVEL_DEBUG, TRACE_GROUP, __VA_ARGS__)
+#define tr_info(...)    mbed_tracef(TRACE_LEVEL_INFO, TRACE_GROUP, __VA_ARGS__)
+#define tr_warn(...)    mbed_tracef(TRACE_LEVEL_WARN, TRACE_GROUP, __VA_ARGS__)
+#define tr_err(...)     mbed_tracef(TRACE_LEVEL_ERROR, TRACE_GROUP, __VA_ARGS__)
+#define tr_error(...)   tr_err(__VA_ARGS__)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int mbed_trace_init(void);
+void mbed_trace_free(void);
+void mbed_trace_config_set(uint8_t config);
+uint8_t mbed_trace_config_get(void);
+void mbed_trace_print_function_set(void (*print_f)(const char *));
+void mbed_trace_mutex_wait_function_set(void (*mutex_wait_f)(void));
+void mbed_trace_mutex_release_function_set(void (*mutex_release_f)(void));
+void mbed_tracef(uint8_t dlevel, const char *grp, const char *fmt, ...)
+    __attribute__ ((__format__(__printf__, 3, 4)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_MBED_TRACE_H
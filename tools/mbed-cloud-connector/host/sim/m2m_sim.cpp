@@ -0,0 +1,288 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "mbed-cloud-client/MbedCloudClient.h"
+
+/*
+ * Simulated M2M object model. Objects, instances and resources are only kept
+ * well enough for the simulated client to find resources by path and to
+ * store their values.
+ */
+
+static sim_notify_callback notify_cb;
+static vector<M2MObject *> objects;
+
+void sim_set_notify_callback(sim_notify_callback callback)
+{
+    notify_cb = callback;
+}
+
+M2MResource *sim_find_resource(const char *path)
+{
+    char object_name[16];
+    unsigned int instance_id;
+    char resource_name[16];
+
+    if (sscanf(path, "%15[0-9]/%u/%15[0-9]", object_name, &instance_id, resource_name) != 3) {
+        return NULL;
+    }
+
+    vector<M2MObject *>::reverse_iterator it;
+    for (it = objects.rbegin(); it != objects.rend(); it++) {
+        if (strcmp((*it)->name(), object_name)) {
+            continue;
+        }
+        M2MObjectInstance *inst = (*it)->object_instance(instance_id);
+        return inst ? inst->resource(resource_name) : NULL;
+    }
+
+    return NULL;
+}
+
+M2MBase::M2MBase(const String &name, const String &uri_path):
+    _name(name),
+    _uri_path(uri_path),
+    _operation(NOT_ALLOWED),
+    _max_age(0),
+    _observable(false)
+{
+}
+
+M2MBase::~M2MBase()
+{
+}
+
+const char *M2MBase::name() const
+{
+    return _name.c_str();
+}
+
+int32_t M2MBase::name_id() const
+{
+    return atoi(_name.c_str());
+}
+
+const char *M2MBase::uri_path() const
+{
+    return _uri_path.c_str();
+}
+
+M2MBase::Operation M2MBase::operation() const
+{
+    return _operation;
+}
+
+void M2MBase::set_operation(Operation operation)
+{
+    _operation = operation;
+}
+
+uint32_t M2MBase::max_age() const
+{
+    return _max_age;
+}
+
+void M2MBase::set_max_age(uint32_t max_age)
+{
+    _max_age = max_age;
+}
+
+bool M2MBase::is_observable() const
+{
+    return _observable;
+}
+
+void M2MBase::set_observable(bool observable)
+{
+    _observable = observable;
+}
+
+M2MResourceInstance::M2MResourceInstance(const String &name, const String &uri_path,
+        const String &resource_type, ResourceType type):
+    M2MBase(name, uri_path),
+    _resource_type(resource_type),
+    _type(type),
+    _value(NULL),
+    _value_length(0)
+{
+}
+
+M2MResourceInstance::~M2MResourceInstance()
+{
+    free(_value);
+}
+
+const char *M2MResourceInstance::resource_type() const
+{
+    return _resource_type.c_str();
+}
+
+M2MResourceInstance::ResourceType M2MResourceInstance::resource_instance_type() const
+{
+    return _type;
+}
+
+bool M2MResourceInstance::set_value(const uint8_t *value, const uint32_t value_length)
+{
+    uint8_t *new_value;
+
+    /* kept nul terminated, as with the real client */
+    new_value = (uint8_t *)malloc(value_length + 1);
+    if (!new_value) {
+        return false;
+    }
+    if (value_length > 0) {
+        memcpy(new_value, value, value_length);
+    }
+    new_value[value_length] = '\0';
+
+    free(_value);
+    _value = new_value;
+    _value_length = value_length;
+
+    if (is_observable()) {
+        notify_cb.call(this);
+    }
+
+    return true;
+}
+
+uint8_t *M2MResourceInstance::value() const
+{
+    return _value;
+}
+
+uint32_t M2MResourceInstance::value_length() const
+{
+    return _value_length;
+}
+
+String M2MResourceInstance::get_value_string() const
+{
+    return _value ? String((const char *)_value, _value_length) : String();
+}
+
+bool M2MResourceInstance::set_value_updated_function(value_updated_callback callback)
+{
+    _value_updated_cb = callback;
+    return true;
+}
+
+bool M2MResourceInstance::set_execute_function(execute_callback callback)
+{
+    _execute_cb = callback;
+    return true;
+}
+
+void M2MResourceInstance::execute_value_updated()
+{
+    _value_updated_cb.call(uri_path());
+}
+
+M2MResource::M2MResource(const String &name, const String &uri_path, const String &resource_type,
+        ResourceType type, bool observable):
+    M2MResourceInstance(name, uri_path, resource_type, type)
+{
+    set_observable(observable);
+}
+
+M2MObjectInstance::M2MObjectInstance(uint16_t instance_id, const String &uri_path):
+    M2MBase(uri_path.substr(uri_path.rfind('/') + 1), uri_path),
+    _instance_id(instance_id)
+{
+}
+
+M2MObjectInstance::~M2MObjectInstance()
+{
+    vector<M2MResource *>::iterator it;
+    for (it = _resources.begin(); it != _resources.end(); it++) {
+        delete *it;
+    }
+}
+
+uint16_t M2MObjectInstance::instance_id() const
+{
+    return _instance_id;
+}
+
+M2MResource *M2MObjectInstance::create_dynamic_resource(const String &resource_name,
+        const String &resource_type,
+        M2MResourceInstance::ResourceType type,
+        bool observable,
+        bool multiple_instance,
+        bool external_blockwise_store)
+{
+    M2MResource *res;
+
+    if (resource(resource_name)) {
+        return NULL;
+    }
+
+    res = new M2MResource(resource_name, String(uri_path()) + "/" + resource_name,
+        resource_type, type, observable);
+    _resources.push_back(res);
+
+    return res;
+}
+
+M2MResource *M2MObjectInstance::resource(const String &name) const
+{
+    vector<M2MResource *>::const_iterator it;
+    for (it = _resources.begin(); it != _resources.end(); it++) {
+        if (name == (*it)->name()) {
+            return *it;
+        }
+    }
+
+    return NULL;
+}
+
+M2MObject::M2MObject(const String &name):
+    M2MBase(name, name)
+{
+    objects.push_back(this);
+}
+
+M2MObject::~M2MObject()
+{
+    vector<M2MObjectInstance *>::iterator it;
+    for (it = _instances.begin(); it != _instances.end(); it++) {
+        delete *it;
+    }
+
+    objects.erase(std::find(objects.begin(), objects.end(), this));
+}
+
+M2MObjectInstance *M2MObject::create_object_instance(uint16_t instance_id)
+{
+    M2MObjectInstance *inst;
+    char path[32];
+
+    if (object_instance(instance_id)) {
+        return NULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/%d", name(), instance_id);
+    inst = new M2MObjectInstance(instance_id, path);
+    _instances.push_back(inst);
+
+    return inst;
+}
+
+M2MObjectInstance *M2MObject::object_instance(uint16_t instance_id) const
+{
+    vector<M2MObjectInstance *>::const_iterator it;
+    for (it = _instances.begin(); it != _instances.end(); it++) {
+        if ((*it)->instance_id() == instance_id) {
+            return *it;
+        }
+    }
+
+    return NULL;
+}
+
+M2MObject *M2MInterfaceFactory::create_object(const String &name)
+{
+    return new M2MObject(name);
+}
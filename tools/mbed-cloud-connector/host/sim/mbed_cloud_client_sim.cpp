@@ -0,0 +1,528 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include "mbed-cloud-client/MbedCloudClient.h"
+#include "mbed-trace/mbed_trace.h"
+
+#define TRACE_GROUP "mClt"
+
+/*
+ * The simulated client runs an event script from its own thread, standing in
+ * for the real client's event loop thread. The script is read from the file
+ * named by SIM_CLOUD_SCRIPT when the client is set up. Without a script the
+ * client just registers. Events are traced with mbed-trace, as the real
+ * client traces its progress.
+ *
+ * Script format (one event per line, '#' starts a comment):
+ *
+ *   register                   Calls the registered callback
+ *   update-registration        Calls the registration updated callback
+ *   unregister                 Calls the unregistered callback
+ *   error <code>               Calls the error callback
+ *   sleep <ms>                 Waits
+ *   put <path> <value>         Sets a resource's value (e.g. 26248/0/26241)
+ *                              and calls its value updated function. "{n}" in
+ *                              the value is replaced by the loop iteration,
+ *                              and "{t}" by the monotonic time in ns.
+ *   loop <count> [rate]        Runs the events up to the matching "end" count
+ *   end                        times (0 for until closed), at rate iterations
+ *                              per second (as fast as possible if 0 or not
+ *                              specified).
+ */
+
+#define SIM_ENV_SCRIPT          "SIM_CLOUD_SCRIPT"
+#define SIM_ENV_DEVICE_ID       "SIM_CLOUD_DEVICE_ID"
+#define SIM_ENV_ENDPOINT_NAME   "SIM_CLOUD_ENDPOINT_NAME"
+
+#define SIM_DEFAULT_DEVICE_ID       "sim-device-id"
+#define SIM_DEFAULT_ENDPOINT_NAME   "sim-endpoint"
+
+#define SIM_VAR_LOOP                "{n}"
+#define SIM_VAR_TIME                "{t}"
+
+#define NSEC_PER_SEC    (1000000000ULL)
+
+enum sim_event_type {
+    SIM_EVENT_REGISTER,
+    SIM_EVENT_UPDATE_REGISTRATION,
+    SIM_EVENT_UNREGISTER,
+    SIM_EVENT_ERROR,
+    SIM_EVENT_SLEEP,
+    SIM_EVENT_PUT,
+    SIM_EVENT_LOOP,
+    SIM_EVENT_END,
+};
+
+struct sim_event {
+    sim_event_type type;
+    /* error code, sleep time (ms) or loop count */
+    uint32_t arg;
+    /* loop rate (iterations per second) */
+    double rate;
+    /* index of the loop's end event */
+    size_t end;
+    M2MResource *res;
+    String path;
+    String value;
+    bool value_has_var;
+};
+
+static sim_put_callback put_cb;
+
+void sim_set_put_callback(sim_put_callback callback)
+{
+    put_cb = callback;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static bool parse_uint(const char *str, uint32_t *val)
+{
+    char *end;
+    unsigned long v;
+
+    if (!str || !isdigit((unsigned char)*str)) {
+        return false;
+    }
+    errno = 0;
+    v = strtoul(str, &end, 10);
+    if (errno != 0 || *end != '\0' || v > UINT32_MAX) {
+        return false;
+    }
+    *val = (uint32_t)v;
+
+    return true;
+}
+
+/* splits the next whitespace separated word off the line */
+static char *next_word(char **line)
+{
+    char *p = *line;
+    char *word;
+
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (*p == '\0') {
+        *line = p;
+        return NULL;
+    }
+    word = p;
+    while (*p != '\0' && !isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    *line = p;
+
+    return word;
+}
+
+static bool parse_event(char *line, struct sim_event *ev)
+{
+    char *cmd = next_word(&line);
+    char *arg = next_word(&line);
+
+    ev->arg = 0;
+    ev->rate = 0;
+    ev->end = 0;
+    ev->res = NULL;
+    ev->value_has_var = false;
+
+    if (!strcmp(cmd, "register")) {
+        ev->type = SIM_EVENT_REGISTER;
+    } else if (!strcmp(cmd, "update-registration")) {
+        ev->type = SIM_EVENT_UPDATE_REGISTRATION;
+    } else if (!strcmp(cmd, "unregister")) {
+        ev->type = SIM_EVENT_UNREGISTER;
+    } else if (!strcmp(cmd, "error")) {
+        ev->type = SIM_EVENT_ERROR;
+        if (!parse_uint(arg, &ev->arg)) {
+            return false;
+        }
+        arg = NULL;
+    } else if (!strcmp(cmd, "sleep")) {
+        ev->type = SIM_EVENT_SLEEP;
+        if (!parse_uint(arg, &ev->arg)) {
+            return false;
+        }
+        arg = NULL;
+    } else if (!strcmp(cmd, "put")) {
+        ev->type = SIM_EVENT_PUT;
+        if (!arg) {
+            return false;
+        }
+        ev->path = arg;
+        /* the value is the rest of the line */
+        while (isspace((unsigned char)*line)) {
+            line++;
+        }
+        ev->value = line;
+        ev->value_has_var = (ev->value.find(SIM_VAR_LOOP) != String::npos ||
+            ev->value.find(SIM_VAR_TIME) != String::npos);
+        return true;
+    } else if (!strcmp(cmd, "loop")) {
+        ev->type = SIM_EVENT_LOOP;
+        if (!parse_uint(arg, &ev->arg)) {
+            return false;
+        }
+        arg = next_word(&line);
+        if (arg) {
+            ev->rate = strtod(arg, NULL);
+            if (ev->rate < 0) {
+                return false;
+            }
+            arg = NULL;
+        }
+    } else if (!strcmp(cmd, "end")) {
+        ev->type = SIM_EVENT_END;
+    } else {
+        return false;
+    }
+
+    /* no trailing arguments */
+    return (arg == NULL && next_word(&line) == NULL);
+}
+
+static vector<struct sim_event> *load_script(const char *path)
+{
+    vector<struct sim_event> *script = new vector<struct sim_event>();
+    vector<size_t> loops;
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "sim: failed to open script '%s' (%s)\n", path, strerror(errno));
+        delete script;
+        return NULL;
+    }
+
+    /* lines can be long (large values) */
+    while (getline(&line, &line_size, fp) >= 0) {
+        struct sim_event ev;
+        char *p;
+
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        p = line;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+
+        if (!parse_event(p, &ev)) {
+            fprintf(stderr, "sim: %s:%d: invalid event\n", path, line_no);
+            goto err;
+        }
+        if (ev.type == SIM_EVENT_LOOP) {
+            loops.push_back(script->size());
+        } else if (ev.type == SIM_EVENT_END) {
+            if (loops.empty()) {
+                fprintf(stderr, "sim: %s:%d: end without loop\n", path, line_no);
+                goto err;
+            }
+            (*script)[loops.back()].end = script->size();
+            loops.pop_back();
+        }
+        script->push_back(ev);
+    }
+
+    if (!loops.empty()) {
+        fprintf(stderr, "sim: %s: loop without end\n", path);
+        goto err;
+    }
+
+    free(line);
+    fclose(fp);
+
+    return script;
+
+err:
+    free(line);
+    fclose(fp);
+    delete script;
+    return NULL;
+}
+
+MbedCloudClient::MbedCloudClient():
+    _update_callback(NULL),
+    _error_description("No error"),
+    _script(NULL),
+    _thread_started(false),
+    _registered(false),
+    _stop(false)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    const char *device_id = getenv(SIM_ENV_DEVICE_ID);
+    const char *endpoint_name = getenv(SIM_ENV_ENDPOINT_NAME);
+    _endpoint_info.internal_endpoint_name = device_id ? device_id : SIM_DEFAULT_DEVICE_ID;
+    _endpoint_info.endpoint_name = endpoint_name ? endpoint_name : SIM_DEFAULT_ENDPOINT_NAME;
+}
+
+MbedCloudClient::~MbedCloudClient()
+{
+    close();
+
+    /* unlike the real client, the objects are freed, so that clients can be repeatedly created */
+    M2MObjectList::iterator it;
+    for (it = _objects.begin(); it != _objects.end(); it++) {
+        delete *it;
+    }
+
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_lock);
+}
+
+void MbedCloudClient::add_objects(const M2MObjectList &object_list)
+{
+    _objects.insert(_objects.end(), object_list.begin(), object_list.end());
+}
+
+void MbedCloudClient::set_update_callback(MbedCloudClientCallback *callback)
+{
+    _update_callback = callback;
+}
+
+bool MbedCloudClient::setup(void *iface)
+{
+    const char *path = getenv(SIM_ENV_SCRIPT);
+
+    if (_thread_started) {
+        return false;
+    }
+
+    if (path) {
+        _script = load_script(path);
+        if (!_script) {
+            return false;
+        }
+    } else {
+        struct sim_event ev;
+        ev.type = SIM_EVENT_REGISTER;
+        _script = new vector<struct sim_event>(1, ev);
+    }
+
+    /* resolve the resource paths up front */
+    for (size_t i = 0; i < _script->size(); i++) {
+        struct sim_event &ev = (*_script)[i];
+        if (ev.type != SIM_EVENT_PUT) {
+            continue;
+        }
+        ev.res = sim_find_resource(ev.path.c_str());
+        if (!ev.res) {
+            fprintf(stderr, "sim: unknown resource '%s'\n", ev.path.c_str());
+            delete _script;
+            _script = NULL;
+            return false;
+        }
+    }
+
+    _stop = false;
+    if (pthread_create(&_thread, NULL, thread_main, this) != 0) {
+        delete _script;
+        _script = NULL;
+        return false;
+    }
+    _thread_started = true;
+
+    return true;
+}
+
+void MbedCloudClient::close()
+{
+    if (!_thread_started) {
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _stop = true;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_lock);
+
+    pthread_join(_thread, NULL);
+    _thread_started = false;
+
+    delete _script;
+    _script = NULL;
+
+    if (_registered) {
+        _registered = false;
+        _on_unregistered.call();
+    }
+}
+
+const ConnectorClientEndpointInfo *MbedCloudClient::endpoint_info() const
+{
+    return _registered ? &_endpoint_info : NULL;
+}
+
+const char *MbedCloudClient::error_description() const
+{
+    return _error_description;
+}
+
+void *MbedCloudClient::thread_main(void *arg)
+{
+    MbedCloudClient *client = (MbedCloudClient *)arg;
+
+    client->run_script();
+
+    return NULL;
+}
+
+/* waits until the deadline, returning false if stopped */
+bool MbedCloudClient::sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts;
+    bool stop;
+
+    ts.tv_sec = deadline_ns / NSEC_PER_SEC;
+    ts.tv_nsec = deadline_ns % NSEC_PER_SEC;
+
+    pthread_mutex_lock(&_lock);
+    while (!_stop) {
+        if (pthread_cond_timedwait(&_cond, &_lock, &ts) == ETIMEDOUT) {
+            break;
+        }
+    }
+    stop = _stop;
+    pthread_mutex_unlock(&_lock);
+
+    return !stop;
+}
+
+void MbedCloudClient::run_script()
+{
+    uint64_t start = now_ns();
+
+    if (run_events(0, _script->size(), 0)) {
+        fprintf(stderr, "sim: script completed in %.3f s\n",
+            (double)(now_ns() - start) / NSEC_PER_SEC);
+    }
+
+    /* stay registered until closed */
+    pthread_mutex_lock(&_lock);
+    while (!_stop) {
+        pthread_cond_wait(&_cond, &_lock);
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+/* runs the events in [start, end), returning false if stopped */
+bool MbedCloudClient::run_events(size_t start, size_t end, uint32_t loop_n)
+{
+    size_t i = start;
+
+    while (i < end) {
+
+        const struct sim_event &ev = (*_script)[i];
+
+        if (ev.type != SIM_EVENT_LOOP) {
+            if (!run_event(ev, loop_n)) {
+                return false;
+            }
+            i++;
+            continue;
+        }
+
+        /* paced against absolute deadlines, so the rate doesn't drift */
+        uint64_t loop_start = now_ns();
+        for (uint32_t n = 0; ev.arg == 0 || n < ev.arg; n++) {
+            if (ev.rate > 0 && n > 0) {
+                if (!sleep_until(loop_start + (uint64_t)(n * (NSEC_PER_SEC / ev.rate)))) {
+                    return false;
+                }
+            } else if (__atomic_load_n(&_stop, __ATOMIC_RELAXED)) {
+                return false;
+            }
+            if (!run_events(i + 1, ev.end, n)) {
+                return false;
+            }
+        }
+        i = ev.end + 1;
+
+    }
+
+    return true;
+}
+
+bool MbedCloudClient::run_event(const struct sim_event &ev, uint32_t loop_n)
+{
+    switch (ev.type) {
+        case SIM_EVENT_REGISTER:
+            tr_info("Registered");
+            _registered = true;
+            _on_registered.call();
+            break;
+        case SIM_EVENT_UPDATE_REGISTRATION:
+            tr_debug("Registration updated");
+            _on_registration_updated.call();
+            break;
+        case SIM_EVENT_UNREGISTER:
+            tr_info("Unregistered");
+            _registered = false;
+            _on_unregistered.call();
+            break;
+        case SIM_EVENT_ERROR:
+            tr_err("Simulated error %u", ev.arg);
+            _error_description = "Simulated error";
+            _on_error.call(ev.arg);
+            break;
+        case SIM_EVENT_SLEEP:
+            return sleep_until(now_ns() + (uint64_t)ev.arg * 1000000);
+        case SIM_EVENT_PUT:
+            put_cb.call(ev.res);
+            tr_debug("PUT %s", ev.path.c_str());
+            if (ev.value_has_var) {
+                char n[16];
+                char t[24];
+                String value = ev.value;
+                size_t pos;
+                snprintf(n, sizeof(n), "%u", loop_n);
+                snprintf(t, sizeof(t), "%llu", (unsigned long long)now_ns());
+                while ((pos = value.find(SIM_VAR_LOOP)) != String::npos) {
+                    value.replace(pos, strlen(SIM_VAR_LOOP), n);
+                }
+                while ((pos = value.find(SIM_VAR_TIME)) != String::npos) {
+                    value.replace(pos, strlen(SIM_VAR_TIME), t);
+                }
+                ev.res->set_value((const uint8_t *)value.data(), value.size());
+            } else {
+                ev.res->set_value((const uint8_t *)ev.value.data(), ev.value.size());
+            }
+            if (ev.res->operation() & M2MBase::PUT_ALLOWED) {
+                ev.res->execute_value_updated();
+            } else if (_update_callback) {
+                _update_callback->value_updated(ev.res, M2MBase::Resource);
+            }
+            break;
+        case SIM_EVENT_LOOP:
+        case SIM_EVENT_END:
+            break;
+    }
+
+    return true;
+}
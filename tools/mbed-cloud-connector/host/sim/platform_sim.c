@@ -0,0 +1,126 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "factory_configurator_client.h"
+#include "mbed-trace/mbed_trace.h"
+#include "mbed-trace-helper.h"
+
+/*
+ * Factory configurator and mbed-trace entry points for the host build. There
+ * is nothing to configure, so the factory configurator calls just succeed.
+ * Traces are formatted and printed as by the real mbed-trace without color.
+ */
+
+#define SIM_TRACE_LINE_LENGTH   (1024)
+
+static uint8_t trace_config = TRACE_ACTIVE_LEVEL_ALL;
+static void (*trace_print)(const char *);
+static void (*trace_mutex_wait)(void);
+static void (*trace_mutex_release)(void);
+static pthread_mutex_t trace_helper_lock = PTHREAD_MUTEX_INITIALIZER;
+
+fcc_status_e fcc_init(void)
+{
+    return FCC_STATUS_SUCCESS;
+}
+
+fcc_status_e fcc_finalize(void)
+{
+    return FCC_STATUS_SUCCESS;
+}
+
+fcc_status_e fcc_verify_device_configured_4mbed_cloud(void)
+{
+    return FCC_STATUS_SUCCESS;
+}
+
+static void trace_print_default(const char *str)
+{
+    printf("%s\n", str);
+}
+
+int mbed_trace_init(void)
+{
+    trace_print = trace_print_default;
+    return 0;
+}
+
+void mbed_trace_free(void)
+{
+    trace_print = NULL;
+}
+
+void mbed_trace_config_set(uint8_t config)
+{
+    trace_config = config;
+}
+
+uint8_t mbed_trace_config_get(void)
+{
+    return trace_config;
+}
+
+void mbed_trace_print_function_set(void (*print_f)(const char *))
+{
+    trace_print = print_f;
+}
+
+void mbed_trace_mutex_wait_function_set(void (*mutex_wait_f)(void))
+{
+    trace_mutex_wait = mutex_wait_f;
+}
+
+void mbed_trace_mutex_release_function_set(void (*mutex_release_f)(void))
+{
+    trace_mutex_release = mutex_release_f;
+}
+
+void mbed_tracef(uint8_t dlevel, const char *grp, const char *fmt, ...)
+{
+    char line[SIM_TRACE_LINE_LENGTH];
+    const char *level;
+    va_list ap;
+    int len;
+
+    if (!trace_print || !(trace_config & TRACE_MASK_LEVEL & dlevel)) {
+        return;
+    }
+
+    switch (dlevel) {
+        case TRACE_LEVEL_ERROR: level = "ERR "; break;
+        case TRACE_LEVEL_WARN:  level = "WARN"; break;
+        case TRACE_LEVEL_INFO:  level = "INFO"; break;
+        case TRACE_LEVEL_DEBUG: level = "DBG "; break;
+        default:                level = NULL;   break;
+    }
+
+    if (trace_mutex_wait) {
+        trace_mutex_wait();
+    }
+
+    len = level ? snprintf(line, sizeof(line), "[%s][%-4s]: ", level, grp) : 0;
+    va_start(ap, fmt);
+    vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+    va_end(ap);
+    trace_print(line);
+
+    if (trace_mutex_release) {
+        trace_mutex_release();
+    }
+}
+
+bool mbed_trace_helper_create_mutex(void)
+{
+    return true;
+}
+
+void mbed_trace_helper_mutex_wait(void)
+{
+    pthread_mutex_lock(&trace_helper_lock);
+}
+
+void mbed_trace_helper_mutex_release(void)
+{
+    pthread_mutex_unlock(&trace_helper_lock);
+}
@@ -8,6 +8,7 @@
 #include "mbed-trace/mbed_trace.h"
 #include "mbed-trace-helper.h"
 #include "enebular_agent_mbed_cloud_connector.h"
+#include "mbed_trace_bridge.h"
 
 #define PROGRAM_NAME    "enebular-agent-mbed-cloud-connector"
 #define PROGRAM_VERSION "1.2.0"
@@ -20,6 +21,8 @@
  */
 #define DEFAULT_STORAGE_PATH "./pal"
 
+#define DEFAULT_RECORDER_PATH DEFAULT_STORAGE_PATH "/flight-recorder.bin"
+
 /**
  * PAL_NET_DEFAULT_INTERFACE == 0xFFFFFFFF
  */
@@ -29,6 +32,16 @@ static bool enable_log_console;
 static bool enable_debug_logging;
 static char server_socket[256] = { 0 };
 static char mbed_cloud_dev_credentials_path[256] = { 0 };
+static size_t send_queue_max_bytes = AGENT_SEND_QUEUE_DEFAULT_MAX_BYTES;
+static size_t send_queue_max_frames = AGENT_SEND_QUEUE_DEFAULT_MAX_FRAMES;
+static bool enable_recorder;
+static char recorder_path[256] = DEFAULT_RECORDER_PATH;
+static size_t recorder_size = FLIGHT_RECORDER_DEFAULT_SIZE;
+static bool trace_options_set;
+static char metrics_address[256] = { 0 };
+static char message_trace_path[256] = { 0 };
+static const char *loop_budgets;
+static uint32_t watchdog_stall_ms = LOOP_MONITOR_DEFAULT_STALL_MS;
 
 EnebularAgentMbedCloudConnector *connector;
 
@@ -58,42 +71,32 @@ static bool init_storage_dir(void)
     return true;
 }
 
-static void sigaction_handler_halt(int sig)
-{
-    if (!connector) {
-        return;
-    }
-
-    connector->halt();
-}
-
-static void sigaction_handler_pipe(int sig)
-{
-    fprintf(stderr, "Terminating due to SIGPIPE...\n");
-
-    exit(1);
-}
-
 static bool init_signals(void)
 {
     struct sigaction sigact;
+    sigset_t mask;
     int ret;
 
-    sigact.sa_flags = 0;
-    sigemptyset(&sigact.sa_mask);
-    sigact.sa_handler = sigaction_handler_halt;
-
-    ret = sigaction(SIGINT, &sigact, NULL);
-    if (ret < 0) {
-        return false;
-    }
-
-    ret = sigaction(SIGTERM, &sigact, NULL);
-    if (ret < 0) {
+    /*
+     * SIGINT and SIGTERM are received by the connector via a signalfd, so they
+     * are blocked here before any other threads are created (which inherit the
+     * mask).
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    ret = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    if (ret != 0) {
         return false;
     }
 
-    sigact.sa_handler = sigaction_handler_pipe;
+    /*
+     * A closed agent connection is handled (and reconnected) via EPIPE/EOF, so
+     * SIGPIPE must not terminate the connector.
+     */
+    sigact.sa_flags = 0;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_handler = SIG_IGN;
 
     ret = sigaction(SIGPIPE, &sigact, NULL);
     if (ret < 0) {
@@ -122,6 +125,22 @@ static bool init(void)
     return true;
 }
 
+/* a whole positive number, or false */
+static bool parse_limit(const char *str, size_t *val)
+{
+    unsigned long parsed;
+    char *end;
+
+    errno = 0;
+    parsed = strtoul(str, &end, 10);
+    if (errno || end == str || *end != '\0' || *str == '-' || parsed == 0) {
+        return false;
+    }
+    *val = parsed;
+
+    return true;
+}
+
 static void print_usage(void)
 {
     printf(
@@ -135,6 +154,24 @@ static void print_usage(void)
         "    -d --debug           Enable debug logging\n"
         "    -s --server-socket   Server socket path to connect\n"
         "    -m --dev-credentials Path of mbed_cloud_dev_credentials.c file\n"
+        "    -b --send-queue-bytes  Max bytes queued for sending to the agent\n"
+        "    -f --send-queue-frames Max messages queued for sending to the agent\n"
+        "    -r --recorder        Record all log messages in a flight recorder file\n"
+        "                         (" DEFAULT_RECORDER_PATH ")\n"
+        "    -F --recorder-file   Flight recorder file path (enables the recorder)\n"
+        "    -R --recorder-size   Flight recorder size in KB\n"
+        "    -t --trace-level     Lowest Mbed Cloud Client trace level to log\n"
+        "                         (debug, info, warn (default), error or none)\n"
+        "    -g --trace-groups    Trace groups to log, comma-separated (groups\n"
+        "                         prefixed with '-' are excluded)\n"
+        "    -M --metrics         Serve metrics (Prometheus) on a Unix socket path\n"
+        "                         or TCP [address:]port\n"
+        "    -l --latency-trace   Write the latency trace of each message between\n"
+        "                         Mbed Cloud and the agent to a file\n"
+        "    -B --loop-budget     Main loop handler time budgets in ms, as a default\n"
+        "                         and/or per handler (e.g. 50,client=200)\n"
+        "    -W --watchdog        Main loop stall time in ms reported by the\n"
+        "                         watchdog (0 to disable)\n"
         "\n"
     );
 }
@@ -154,13 +191,24 @@ static int parse_args(int argc, char * const *argv)
         {"debug",           0, NULL, 'd'},
         {"server-socket",   required_argument, NULL, 's'},
         {"dev-credentials", required_argument, NULL, 'm'},
+        {"send-queue-bytes",  required_argument, NULL, 'b'},
+        {"send-queue-frames", required_argument, NULL, 'f'},
+        {"recorder",        0, NULL, 'r'},
+        {"recorder-file",   required_argument, NULL, 'F'},
+        {"recorder-size",   required_argument, NULL, 'R'},
+        {"trace-level",     required_argument, NULL, 't'},
+        {"trace-groups",    required_argument, NULL, 'g'},
+        {"metrics",         required_argument, NULL, 'M'},
+        {"latency-trace",   required_argument, NULL, 'l'},
+        {"loop-budget",     required_argument, NULL, 'B'},
+        {"watchdog",        required_argument, NULL, 'W'},
         {0, 0, 0, 0}
     };
     int c;
 
     while (1) {
 
-        c = getopt_long(argc, argv, "hvcds:m:", options, NULL);
+        c = getopt_long(argc, argv, "hvcds:m:b:f:rF:R:t:g:M:l:B:W:", options, NULL);
         if (c == -1)
             break;
 
@@ -191,6 +239,65 @@ static int parse_args(int argc, char * const *argv)
                         sizeof(mbed_cloud_dev_credentials_path));
                 break;
 
+            case 'b':
+                if (!parse_limit(optarg, &send_queue_max_bytes)) {
+                    fprintf(stderr, "Invalid send queue bytes: %s\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'f':
+                if (!parse_limit(optarg, &send_queue_max_frames)) {
+                    fprintf(stderr, "Invalid send queue frames: %s\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'r':
+                enable_recorder = true;
+                break;
+
+            case 'F':
+                enable_recorder = true;
+                strncpy(recorder_path, optarg, sizeof(recorder_path) - 1);
+                break;
+
+            case 'R':
+                recorder_size = strtoul(optarg, NULL, 10) * 1024;
+                break;
+
+            case 't':
+                if (!MbedTraceBridge::set_level(optarg)) {
+                    fprintf(stderr, "Invalid trace level: %s\n", optarg);
+                    return 1;
+                }
+                trace_options_set = true;
+                break;
+
+            case 'g':
+                if (!MbedTraceBridge::set_groups(optarg)) {
+                    fprintf(stderr, "Trace group list too long\n");
+                    return 1;
+                }
+                trace_options_set = true;
+                break;
+
+            case 'M':
+                strncpy(metrics_address, optarg, sizeof(metrics_address) - 1);
+                break;
+
+            case 'l':
+                strncpy(message_trace_path, optarg, sizeof(message_trace_path) - 1);
+                break;
+
+            case 'B':
+                loop_budgets = optarg;
+                break;
+
+            case 'W':
+                watchdog_stall_ms = strtoul(optarg, NULL, 10);
+                break;
+
             default:
                 return 1;
 
@@ -243,14 +350,52 @@ int main(int argc, char **argv)
 
     connector->enable_log_console(enable_log_console);
     if (enable_debug_logging) {
+#if LOGGER_MIN_LEVEL > 0
+        fprintf(stderr, "Debug logging is not available in this build\n");
+#endif
         connector->set_log_level(DEBUG);
     }
+    connector->set_agent_send_queue_limits(send_queue_max_bytes, send_queue_max_frames);
+
+    if (enable_recorder && !connector->enable_log_recorder(recorder_path, recorder_size)) {
+        fprintf(stderr, "Failed to enable flight recorder\n");
+        return EXIT_FAILURE;
+    }
+
+    if (loop_budgets && !connector->set_loop_budgets(loop_budgets)) {
+        fprintf(stderr, "Invalid loop budgets: %s\n", loop_budgets);
+        return EXIT_FAILURE;
+    }
+
+    if (message_trace_path[0] != '\0' && !connector->enable_message_trace_dump(message_trace_path)) {
+        fprintf(stderr, "Failed to open latency trace file\n");
+        return EXIT_FAILURE;
+    }
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+    /* after the logging setup, which determines the trace levels enabled */
+    MbedTraceBridge::start(Logger::get_instance());
+#else
+    if (trace_options_set) {
+        fprintf(stderr, "Mbed Cloud Client tracing is not available in this build\n");
+    }
+#endif
 
     if (!connector->startup(network_interface)) {
         fprintf(stderr, "Connector startup failed\n");
         return EXIT_FAILURE;
     }
 
+    if (metrics_address[0] != '\0' && !connector->enable_metrics_server(metrics_address)) {
+        fprintf(stderr, "Failed to start metrics server\n");
+        return EXIT_FAILURE;
+    }
+
+    if (watchdog_stall_ms > 0 && !connector->enable_loop_watchdog(watchdog_stall_ms)) {
+        fprintf(stderr, "Failed to start loop watchdog\n");
+        return EXIT_FAILURE;
+    }
+
     connector->run();
 
     connector->shutdown();
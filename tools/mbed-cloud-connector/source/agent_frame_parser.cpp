@@ -0,0 +1,272 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "agent_frame_parser.h"
+
+#define NO_TERM_POS     ((size_t)-1)
+
+AgentFrameParser::AgentFrameParser(char delim):
+    _delim(delim),
+    _mode(AGENT_FRAME_MODE_TEXT),
+    _buf(NULL),
+    _size(0),
+    _max_size(0),
+    _start(0),
+    _scan(0),
+    _end(0),
+    _discarding(false),
+    _skip(0),
+    _term_pos(NO_TERM_POS),
+    _term_byte(0),
+    _dropped_cnt(0)
+{
+}
+
+AgentFrameParser::~AgentFrameParser()
+{
+    uninit();
+}
+
+bool AgentFrameParser::init(size_t init_size, size_t max_size)
+{
+    uninit();
+
+    /* one extra byte so a frame at the very end can still be terminated */
+    _buf = (char *)malloc(init_size + 1);
+    if (!_buf) {
+        return false;
+    }
+    _size = init_size;
+    _max_size = (max_size > init_size) ? max_size : init_size;
+
+    reset();
+
+    return true;
+}
+
+void AgentFrameParser::uninit()
+{
+    free(_buf);
+    _buf = NULL;
+    _size = 0;
+}
+
+void AgentFrameParser::reset()
+{
+    _mode = AGENT_FRAME_MODE_TEXT;
+    _start = 0;
+    _scan = 0;
+    _end = 0;
+    _discarding = false;
+    _skip = 0;
+    _term_pos = NO_TERM_POS;
+}
+
+void AgentFrameParser::set_mode(AgentFrameMode mode)
+{
+    _mode = mode;
+    _scan = _start;
+    _discarding = false;
+    _skip = 0;
+}
+
+AgentFrameMode AgentFrameParser::get_mode()
+{
+    return _mode;
+}
+
+void AgentFrameParser::restore_term()
+{
+    if (_term_pos != NO_TERM_POS) {
+        _buf[_term_pos] = _term_byte;
+        _term_pos = NO_TERM_POS;
+    }
+}
+
+void AgentFrameParser::compact()
+{
+    size_t cnt = _end - _start;
+
+    if (cnt > 0) {
+        memmove(_buf, _buf + _start, cnt);
+    }
+    _scan -= _start;
+    _end = cnt;
+    _start = 0;
+}
+
+bool AgentFrameParser::grow()
+{
+    size_t size;
+    char *buf;
+
+    if (_size >= _max_size) {
+        return false;
+    }
+
+    size = _size * 2;
+    if (size > _max_size) {
+        size = _max_size;
+    }
+    buf = (char *)realloc(_buf, size + 1);
+    if (!buf) {
+        return false;
+    }
+    _buf = buf;
+    _size = size;
+
+    return true;
+}
+
+char *AgentFrameParser::get_write_buf(size_t *avail)
+{
+    if (!_buf) {
+        *avail = 0;
+        return NULL;
+    }
+
+    restore_term();
+
+    if (_start == _end) {
+        _start = 0;
+        _scan = 0;
+        _end = 0;
+    } else if (_start > 0 && (_size - _end) < (_size / 4)) {
+        compact();
+    }
+
+    if (_end == _size && !grow()) {
+        /* a single frame has filled the whole buffer. drop it. */
+        if (!_discarding) {
+            _dropped_cnt++;
+        }
+        _discarding = true;
+        _start = 0;
+        _scan = 0;
+        _end = 0;
+    }
+
+    *avail = _size - _end;
+
+    return _buf + _end;
+}
+
+void AgentFrameParser::commit(size_t cnt)
+{
+    _end += cnt;
+}
+
+char *AgentFrameParser::next_text_frame(size_t *len)
+{
+    char *frame;
+    char *delim;
+
+    while (_scan < _end) {
+
+        delim = (char *)memchr(_buf + _scan, _delim, _end - _scan);
+        if (!delim) {
+            _scan = _end;
+            break;
+        }
+
+        *delim = '\0';
+        frame = _buf + _start;
+        *len = delim - frame;
+        _start = _scan = (delim - _buf) + 1;
+
+        if (_discarding) {
+            /* tail of an oversized frame */
+            _discarding = false;
+            continue;
+        }
+        if (*len == 0) {
+            continue;
+        }
+
+        return frame;
+    }
+
+    return NULL;
+}
+
+char *AgentFrameParser::next_binary_frame(size_t *len)
+{
+    const unsigned char *hdr;
+    size_t avail;
+    size_t frame_len;
+    char *frame;
+
+    while (1) {
+
+        avail = _end - _start;
+
+        if (_skip > 0) {
+            /* rest of an oversized frame */
+            if (_skip > avail) {
+                _skip -= avail;
+                _start = _end;
+                break;
+            }
+            _start += _skip;
+            _skip = 0;
+            continue;
+        }
+
+        if (avail < AGENT_FRAME_LEN_SIZE) {
+            break;
+        }
+        hdr = (const unsigned char *)(_buf + _start);
+        frame_len = ((size_t)hdr[0] << 24) | ((size_t)hdr[1] << 16) |
+            ((size_t)hdr[2] << 8) | (size_t)hdr[3];
+
+        if (frame_len == 0) {
+            _start += AGENT_FRAME_LEN_SIZE;
+            continue;
+        }
+        if (frame_len > _max_size - AGENT_FRAME_LEN_SIZE) {
+            _dropped_cnt++;
+            _skip = frame_len;
+            _start += AGENT_FRAME_LEN_SIZE;
+            continue;
+        }
+        if (avail < AGENT_FRAME_LEN_SIZE + frame_len) {
+            break;
+        }
+
+        frame = _buf + _start + AGENT_FRAME_LEN_SIZE;
+        _start += AGENT_FRAME_LEN_SIZE + frame_len;
+        _scan = _start;
+
+        /* terminate in place, keeping the overwritten byte for later */
+        _term_pos = _start;
+        _term_byte = _buf[_start];
+        _buf[_start] = '\0';
+
+        *len = frame_len;
+        return frame;
+    }
+
+    _scan = _start;
+
+    return NULL;
+}
+
+char *AgentFrameParser::next_frame(size_t *len)
+{
+    if (!_buf) {
+        return NULL;
+    }
+
+    restore_term();
+
+    if (_mode == AGENT_FRAME_MODE_BINARY) {
+        return next_binary_frame(len);
+    }
+
+    return next_text_frame(len);
+}
+
+uint32_t AgentFrameParser::get_dropped_cnt()
+{
+    return _dropped_cnt;
+}
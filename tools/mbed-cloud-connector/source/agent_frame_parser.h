@@ -0,0 +1,133 @@
+#ifndef AGENT_FRAME_PARSER_H
+#define AGENT_FRAME_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum AgentFrameMode {
+    /* frames terminated by a delimiter */
+    AGENT_FRAME_MODE_TEXT,
+    /* frames prefixed with their length (32-bit big endian) */
+    AGENT_FRAME_MODE_BINARY
+};
+
+#define AGENT_FRAME_LEN_SIZE    (4)
+
+/**
+ * Incremental parser for the frames received from the agent.
+ *
+ * Data is read directly into the parser's buffer (get_write_buf() / commit())
+ * and each complete frame is handed out by next_frame() as soon as it has fully
+ * arrived. Any trailing partial frame is kept and completed by subsequent
+ * reads. The buffer is compacted as frames are consumed and grown (up to a
+ * maximum size) if a single frame doesn't fit.
+ *
+ * The framing mode can be switched between frames, and the switch applies to
+ * the data following the last frame returned.
+ */
+class AgentFrameParser {
+
+public:
+
+    /**
+     * Constructor
+     *
+     * @param delim Frame delimiter
+     */
+    AgentFrameParser(char delim);
+
+    /**
+     * Deconstructor
+     */
+    ~AgentFrameParser();
+
+    /**
+     * Allocate the parser's buffer.
+     *
+     * @param init_size Initial buffer size
+     * @param max_size  Maximum buffer size (the maximum frame size)
+     */
+    bool init(size_t init_size, size_t max_size);
+
+    /**
+     * Free the parser's buffer.
+     */
+    void uninit();
+
+    /**
+     * Discard all buffered data and return to text mode.
+     */
+    void reset();
+
+    /**
+     * Set the framing mode.
+     *
+     * @param mode Framing mode
+     */
+    void set_mode(AgentFrameMode mode);
+
+    /**
+     * Get the framing mode.
+     */
+    AgentFrameMode get_mode();
+
+    /**
+     * Get the location to read new data into.
+     *
+     * If a single frame has filled the maximum sized buffer, then it is
+     * discarded (up to its delimiter) and counted as dropped.
+     *
+     * @param avail Set to the number of bytes that can be written
+     * @return The location to write to, or NULL if not initialized
+     */
+    char *get_write_buf(size_t *avail);
+
+    /**
+     * Commit data written to the location returned by get_write_buf().
+     *
+     * @param cnt Number of bytes written
+     */
+    void commit(size_t cnt);
+
+    /**
+     * Get the next complete frame.
+     *
+     * The frame is NUL terminated in place and stays valid until the next call
+     * to next_frame() or get_write_buf(). In binary mode the length prefix is
+     * not included in the frame.
+     *
+     * @param len Set to the frame length (excluding the terminator)
+     * @return The frame, or NULL if there is no complete frame
+     */
+    char *next_frame(size_t *len);
+
+    /**
+     * Get the number of frames dropped for exceeding the maximum size.
+     */
+    uint32_t get_dropped_cnt();
+
+private:
+
+    char _delim;
+    AgentFrameMode _mode;
+    char *_buf;
+    size_t _size;
+    size_t _max_size;
+    size_t _start;
+    size_t _scan;
+    size_t _end;
+    bool _discarding;
+    size_t _skip;
+    size_t _term_pos;
+    char _term_byte;
+    uint32_t _dropped_cnt;
+
+    bool grow();
+    void compact();
+    void restore_term();
+    char *next_text_frame(size_t *len);
+    char *next_binary_frame(size_t *len);
+
+};
+
+#endif // AGENT_FRAME_PARSER_H
@@ -0,0 +1,323 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "agent_send_queue.h"
+
+#define FLUSH_IOV_MAX   (128)
+
+#define FRAME_DATA(f)   ((char *)((f) + 1))
+
+/**
+ * writev() for sockets, that returns EPIPE instead of raising SIGPIPE if the
+ * peer has gone away.
+ */
+static ssize_t send_iov(int fd, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+AgentSendQueue::AgentSendQueue():
+    _head(NULL),
+    _tail(NULL),
+    _max_bytes(AGENT_SEND_QUEUE_DEFAULT_MAX_BYTES),
+    _max_frames(AGENT_SEND_QUEUE_DEFAULT_MAX_FRAMES),
+    _byte_cnt(0),
+    _frame_cnt(0),
+    _overflow_frame_cnt(0),
+    _overflow_byte_cnt(0)
+{
+}
+
+AgentSendQueue::~AgentSendQueue()
+{
+    clear();
+}
+
+void AgentSendQueue::set_limits(size_t max_bytes, size_t max_frames)
+{
+    _max_bytes = max_bytes;
+    _max_frames = max_frames;
+}
+
+AgentSendResult AgentSendQueue::send(int fd, const struct iovec *iov, SharedBuffer *const *refs,
+        int iovcnt)
+{
+    struct iovec cur[AGENT_SEND_MAX_SEGMENTS];
+    size_t total = 0;
+    size_t written = 0;
+    size_t skip;
+    ssize_t cnt;
+    int first = 0;
+    int i;
+
+    if (iovcnt > AGENT_SEND_MAX_SEGMENTS) {
+        return AGENT_SEND_DROPPED;
+    }
+
+    /* keep ordering behind anything already queued */
+    if (!is_empty()) {
+        return push(iov, refs, iovcnt, 0) ? AGENT_SEND_QUEUED : AGENT_SEND_DROPPED;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        cur[i] = iov[i];
+        total += iov[i].iov_len;
+    }
+
+    while (written < total) {
+
+        cnt = send_iov(fd, &cur[first], iovcnt - first);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return AGENT_SEND_ERROR;
+            }
+            break;
+        }
+        if (cnt == 0) {
+            break;
+        }
+        written += cnt;
+
+        while (cnt > 0) {
+            skip = ((size_t)cnt < cur[first].iov_len) ? cnt : cur[first].iov_len;
+            cur[first].iov_base = (char *)cur[first].iov_base + skip;
+            cur[first].iov_len -= skip;
+            cnt -= skip;
+            if (cur[first].iov_len == 0) {
+                first++;
+            }
+        }
+
+    }
+
+    if (written == total) {
+        return AGENT_SEND_OK;
+    }
+
+    return push(iov, refs, iovcnt, written) ? AGENT_SEND_QUEUED : AGENT_SEND_DROPPED;
+}
+
+bool AgentSendQueue::push(const struct iovec *iov, SharedBuffer *const *refs, int iovcnt,
+        size_t offset)
+{
+    size_t len = 0;
+    size_t copy_len = 0;
+    size_t skip;
+    size_t seg_len;
+    struct frame *f;
+    char *data;
+    int i;
+
+    if (iovcnt > AGENT_SEND_MAX_SEGMENTS) {
+        return false;
+    }
+
+    skip = offset;
+    for (i = 0; i < iovcnt; i++) {
+        seg_len = iov[i].iov_len;
+        if (skip >= seg_len) {
+            skip -= seg_len;
+            continue;
+        }
+        seg_len -= skip;
+        skip = 0;
+        len += seg_len;
+        if (!refs || !refs[i]) {
+            copy_len += seg_len;
+        }
+    }
+
+    /*
+     * a partially written frame must always be kept to avoid a torn stream,
+     * and a frame is always accepted into an empty queue so that one larger
+     * than the byte limit can still be sent
+     */
+    if (offset == 0 && _frame_cnt > 0 &&
+            (_frame_cnt + 1 > _max_frames || _byte_cnt + len > _max_bytes)) {
+        _overflow_frame_cnt++;
+        _overflow_byte_cnt += len;
+        return false;
+    }
+
+    f = (struct frame *)malloc(sizeof(*f) + copy_len);
+    if (!f) {
+        _overflow_frame_cnt++;
+        _overflow_byte_cnt += len;
+        return false;
+    }
+    f->next = NULL;
+    f->len = len;
+    f->sent = 0;
+    f->seg_cnt = 0;
+
+    data = FRAME_DATA(f);
+    skip = offset;
+    for (i = 0; i < iovcnt; i++) {
+        const char *base = (const char *)iov[i].iov_base;
+        struct segment *seg;
+        seg_len = iov[i].iov_len;
+        if (skip >= seg_len) {
+            skip -= seg_len;
+            continue;
+        }
+        base += skip;
+        seg_len -= skip;
+        skip = 0;
+        seg = &f->segs[f->seg_cnt++];
+        seg->len = seg_len;
+        if (refs && refs[i]) {
+            seg->base = base;
+            seg->ref = refs[i]->ref();
+        } else {
+            memcpy(data, base, seg_len);
+            seg->base = data;
+            seg->ref = NULL;
+            data += seg_len;
+        }
+    }
+
+    if (_tail) {
+        _tail->next = f;
+    } else {
+        _head = f;
+    }
+    _tail = f;
+    _byte_cnt += len;
+    _frame_cnt++;
+
+    return true;
+}
+
+void AgentSendQueue::pop()
+{
+    struct frame *f = _head;
+    int i;
+
+    _head = f->next;
+    if (!_head) {
+        _tail = NULL;
+    }
+    _byte_cnt -= f->len - f->sent;
+    _frame_cnt--;
+
+    for (i = 0; i < f->seg_cnt; i++) {
+        if (f->segs[i].ref) {
+            f->segs[i].ref->unref();
+        }
+    }
+
+    free(f);
+}
+
+int AgentSendQueue::fill_iov(struct frame *f, struct iovec *iov, int iovcnt)
+{
+    size_t skip = f->sent;
+    int cnt = 0;
+    int i;
+
+    for (i = 0; i < f->seg_cnt && cnt < iovcnt; i++) {
+        if (skip >= f->segs[i].len) {
+            skip -= f->segs[i].len;
+            continue;
+        }
+        iov[cnt].iov_base = (void *)(f->segs[i].base + skip);
+        iov[cnt].iov_len = f->segs[i].len - skip;
+        skip = 0;
+        cnt++;
+    }
+
+    return cnt;
+}
+
+ssize_t AgentSendQueue::flush(int fd)
+{
+    struct iovec iov[FLUSH_IOV_MAX];
+    struct frame *f;
+    ssize_t total = 0;
+    ssize_t cnt;
+    size_t left;
+    int iovcnt;
+
+    while (_head) {
+
+        iovcnt = 0;
+        for (f = _head; f && iovcnt < FLUSH_IOV_MAX; f = f->next) {
+            iovcnt += fill_iov(f, &iov[iovcnt], FLUSH_IOV_MAX - iovcnt);
+        }
+
+        cnt = send_iov(fd, iov, iovcnt);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        if (cnt == 0) {
+            break;
+        }
+        total += cnt;
+
+        left = cnt;
+        while (left > 0) {
+            f = _head;
+            if (left >= f->len - f->sent) {
+                left -= f->len - f->sent;
+                pop();
+            } else {
+                f->sent += left;
+                _byte_cnt -= left;
+                left = 0;
+            }
+        }
+
+    }
+
+    return total;
+}
+
+void AgentSendQueue::clear()
+{
+    while (_head) {
+        pop();
+    }
+}
+
+bool AgentSendQueue::is_empty()
+{
+    return (_head == NULL);
+}
+
+size_t AgentSendQueue::get_byte_cnt()
+{
+    return _byte_cnt;
+}
+
+size_t AgentSendQueue::get_frame_cnt()
+{
+    return _frame_cnt;
+}
+
+uint32_t AgentSendQueue::get_overflow_frame_cnt()
+{
+    return _overflow_frame_cnt;
+}
+
+uint64_t AgentSendQueue::get_overflow_byte_cnt()
+{
+    return _overflow_byte_cnt;
+}
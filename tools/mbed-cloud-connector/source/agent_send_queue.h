@@ -0,0 +1,156 @@
+#ifndef AGENT_SEND_QUEUE_H
+#define AGENT_SEND_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "shared_buffer.h"
+
+#define AGENT_SEND_QUEUE_DEFAULT_MAX_BYTES  (4 * 1024 * 1024)
+#define AGENT_SEND_QUEUE_DEFAULT_MAX_FRAMES (1024)
+
+#define AGENT_SEND_MAX_SEGMENTS (4)
+
+enum AgentSendResult {
+    AGENT_SEND_OK,
+    AGENT_SEND_QUEUED,
+    AGENT_SEND_DROPPED,
+    AGENT_SEND_ERROR
+};
+
+/**
+ * Outbound frame queue for the (non-blocking) agent socket.
+ *
+ * Writes are made with MSG_NOSIGNAL, so a closed peer results in an EPIPE error
+ * rather than SIGPIPE.
+ *
+ * A frame is made up of a small number of segments (an iovec array). Each
+ * segment is either copied into the queue, or if it is backed by a
+ * SharedBuffer, referenced without copying.
+ *
+ * Frames that could not be written straight away are parked here in order and
+ * then written out with flush() once the socket becomes writable again. A frame
+ * that has been partially written is always kept, so the stream is never torn.
+ * New frames that would exceed the byte or frame limits are dropped whole and
+ * counted, except into an empty queue, which always takes one frame.
+ */
+class AgentSendQueue {
+
+public:
+
+    /**
+     * Constructor
+     */
+    AgentSendQueue();
+
+    /**
+     * Deconstructor
+     */
+    ~AgentSendQueue();
+
+    /**
+     * Set the queue limits.
+     *
+     * @param max_bytes  Maximum number of queued bytes
+     * @param max_frames Maximum number of queued frames
+     */
+    void set_limits(size_t max_bytes, size_t max_frames);
+
+    /**
+     * Send a frame.
+     *
+     * If the queue is empty an immediate write is attempted, and any part of
+     * the frame that could not be written is queued.
+     *
+     * @param fd     Socket to write to
+     * @param iov    Frame segments
+     * @param refs   Buffers backing the segments (entries may be NULL). May be
+     *               NULL if no segments are backed by buffers.
+     * @param iovcnt Number of segments (max AGENT_SEND_MAX_SEGMENTS)
+     * @return The result
+     */
+    AgentSendResult send(int fd, const struct iovec *iov, SharedBuffer *const *refs, int iovcnt);
+
+    /**
+     * Queue a frame.
+     *
+     * @param iov    Frame segments
+     * @param refs   Buffers backing the segments (entries may be NULL). May be
+     *               NULL if no segments are backed by buffers.
+     * @param iovcnt Number of segments (max AGENT_SEND_MAX_SEGMENTS)
+     * @param offset Number of bytes of the frame already written
+     * @return False if the frame was dropped
+     */
+    bool push(const struct iovec *iov, SharedBuffer *const *refs, int iovcnt, size_t offset);
+
+    /**
+     * Write out as much of the queue as the file descriptor will accept.
+     *
+     * @param fd Socket to write to
+     * @return Number of bytes written, or -1 on a write error (errno is set)
+     */
+    ssize_t flush(int fd);
+
+    /**
+     * Discard all queued frames.
+     */
+    void clear();
+
+    /**
+     * Checks if the queue is empty or not.
+     */
+    bool is_empty();
+
+    /**
+     * Get the number of queued bytes.
+     */
+    size_t get_byte_cnt();
+
+    /**
+     * Get the number of queued frames.
+     */
+    size_t get_frame_cnt();
+
+    /**
+     * Get the number of frames dropped due to the limits.
+     */
+    uint32_t get_overflow_frame_cnt();
+
+    /**
+     * Get the number of bytes dropped due to the limits.
+     */
+    uint64_t get_overflow_byte_cnt();
+
+private:
+
+    struct segment {
+        const char *base;
+        size_t len;
+        SharedBuffer *ref;
+    };
+
+    struct frame {
+        struct frame *next;
+        size_t len;
+        size_t sent;
+        int seg_cnt;
+        struct segment segs[AGENT_SEND_MAX_SEGMENTS];
+        /* copied segment data follows */
+    };
+
+    struct frame *_head;
+    struct frame *_tail;
+    size_t _max_bytes;
+    size_t _max_frames;
+    size_t _byte_cnt;
+    size_t _frame_cnt;
+    uint32_t _overflow_frame_cnt;
+    uint64_t _overflow_byte_cnt;
+
+    void pop();
+    int fill_iov(struct frame *f, struct iovec *iov, int iovcnt);
+
+};
+
+#endif // AGENT_SEND_QUEUE_H
@@ -0,0 +1,46 @@
+#ifndef CONNECTOR_PROBES_H
+#define CONNECTOR_PROBES_H
+
+/*
+ * USDT (SystemTap/DTrace style) static probes, for tracing the connector in
+ * the field with perf, bpftrace etc, under the "enebular_connector" provider.
+ *
+ * A probe is a single nop until it is attached to, and its arguments are only
+ * loaded into registers, so probes must only be passed values at hand (no
+ * function calls that do any real work).
+ *
+ * The probes are built in when sys/sdt.h (systemtap-sdt-dev) is available,
+ * unless CONNECTOR_PROBES is defined as 0, and compile to nothing otherwise.
+ */
+
+#ifndef CONNECTOR_PROBES
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define CONNECTOR_PROBES 1
+#endif
+#endif
+#endif
+
+#if CONNECTOR_PROBES
+
+#include <sys/sdt.h>
+
+#define CONNECTOR_PROBE(name) \
+    DTRACE_PROBE(enebular_connector, name)
+#define CONNECTOR_PROBE1(name, a1) \
+    DTRACE_PROBE1(enebular_connector, name, a1)
+#define CONNECTOR_PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(enebular_connector, name, a1, a2)
+#define CONNECTOR_PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(enebular_connector, name, a1, a2, a3)
+
+#else
+
+#define CONNECTOR_PROBE(name)               do { } while (0)
+#define CONNECTOR_PROBE1(name, a1)          do { } while (0)
+#define CONNECTOR_PROBE2(name, a1, a2)      do { } while (0)
+#define CONNECTOR_PROBE3(name, a1, a2, a3)  do { } while (0)
+
+#endif
+
+#endif // CONNECTOR_PROBES_H
@@ -4,34 +4,101 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include "enebular_agent_mbed_cloud_connector.h"
 #include "enebular_agent_interface.h"
+#include "connector_probes.h"
 
 #define DEFAULT_SERVER_SOCKET_PATH      "/tmp/enebular-local-agent.socket"
 #define CLIENT_SOCKET_PATH_BASE "/tmp/enebular-local-agent-client.socket-"
 
 #define END_OF_MSG_MARKER       (0x1E) // RS (Record Separator)
 
-#define CONNECT_RETRIES_MAX     (5)
-#define SEND_BUF_SIZE           (100 * 1024)
-#define RECV_BUF_SIZE           (1024 * 1024)
+#define RETRY_WAIT_MIN_MS       (100)
+#define RETRY_WAIT_MAX_MS       (5000)
+#define CONNECT_OK_TIMEOUT_MS   (5000)
+#define DISCONNECT_DRAIN_MS     (1000)
+/* message segments per frame, leaving one for the header or marker */
+#define FRAME_MAX_MSG_SEGMENTS  (AGENT_SEND_MAX_SEGMENTS - 1)
+#define RECV_BUF_INIT_SIZE      (64 * 1024)
+#define RECV_BUF_MAX_SIZE       (1024 * 1024)
 
 EnebularAgentInterface::EnebularAgentInterface(EnebularAgentMbedCloudConnector * connector,
     const char* server_socket):
     _server_socket(server_socket[0] == '\0' ? DEFAULT_SERVER_SOCKET_PATH : server_socket),
     _connector(connector),
     _logger(Logger::get_instance()),
-    _is_connected(false)
+    _tracer(connector->get_tracer()),
+    _recv_parser(END_OF_MSG_MARKER),
+    _recv_ts(0),
+    _send_wait_writable(false),
+    _corked(false),
+    _send_binary(false),
+    _agent_supports_log_batches(false),
+    _is_connected(false),
+    _state(STATE_IDLE),
+    _retry_timer(0),
+    _retry_wait_ms(RETRY_WAIT_MIN_MS),
+    _connect_ok_timer(0),
+    _connect_fail_cnt(0)
 {
+    add_metrics(connector->get_metrics());
 }
 
 EnebularAgentInterface::~EnebularAgentInterface()
 {
 }
 
+void EnebularAgentInterface::add_metrics(Metrics *metrics)
+{
+    _received_frames = metrics->add_counter(METRICS_PREFIX "agent_received_frames_total",
+        "Messages received from the agent");
+    _received_bytes = metrics->add_counter(METRICS_PREFIX "agent_received_bytes_total",
+        "Bytes received from the agent");
+    metrics->add_counter(METRICS_PREFIX "agent_received_dropped_frames_total",
+        "Messages from the agent dropped for exceeding the receive buffer",
+        MetricValueCB(this, &EnebularAgentInterface::get_received_dropped_cnt));
+    _sent_frames = metrics->add_counter(METRICS_PREFIX "agent_sent_frames_total",
+        "Messages sent (or queued to be sent) to the agent");
+    _sent_bytes = metrics->add_counter(METRICS_PREFIX "agent_sent_bytes_total",
+        "Bytes sent (or queued to be sent) to the agent");
+    metrics->add_counter(METRICS_PREFIX "agent_send_dropped_frames_total",
+        "Messages for the agent dropped due to the send queue being full",
+        MetricValueCB(this, &EnebularAgentInterface::get_send_dropped_cnt));
+    metrics->add_gauge(METRICS_PREFIX "agent_send_queue_bytes",
+        "Bytes queued for sending to the agent",
+        MetricValueCB(this, &EnebularAgentInterface::get_send_queue_bytes));
+    metrics->add_gauge(METRICS_PREFIX "agent_send_queue_frames",
+        "Messages queued for sending to the agent",
+        MetricValueCB(this, &EnebularAgentInterface::get_send_queue_frames));
+}
+
+uint64_t EnebularAgentInterface::get_received_dropped_cnt()
+{
+    return _recv_parser.get_dropped_cnt();
+}
+
+uint64_t EnebularAgentInterface::get_send_dropped_cnt()
+{
+    return _send_queue.get_overflow_frame_cnt();
+}
+
+uint64_t EnebularAgentInterface::get_send_queue_bytes()
+{
+    return _send_queue.get_byte_cnt();
+}
+
+uint64_t EnebularAgentInterface::get_send_queue_frames()
+{
+    return _send_queue.get_frame_cnt();
+}
+
 bool EnebularAgentInterface::connected_check()
 {
     if (!_is_connected) {
@@ -77,80 +144,218 @@ void EnebularAgentInterface::update_connected_state(bool connected)
     notify_conntection_state();
 }
 
-void EnebularAgentInterface::handle_recv_msg(const char *msg)
+/* indexed by (type - 1) */
+const struct EnebularAgentInterface::recv_msg_handler EnebularAgentInterface::_recv_msg_handlers[] = {
+    { AGENT_MSG_OK,             "ok",               false,  &EnebularAgentInterface::handle_ok_msg },
+    { AGENT_MSG_AGENT_INFO,     "agent: ",          true,   &EnebularAgentInterface::handle_agent_info_msg },
+    { AGENT_MSG_CTRL_MESSAGE,   "ctrlMessage: ",    true,   &EnebularAgentInterface::handle_ctrl_message_msg },
+    { AGENT_MSG_REGISTER,       "register",         false,  &EnebularAgentInterface::handle_register_msg },
+    { AGENT_MSG_CONNECT,        "connect",          false,  &EnebularAgentInterface::handle_connect_msg },
+    { AGENT_MSG_DISCONNECT,     "disconnect",       false,  &EnebularAgentInterface::handle_disconnect_msg },
+    { AGENT_MSG_FRAMING,        "framing: ",        true,   &EnebularAgentInterface::handle_framing_msg },
+    { AGENT_MSG_STATS,          "stats",            false,  &EnebularAgentInterface::handle_stats_msg },
+    { AGENT_MSG_CAPABILITIES,   "capabilities: ",   true,   &EnebularAgentInterface::handle_capabilities_msg },
+};
+
+#define RECV_MSG_HANDLER_CNT \
+    (sizeof(_recv_msg_handlers) / sizeof(_recv_msg_handlers[0]))
+
+void EnebularAgentInterface::handle_ok_msg(const char *msg)
 {
-    _logger->log_console(DEBUG, "Agent: received message: [%s]", msg);
+    if (_state == STATE_WAITING_OK) {
+        _connector->cancel_timer(_connect_ok_timer);
+        _connect_ok_timer = 0;
+        _retry_wait_ms = RETRY_WAIT_MIN_MS;
+        _state = STATE_CONNECTED;
+        update_connected_state(true);
+    } else {
+        _logger->log_console(INFO, "Agent: received unexpected ok");
+    }
+}
 
-    if (strcmp(msg, "ok") == 0) {
+void EnebularAgentInterface::handle_agent_info_msg(const char *msg)
+{
+    notify_agent_info(msg);
+}
 
-        if (_waiting_for_connect_ok) {
-            _waiting_for_connect_ok = false;
-            update_connected_state(true);
-        } else {
-            _logger->log_console(INFO, "Agent: received unexpected ok");
-        }
+void EnebularAgentInterface::handle_ctrl_message_msg(const char *msg)
+{
+    struct msg_trace trace;
 
-    } else if (strncmp(msg, "agent: ", strlen("agent: ")) == 0) {
+    MessageTracer::init(&trace, MSG_TRACE_FROM_AGENT, "ctrlMessage", strlen(msg));
+    trace.ts[MSG_TRACE_RECEIVED] = _recv_ts;
+    trace.ts[MSG_TRACE_HANDLED] = MessageTracer::now();
 
-        notify_agent_info(msg + strlen("agent: "));
+    _tracer->begin(&trace);
+    notify_ctrl_message(msg);
+    _tracer->end();
+}
 
-    } else if (strncmp(msg, "ctrlMessage: ", strlen("ctrlMessage: ")) == 0) {
+void EnebularAgentInterface::handle_register_msg(const char *msg)
+{
+    notify_registration_request();
+}
 
-        notify_ctrl_message(msg + strlen("ctrlMessage: "));
+void EnebularAgentInterface::handle_connect_msg(const char *msg)
+{
+    notify_connection_request(true);
+}
 
-    } else if (strcmp(msg, "register") == 0) {
+void EnebularAgentInterface::handle_disconnect_msg(const char *msg)
+{
+    notify_connection_request(false);
+}
 
-        notify_registration_request();
+void EnebularAgentInterface::handle_framing_msg(const char *msg)
+{
+    static const char accept_msg[] =
+        "{\"type\":\"framing\",\"framing\":{\"mode\":\"binary\"}}";
+
+    if (strcmp(msg, "binary") == 0) {
+        if (_send_binary) {
+            return;
+        }
+        /* the accept is the last message we send with text framing */
+        send_msg(accept_msg, sizeof(accept_msg) - 1);
+        _send_binary = true;
+    } else if (strcmp(msg, "active") == 0) {
+        _recv_parser.set_mode(AGENT_FRAME_MODE_BINARY);
+        _logger->log_console(INFO, "Agent: using binary framing");
+    } else {
+        _logger->log_console(INFO, "Agent: unsupported framing: %s", msg);
+    }
+}
+
+void EnebularAgentInterface::handle_stats_msg(const char *msg)
+{
+    _json.reset();
+    _json.begin_object();
+    _json.member("type", "stats");
+    _json.key("stats");
+    _connector->get_metrics()->write_json(_json);
+    _json.end_object();
+
+    send_json();
+}
+
+void EnebularAgentInterface::handle_capabilities_msg(const char *msg)
+{
+    const char *p = msg;
+
+    while (*p != '\0') {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
+        if (len == strlen("logs") && strncmp(p, "logs", len) == 0) {
+            _agent_supports_log_batches = true;
+        }
 
-    } else if (strcmp(msg, "connect") == 0) {
+        if (!end) {
+            break;
+        }
+        p = end + 1;
+    }
 
-        notify_connection_request(true);
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: capabilities: %s", msg);
+}
 
-    } else if (strcmp(msg, "disconnect") == 0) {
+void EnebularAgentInterface::handle_recv_msg(char *msg, size_t len)
+{
+    const struct recv_msg_handler *handler = NULL;
+    const char *content = msg;
+    size_t i;
+
+    if (_recv_parser.get_mode() == AGENT_FRAME_MODE_BINARY) {
 
-        notify_connection_request(false);
+        AgentMsgType type = (AgentMsgType)(unsigned char)msg[0];
+        content = msg + 1;
+        if (type >= 1 && type <= RECV_MSG_HANDLER_CNT) {
+            handler = &_recv_msg_handlers[type - 1];
+        }
+        LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: received message: type:%d [%s]", type, content);
+        if (!handler) {
+            _logger->log_console(INFO, "Agent: unsupported message type: %d", type);
+            return;
+        }
 
     } else {
 
-        _logger->log_console(INFO, "Agent: unsupported message: [%s]", msg);
+        LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: received message: [%s]", msg);
+        for (i = 0; i < RECV_MSG_HANDLER_CNT; i++) {
+            const struct recv_msg_handler *h = &_recv_msg_handlers[i];
+            if (h->has_content) {
+                size_t prefix_len = strlen(h->prefix);
+                if (strncmp(msg, h->prefix, prefix_len) == 0) {
+                    handler = h;
+                    content = msg + prefix_len;
+                    break;
+                }
+            } else if (strcmp(msg, h->prefix) == 0) {
+                handler = h;
+                break;
+            }
+        }
+
+    }
 
+    if (!handler) {
+        _logger->log_console(INFO, "Agent: unsupported message: [%s]", msg);
+        return;
     }
+
+    (this->*handler->handle)(content);
 }
 
 void EnebularAgentInterface::recv()
 {
     ssize_t cnt;
+    size_t avail;
+    size_t len;
+    uint32_t dropped_cnt;
+    char *buf;
+    char *msg;
+
+    /* the socket is edge-triggered, so read until there is nothing left */
+    while (1) {
+
+        dropped_cnt = _recv_parser.get_dropped_cnt();
 
-    cnt = read(_agent_fd, &_recv_buf[_recv_cnt], RECV_BUF_SIZE - _recv_cnt);
-    if (cnt < 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            _logger->log_console(ERROR, "Agent: receive read error: %s", strerror(errno));
+        buf = _recv_parser.get_write_buf(&avail);
+        if (!buf) {
+            return;
         }
-        return;
-    }
-    if (cnt < 1) {
-        return;
-    }
 
-    _logger->log_console(DEBUG, "Agent: received data (%ld)", cnt);
-    _recv_cnt += cnt;
+        if (_recv_parser.get_dropped_cnt() != dropped_cnt) {
+            _logger->log_console(ERROR, "Agent: message exceeds receive buffer size. dropping.");
+        }
 
-    if (_recv_buf[_recv_cnt-1] == END_OF_MSG_MARKER) {
-        _recv_cnt--;
-        _recv_buf[_recv_cnt] = '\0';
-        char delim[] = {END_OF_MSG_MARKER, '\0'};
-        char *msg = strtok(_recv_buf, delim);
-        while (msg) {
-            handle_recv_msg(msg);
-            msg = strtok(NULL, delim);
+        cnt = read(_agent_fd, buf, avail);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                _logger->log_console(ERROR, "Agent: receive read error: %s", strerror(errno));
+                connection_lost();
+            }
+            return;
+        }
+        if (cnt == 0) {
+            _logger->log_console(INFO, "Agent: connection closed by agent");
+            connection_lost();
+            return;
         }
-        _recv_cnt = 0;
-        return;
-    }
 
-    if (_recv_cnt == RECV_BUF_SIZE) {
-        _logger->log_console(DEBUG, "Agent: receive buffer full. clearing.");
-        _recv_cnt = 0;
+        LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: received data (%ld)", cnt);
+        _recv_parser.commit(cnt);
+        _received_bytes->inc(cnt);
+        _recv_ts = MessageTracer::now();
+
+        while ((msg = _recv_parser.next_frame(&len)) != NULL) {
+            CONNECTOR_PROBE1(agent_frame_received, len);
+            _received_frames->inc();
+            handle_recv_msg(msg, len);
+        }
     }
 }
 
@@ -159,11 +364,9 @@ bool EnebularAgentInterface::connect_agent()
     int fd;
     struct sockaddr_un addr;
     char path[PATH_MAX];
-    int retries = 0;
-    int retry_wait_ms = 500;
     int ret;
 
-    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd < 0) {
         _logger->log_console(ERROR, "Agent: failed to open socket: %s", strerror(errno));
         return false;
@@ -189,43 +392,35 @@ bool EnebularAgentInterface::connect_agent()
         goto err;
     }
 
-    while (1) {
-
-        memset(&addr, 0, sizeof(addr));
-        addr.sun_family = AF_UNIX;
-        strcpy(addr.sun_path, _server_socket);
-        ret = ::connect(fd, (struct sockaddr *)&addr, sizeof(addr));
-        if (ret == 0) {
-            break;
-        } else if (retries++ < CONNECT_RETRIES_MAX) {
-            _logger->log_console(INFO, "Agent: connect failed, retrying in %dms", retry_wait_ms);
-            usleep(retry_wait_ms * 1000);
-            retry_wait_ms *= 2;
-            continue;
-        } else {
-            _logger->log_console(ERROR, "Agent: failed to connect: %s", strerror(errno));
-            goto err;
-        }
-
+    /* a unix domain socket connect either completes or fails immediately */
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, _server_socket);
+    ret = ::connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0) {
+        /* report the first failure only, as the agent may take a while */
+        _logger->log_console(_connect_fail_cnt++ ? DEBUG : INFO,
+            "Agent: failed to connect: %s", strerror(errno));
+        goto err;
     }
+    _connect_fail_cnt = 0;
 
     _agent_fd = fd;
     strncpy(_client_path, path, sizeof(_client_path));
 
-    _send_buf = (char *)calloc(1, SEND_BUF_SIZE);
-    if (!_send_buf) {
+    if (!_recv_parser.init(RECV_BUF_INIT_SIZE, RECV_BUF_MAX_SIZE)) {
         _logger->log_console(ERROR, "Agent: oom");
         goto err;
     }
 
-    _recv_buf = (char *)calloc(1, RECV_BUF_SIZE);
-    if (!_recv_buf) {
-        free(_send_buf);
-        _logger->log_console(ERROR, "Agent: oom");
+    if (!_connector->register_wait_fd(_agent_fd, "agent",
+            WaitFdCB(this, &EnebularAgentInterface::agent_fd_cb), true)) {
+        _recv_parser.uninit();
         goto err;
     }
-
-    _connector->register_wait_fd(_agent_fd);
+    _send_wait_writable = false;
+    _send_binary = false;
+    _agent_supports_log_batches = false;
 
     return true;
  err:
@@ -238,44 +433,126 @@ void EnebularAgentInterface::disconnect_agent()
 {
     _connector->deregister_wait_fd(_agent_fd);
 
-    free(_send_buf);
-    free(_recv_buf);
+    _recv_parser.uninit();
+    _send_queue.clear();
+    _tracer->dropped();
     close(_agent_fd);
+    _agent_fd = -1;
     unlink(_client_path);
 }
 
-bool EnebularAgentInterface::connect()
+void EnebularAgentInterface::try_connect()
 {
-    _logger->log_console(DEBUG, "Agent: connect to %s...", _server_socket);
+    if (!connect_agent()) {
+        schedule_connect();
+        return;
+    }
 
-    if (_is_connected || _waiting_for_connect_ok) {
-        return true;
+    _state = STATE_WAITING_OK;
+    _connect_ok_timer = _connector->add_timer(CONNECT_OK_TIMEOUT_MS, 0, "agent-connect-ok",
+        TimerCB(this, &EnebularAgentInterface::connect_ok_timeout_cb));
+
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: waiting for connect confirmation...");
+}
+
+void EnebularAgentInterface::schedule_connect()
+{
+    _state = STATE_RETRY_WAIT;
+    _retry_timer = _connector->add_timer(_retry_wait_ms, 0, "agent-retry",
+        TimerCB(this, &EnebularAgentInterface::retry_timer_cb));
+
+    _retry_wait_ms *= 2;
+    if (_retry_wait_ms > RETRY_WAIT_MAX_MS) {
+        _retry_wait_ms = RETRY_WAIT_MAX_MS;
     }
+}
 
-    if (!connect_agent()) {
-        _logger->log_console(ERROR, "Agent: connect failed");
-        return false;
+void EnebularAgentInterface::retry_timer_cb()
+{
+    _retry_timer = 0;
+
+    if (_state == STATE_RETRY_WAIT) {
+        try_connect();
     }
+}
 
-    _waiting_for_connect_ok = true;
+void EnebularAgentInterface::connect_ok_timeout_cb()
+{
+    _connect_ok_timer = 0;
 
-    _logger->log_console(DEBUG, "Agent: waiting for connect confirmation...");
+    if (_state != STATE_WAITING_OK) {
+        return;
+    }
 
-    return true;
+    _logger->log_console(ERROR, "Agent: no connect confirmation, reconnecting...");
+
+    disconnect_agent();
+    schedule_connect();
 }
 
-void EnebularAgentInterface::disconnect()
+void EnebularAgentInterface::connection_lost()
 {
-    if (!_waiting_for_connect_ok && !_is_connected) {
+    bool was_connected = (_state == STATE_CONNECTED);
+
+    if (_state != STATE_WAITING_OK && _state != STATE_CONNECTED) {
         return;
     }
 
-    _logger->log_console(DEBUG, "Agent: disconnect...");
+    _connector->cancel_timer(_connect_ok_timer);
+    _connect_ok_timer = 0;
 
     disconnect_agent();
 
-    _waiting_for_connect_ok = false;
-    update_connected_state(false);
+    _logger->log_console(INFO, "Agent: reconnecting...");
+    _retry_wait_ms = RETRY_WAIT_MIN_MS;
+    schedule_connect();
+
+    if (was_connected) {
+        update_connected_state(false);
+    }
+}
+
+bool EnebularAgentInterface::connect()
+{
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: connect to %s...", _server_socket);
+
+    if (_state != STATE_IDLE) {
+        return true;
+    }
+
+    _retry_wait_ms = RETRY_WAIT_MIN_MS;
+    try_connect();
+
+    return true;
+}
+
+void EnebularAgentInterface::disconnect()
+{
+    bool was_connected = (_state == STATE_CONNECTED);
+
+    switch (_state) {
+        case STATE_IDLE:
+            return;
+        case STATE_RETRY_WAIT:
+            _connector->cancel_timer(_retry_timer);
+            _retry_timer = 0;
+            break;
+        case STATE_WAITING_OK:
+        case STATE_CONNECTED:
+            LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: disconnect...");
+            _connector->cancel_timer(_connect_ok_timer);
+            _connect_ok_timer = 0;
+            /* the last messages (disconnect notice, logs) are still worth sending */
+            drain_send_queue(DISCONNECT_DRAIN_MS);
+            disconnect_agent();
+            break;
+    }
+
+    _state = STATE_IDLE;
+
+    if (was_connected) {
+        update_connected_state(false);
+    }
 }
 
 bool EnebularAgentInterface::is_connected()
@@ -283,140 +560,346 @@ bool EnebularAgentInterface::is_connected()
     return _is_connected;
 }
 
-void EnebularAgentInterface::run()
+void EnebularAgentInterface::agent_fd_cb(uint32_t events)
+{
+    /* a closed connection is detected by recv() reading EOF or an error */
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+        recv();
+    }
+
+    if (_state != STATE_WAITING_OK && _state != STATE_CONNECTED) {
+        return;
+    }
+
+    if ((events & EPOLLOUT) && !_corked) {
+        flush();
+    }
+}
+
+void EnebularAgentInterface::cork()
 {
-    recv();
+    _corked = true;
 }
 
-void EnebularAgentInterface::send_msg(const char *msg)
+void EnebularAgentInterface::uncork()
 {
-    char *full_msg;
-    int msg_len;
-    int write_cnt = 0;
-    int zero_writes = 0;
-    int cnt;
+    _corked = false;
+
+    flush();
+}
+
+void EnebularAgentInterface::flush()
+{
+    if ((_state == STATE_WAITING_OK || _state == STATE_CONNECTED) &&
+            !_send_queue.is_empty()) {
+        flush_send_queue();
+    }
+}
+
+void EnebularAgentInterface::set_send_queue_limits(size_t max_bytes, size_t max_frames)
+{
+    _send_queue.set_limits(max_bytes, max_frames);
+}
+
+void EnebularAgentInterface::update_send_wait_writable()
+{
+    bool wait_writable = !_send_queue.is_empty();
+
+    if (wait_writable != _send_wait_writable) {
+        _connector->set_wait_fd_writable(_agent_fd, wait_writable);
+        _send_wait_writable = wait_writable;
+    }
+}
+
+void EnebularAgentInterface::flush_send_queue()
+{
+    if (_send_queue.flush(_agent_fd) < 0) {
+        _logger->log_console(ERROR, "Agent: send queue write error: %s", strerror(errno));
+        _send_queue.clear();
+        _tracer->dropped();
+    } else if (_send_queue.is_empty()) {
+        _tracer->written();
+    }
+
+    update_send_wait_writable();
+}
+
+/* blocks until the send queue is written out, for up to timeout_ms */
+void EnebularAgentInterface::drain_send_queue(int timeout_ms)
+{
+    struct timespec ts;
+    struct pollfd pfd;
+    int64_t deadline_ms;
+    int64_t now_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    deadline_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + timeout_ms;
+
+    while (!_send_queue.is_empty()) {
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        if (now_ms >= deadline_ms) {
+            _logger->log_console(INFO, "Agent: dropping %zu unsent bytes on disconnect",
+                _send_queue.get_byte_cnt());
+            break;
+        }
+
+        pfd.fd = _agent_fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, (int)(deadline_ms - now_ms)) < 0 && errno != EINTR) {
+            break;
+        }
+        if (pfd.revents) {
+            flush_send_queue();
+        }
+
+    }
+}
+
+void EnebularAgentInterface::send_frame(const struct iovec *iov, SharedBuffer *const *refs,
+        int iovcnt)
+{
+    static char marker = END_OF_MSG_MARKER;
+    struct iovec frame_iov[AGENT_SEND_MAX_SEGMENTS];
+    SharedBuffer *frame_refs[AGENT_SEND_MAX_SEGMENTS];
+    unsigned char hdr[AGENT_FRAME_LEN_SIZE + 1];
+    AgentSendResult result;
+    size_t frame_len = 0;
+    size_t len = 0;
+    int cnt = 0;
+    int i;
+
+    if (iovcnt > FRAME_MAX_MSG_SEGMENTS) {
+        _logger->log_console(ERROR, "Agent: too many message segments (%d)", iovcnt);
+        return;
+    }
 
     if (!connected_check()) {
         return;
     }
 
-    msg_len = strlen(msg);
+    if (_send_binary) {
+        for (i = 0; i < iovcnt; i++) {
+            len += iov[i].iov_len;
+        }
+        len += 1;
+        hdr[0] = (len >> 24) & 0xff;
+        hdr[1] = (len >> 16) & 0xff;
+        hdr[2] = (len >> 8) & 0xff;
+        hdr[3] = len & 0xff;
+        hdr[4] = AGENT_MSG_JSON;
+        frame_iov[cnt].iov_base = hdr;
+        frame_iov[cnt].iov_len = sizeof(hdr);
+        frame_refs[cnt++] = NULL;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        frame_iov[cnt] = iov[i];
+        frame_refs[cnt++] = refs ? refs[i] : NULL;
+    }
+    if (!_send_binary) {
+        frame_iov[cnt].iov_base = &marker;
+        frame_iov[cnt].iov_len = 1;
+        frame_refs[cnt++] = NULL;
+    }
 
-    _logger->log_console(DEBUG, "Agent: send message: [%s] (%d)", msg, msg_len);
+    for (i = 0; i < cnt; i++) {
+        frame_len += frame_iov[i].iov_len;
+    }
 
-    full_msg = (char *)malloc(msg_len + 1);
-    if (!full_msg) {
-        _logger->log_console(ERROR, "Agent: oom\n");
-        return;
+    if (_corked) {
+        result = _send_queue.push(frame_iov, frame_refs, cnt, 0) ?
+            AGENT_SEND_QUEUED : AGENT_SEND_DROPPED;
+    } else {
+        result = _send_queue.send(_agent_fd, frame_iov, frame_refs, cnt);
     }
-    memcpy(full_msg, msg, msg_len);
-    full_msg[msg_len] = END_OF_MSG_MARKER;
-    msg_len++;
 
-    while (1) {
+    CONNECTOR_PROBE2(agent_frame_sent, frame_len, (int)result);
 
-        cnt = write(_agent_fd, full_msg+write_cnt, msg_len-write_cnt);
-        if (cnt < 0) {
-            if (errno != EINTR) {
-                _logger->log_console(ERROR, "Agent: send message write error: %s", strerror(errno));
-                break;
-            }
-        } else if (cnt == 0) {
-            zero_writes++;
-            if (zero_writes > 5) {
-                _logger->log_console(ERROR, "Agent: send message: too many zero writes");
-                break;
-            }
-        } else {
-            zero_writes = 0;
-            write_cnt += cnt;
+    if (result == AGENT_SEND_OK || result == AGENT_SEND_QUEUED) {
+        _sent_frames->inc();
+        _sent_bytes->inc(frame_len);
+        _tracer->mark(MSG_TRACE_SENT);
+        if (result == AGENT_SEND_OK) {
+            _tracer->mark(MSG_TRACE_WRITTEN);
         }
+    }
 
-        if (write_cnt == msg_len) {
+    switch (result) {
+        case AGENT_SEND_OK:
             break;
-        }
+        case AGENT_SEND_QUEUED:
+            if (!_corked) {
+                update_send_wait_writable();
+            }
+            break;
+        case AGENT_SEND_DROPPED:
+            if (_send_queue.get_overflow_frame_cnt() == 1 ||
+                    !(_send_queue.get_overflow_frame_cnt() % 100)) {
+                _logger->log_console(ERROR, "Agent: send queue full, dropped message (%u dropped in total)",
+                    _send_queue.get_overflow_frame_cnt());
+            }
+            break;
+        case AGENT_SEND_ERROR:
+            _logger->log_console(ERROR, "Agent: send message write error: %s", strerror(errno));
+            break;
+    }
+}
+
+void EnebularAgentInterface::send_msg(const char *msg, size_t len)
+{
+    struct iovec iov;
+
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: send message: [%.*s] (%zu)", (int)len, msg, len);
+
+    iov.iov_base = (void *)msg;
+    iov.iov_len = len;
+
+    send_frame(&iov, NULL, 1);
+}
 
+void EnebularAgentInterface::send_json()
+{
+    if (_json.failed()) {
+        _logger->log_console(ERROR, "Agent: oom");
+        return;
     }
 
-    free(full_msg);
+    send_msg(_json.data(), _json.len());
 }
 
-void EnebularAgentInterface::send_message(const char *type, const char *content)
+void EnebularAgentInterface::send_message(const char *type, SharedBuffer *content)
 {
-    snprintf(_send_buf, SEND_BUF_SIZE-1,
-        "{"
-            "\"type\": \"message\","
-            "\"message\": {"
-                "\"messageType\": \"%s\","
-                "\"message\": %s"
-            "}"
-        "}",
-        type,
-        content
-    );
+    static char suffix[] = { '}', '}' };
+    struct iovec iov[3];
+    SharedBuffer *refs[3] = { NULL, content, NULL };
+
+    /* the content is already JSON. only the surrounding part is built here. */
+    _json.reset();
+    _json.begin_object();
+    _json.member("type", "message");
+    _json.key("message");
+    _json.begin_object();
+    _json.member("messageType", type);
+    _json.key("message");
+    if (_json.failed()) {
+        _logger->log_console(ERROR, "Agent: oom");
+        return;
+    }
+
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: send message: type:%s (%zu)", type, content->len());
 
-    send_msg(_send_buf);
+    iov[0].iov_base = (void *)_json.data();
+    iov[0].iov_len = _json.len();
+    iov[1].iov_base = (void *)content->data();
+    iov[1].iov_len = content->len();
+    iov[2].iov_base = suffix;
+    iov[2].iov_len = sizeof(suffix);
+
+    send_frame(iov, refs, 3);
 }
 
-void EnebularAgentInterface::send_ctrl_message(const char *message)
+void EnebularAgentInterface::send_ctrl_message(SharedBuffer *message)
 {
-    snprintf(_send_buf, SEND_BUF_SIZE-1,
+    static char prefix[] =
         "{"
-            "\"type\": \"ctrlMessage\","
-            "\"message\": %s"
-        "}",
-        message
-    );
-
-    send_msg(_send_buf);
+            "\"type\":\"ctrlMessage\","
+            "\"message\":";
+    static char suffix[] = { '}' };
+    struct iovec iov[3];
+    SharedBuffer *refs[3] = { NULL, message, NULL };
+
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent: send ctrl message (%zu)", message->len());
+
+    iov[0].iov_base = prefix;
+    iov[0].iov_len = sizeof(prefix) - 1;
+    iov[1].iov_base = (void *)message->data();
+    iov[1].iov_len = message->len();
+    iov[2].iov_base = suffix;
+    iov[2].iov_len = sizeof(suffix);
+
+    send_frame(iov, refs, 3);
 }
 
-/**
- * Todo:
- *  - JSON string escaping for message content
- */
 void EnebularAgentInterface::send_log_message(const char *level, const char *prefix, const char *message)
 {
-    snprintf(_send_buf, SEND_BUF_SIZE-1,
-        "{"
-            "\"type\": \"log\","
-            "\"log\": {"
-                "\"level\": \"%s\","
-                "\"message\": \"%s: %s\""
-            "}"
-        "}",
-        level,
-        prefix,
-        message
-    );
+    _json.reset();
+    _json.begin_object();
+    _json.member("type", "log");
+    _json.key("log");
+    _json.begin_object();
+    _json.member("level", level);
+    _json.key("message");
+    _json.string_begin();
+    _json.string_append(prefix, strlen(prefix));
+    _json.string_append(": ", 2);
+    _json.string_append(message, strlen(message));
+    _json.string_end();
+    _json.end_object();
+    _json.end_object();
+
+    send_json();
+}
+
+void EnebularAgentInterface::send_log_messages(const char *prefix,
+        const struct agent_log_entry *entries, size_t cnt)
+{
+    size_t prefix_len = strlen(prefix);
+
+    _json.reset();
+    _json.begin_object();
+    _json.member("type", "logs");
+    _json.key("logs");
+    _json.begin_array();
+    for (size_t i = 0; i < cnt; i++) {
+        _json.begin_object();
+        _json.member("level", entries[i].level);
+        _json.key("ts");
+        _json.number(entries[i].ts);
+        _json.key("message");
+        _json.string_begin();
+        _json.string_append(prefix, prefix_len);
+        _json.string_append(": ", 2);
+        _json.string_append(entries[i].message, strlen(entries[i].message));
+        _json.string_end();
+        _json.end_object();
+    }
+    _json.end_array();
+    _json.end_object();
 
-    send_msg(_send_buf);
+    send_json();
+}
+
+bool EnebularAgentInterface::supports_log_batches()
+{
+    return _agent_supports_log_batches;
 }
 
 void EnebularAgentInterface::notify_connection(bool connected)
 {
+    static const char connect_msg[] = "{\"type\":\"connect\"}";
+    static const char disconnect_msg[] = "{\"type\":\"disconnect\"}";
+
     if (connected) {
-        send_msg("{\"type\": \"connect\"}");
+        send_msg(connect_msg, sizeof(connect_msg) - 1);
     } else {
-        send_msg("{\"type\": \"disconnect\"}");
+        send_msg(disconnect_msg, sizeof(disconnect_msg) - 1);
     }
 }
 
 void EnebularAgentInterface::notify_registration(bool registered, const char *device_id)
 {
-    snprintf(_send_buf, SEND_BUF_SIZE-1,
-        "{"
-            "\"type\": \"registration\","
-            "\"registration\": {"
-                "\"registered\": \"%s\","
-                "\"deviceId\": \"%s\""
-            "}"
-        "}",
-        registered ? "true" : "false",
-        device_id ? device_id : ""
-    );
-
-    send_msg(_send_buf);
+    _json.reset();
+    _json.begin_object();
+    _json.member("type", "registration");
+    _json.key("registration");
+    _json.begin_object();
+    _json.member("registered", registered ? "true" : "false");
+    _json.member("deviceId", device_id ? device_id : "");
+    _json.end_object();
+    _json.end_object();
+
+    send_json();
 }
 
 void EnebularAgentInterface::on_agent_connection_change(AgentConnectionChangeCB cb)
@@ -5,6 +5,11 @@
 #include <limits.h>
 #include "mbed-cloud-client/MbedCloudClient.h"
 #include "logger.h"
+#include "agent_frame_parser.h"
+#include "agent_send_queue.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "message_tracer.h"
 
 class EnebularAgentMbedCloudConnector;
 class Logger;
@@ -15,10 +20,69 @@ typedef FP1<void, bool> ConnectorConnectionRequestCB;
 typedef FP1<void, const char *> AgentInfoCB;
 typedef FP1<void, const char *> CtrlMessageCB;
 
+/**
+ * Message types.
+ *
+ * These are used as the type tag of messages when using binary framing. In
+ * text mode, the messages received from the agent are identified by their
+ * prefix instead.
+ */
+enum AgentMsgType {
+    AGENT_MSG_OK            = 0x01,
+    AGENT_MSG_AGENT_INFO    = 0x02,
+    AGENT_MSG_CTRL_MESSAGE  = 0x03,
+    AGENT_MSG_REGISTER      = 0x04,
+    AGENT_MSG_CONNECT       = 0x05,
+    AGENT_MSG_DISCONNECT    = 0x06,
+    AGENT_MSG_FRAMING       = 0x07,
+    AGENT_MSG_STATS         = 0x08,
+    AGENT_MSG_CAPABILITIES  = 0x09,
+    AGENT_MSG_JSON          = 0x10,
+};
+
+/**
+ * A log message, for sending in a batch with send_log_messages().
+ */
+struct agent_log_entry {
+    const char *level;
+    /* when it was logged, in ms since the epoch */
+    uint64_t ts;
+    const char *message;
+};
+
 /**
  * The enebular agent interface.
  *
  * This class provides a communication interface to the main enebular agent.
+ *
+ * By default messages are delimited with an RS character (text framing). If
+ * the agent offers it after confirming the connection, the interface switches
+ * to length prefixed frames with a type tag (binary framing) as follows.
+ *
+ *   agent:     "framing: binary"   (offer, text)
+ *   connector: {"type": "framing", "framing": {"mode": "binary"}}
+ *              (accept, text. all following connector messages are binary)
+ *   agent:     "framing: active"   (text. all following agent messages are binary)
+ *
+ * A binary frame is a 32-bit big endian length, followed by that many bytes
+ * made up of a one byte AgentMsgType and the message content.
+ *
+ * The agent can list what it supports beyond the basic messages with
+ * "capabilities: <name>[,<name>...]". Agents with the "logs" capability accept
+ * batches of log messages:
+ *
+ *   {"type": "logs", "logs": [{"level": "info", "ts": 1546300800000,
+ *       "message": "..."}, ...]}
+ *
+ * The agent can request the connector's metrics with "stats", which are sent
+ * back as follows (see Metrics::write_json()):
+ *
+ *   {"type": "stats", "stats": {"enebular_connector_...": 123, ...}}
+ *
+ * Connecting never blocks. Failed connection attempts are retried from a timer
+ * with backoff, and if the agent doesn't confirm the connection with "ok" in
+ * time, or the connection is lost (the agent restarts etc), the interface
+ * reconnects the same way until disconnect() is called.
  */
 class EnebularAgentInterface {
 
@@ -35,28 +99,57 @@ public:
     ~EnebularAgentInterface();
 
     /**
-     * Connect to the agent.
+     * Start connecting to the agent.
+     *
+     * The connection is made (and remade whenever it is lost) in the background
+     * from the connector's main loop, and is reported via the agent connection
+     * change callbacks.
      */
     bool connect();
 
     /**
-     * Disconnect from the agent.
+     * Disconnect from the agent, and stop reconnecting.
      */
     void disconnect();
 
     /**
-     * Run the agent interface's main work.
+     * Start holding back messages so they can be sent together.
+     *
+     * Messages sent while corked are queued, and then written with as few
+     * system calls as possible by uncork(). This is designed to be used around
+     * each pass of the connector's main loop.
+     */
+    void cork();
+
+    /**
+     * Stop holding back messages and send all queued messages.
+     */
+    void uncork();
+
+    /**
+     * Send all queued messages now (even if corked).
      *
-     * This is designed to be run from the connector's main loop and it will not
-     * block.
+     * This is used for messages that should not be delayed.
      */
-    void run();
+    void flush();
 
     /**
      * Checks if the agent is connected or not.
      */
     bool is_connected();
 
+    /**
+     * Set the limits of the outbound message queue.
+     *
+     * Messages that can't be written to the agent immediately are queued. Once
+     * either limit is reached, further messages are dropped until the queue
+     * has drained.
+     *
+     * @param max_bytes  Maximum number of queued bytes
+     * @param max_frames Maximum number of queued messages
+     */
+    void set_send_queue_limits(size_t max_bytes, size_t max_frames);
+
     /**
      * Adds an agent connection state change callback.
      *
@@ -105,32 +198,49 @@ public:
     /**
      * Send an agent-manager message to the agent.
      *
+     * The content is sent directly from the buffer (it is not copied), with a
+     * reference held while it is queued for sending.
+     *
      * @param type      Message type
      * @param content   Message content
      */
-    void send_message(const char *type, const char *content);
+    void send_message(const char *type, SharedBuffer *content);
 
     /**
      * Send an agent-manager ctrl message to the agent.
      *
+     * The message is sent directly from the buffer (it is not copied), with a
+     * reference held while it is queued for sending.
+     *
      * @param message   Message
      */
-    void send_ctrl_message(const char *message);
+    void send_ctrl_message(SharedBuffer *message);
 
     /**
      * Send a log message to the agent.
      *
-     * Note that the message is sent to the agent packaged in JSON, but the
-     * interface currently does not support properly stringifying the message
-     * content. Therefore the message cannot contain any character that will
-     * interfere with JSON formatting.
-     *
      * @param level   Log level
      * @param prefix  Log message prefix
      * @param message Log message
      */
     void send_log_message(const char *level, const char *prefix, const char *message);
 
+    /**
+     * Send a batch of log messages to the agent as one message.
+     *
+     * This must only be used if supports_log_batches() is true.
+     *
+     * @param prefix  Log message prefix
+     * @param entries Log messages
+     * @param cnt     Number of log messages
+     */
+    void send_log_messages(const char *prefix, const struct agent_log_entry *entries, size_t cnt);
+
+    /**
+     * Checks if the agent accepts batches of log messages.
+     */
+    bool supports_log_batches();
+
     /**
      * Notify the agent of the connector's connection state.
      *
@@ -150,12 +260,18 @@ private:
 
     EnebularAgentMbedCloudConnector * _connector;
     Logger *_logger;
+    MessageTracer *_tracer;
     int _agent_fd;
     char _client_path[PATH_MAX];
-    char *_send_buf;
-    char *_recv_buf;
-    int _recv_cnt;
-    bool _waiting_for_connect_ok;
+    JsonWriter _json;
+    AgentFrameParser _recv_parser;
+    /* time of the read that received the frames being handled */
+    uint64_t _recv_ts;
+    AgentSendQueue _send_queue;
+    bool _send_wait_writable;
+    bool _corked;
+    bool _send_binary;
+    bool _agent_supports_log_batches;
     bool _is_connected;
     const char *_server_socket;
     vector<AgentConnectionChangeCB> _agent_conn_change_cbs;
@@ -164,18 +280,73 @@ private:
     AgentInfoCB _agent_info_cb;
     CtrlMessageCB _ctrl_message_cb;
 
+    MetricCounter *_received_frames;
+    MetricCounter *_received_bytes;
+    MetricCounter *_sent_frames;
+    MetricCounter *_sent_bytes;
+
+    enum connect_state {
+        /* not connected, and not trying to connect */
+        STATE_IDLE,
+        /* waiting to retry connecting */
+        STATE_RETRY_WAIT,
+        /* connected, waiting for the agent's "ok" */
+        STATE_WAITING_OK,
+        STATE_CONNECTED
+    };
+
+    connect_state _state;
+    uint32_t _retry_timer;
+    uint32_t _retry_wait_ms;
+    uint32_t _connect_ok_timer;
+    uint32_t _connect_fail_cnt;
+
+    struct recv_msg_handler {
+        AgentMsgType type;
+        const char *prefix;
+        bool has_content;
+        void (EnebularAgentInterface::*handle)(const char *content);
+    };
+    static const struct recv_msg_handler _recv_msg_handlers[];
+
     bool connect_agent();
     void disconnect_agent();
+    void try_connect();
+    void schedule_connect();
+    void connection_lost();
+    void retry_timer_cb();
+    void connect_ok_timeout_cb();
     bool connected_check();
     void recv();
-    void handle_recv_msg(const char *msg);
-    void send_msg(const char *msg);
+    void agent_fd_cb(uint32_t events);
+    void handle_recv_msg(char *msg, size_t len);
+    void handle_ok_msg(const char *msg);
+    void handle_agent_info_msg(const char *msg);
+    void handle_ctrl_message_msg(const char *msg);
+    void handle_register_msg(const char *msg);
+    void handle_connect_msg(const char *msg);
+    void handle_disconnect_msg(const char *msg);
+    void handle_framing_msg(const char *msg);
+    void handle_stats_msg(const char *msg);
+    void handle_capabilities_msg(const char *msg);
+    void send_msg(const char *msg, size_t len);
+    void send_json();
+    /* iovcnt must be at most AGENT_SEND_MAX_SEGMENTS - 1 (room for the header or marker) */
+    void send_frame(const struct iovec *iov, SharedBuffer *const *refs, int iovcnt);
+    void flush_send_queue();
+    void drain_send_queue(int timeout_ms);
+    void update_send_wait_writable();
     void notify_conntection_state();
     void notify_registration_request();
     void notify_connection_request(bool connect);
     void notify_agent_info(const char *info);
     void notify_ctrl_message(const char *info);
     void update_connected_state(bool connected);
+    void add_metrics(Metrics *metrics);
+    uint64_t get_received_dropped_cnt();
+    uint64_t get_send_dropped_cnt();
+    uint64_t get_send_queue_bytes();
+    uint64_t get_send_queue_frames();
 
 };
 
@@ -1,11 +1,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <pthread.h>
 #include "enebular_agent_mbed_cloud_connector.h"
 #include "enebular_agent_mbed_cloud_client.h"
 #include "enebular_agent_fcc_dev_flow.h"
+#include "connector_probes.h"
 
 #define OBJECT_ID_REGISTER              (26243)
 #define OBJECT_ID_AUTH_TOKEN            (26244)
@@ -28,7 +28,135 @@
 #define RESOURCE_ID_FROM_DEVICE             (26242)
 #define RESOURCE_ID_DEVICE_COMMAND_SEND     (26241)
 
-#define MAX_RESOURCE_SET_UPDATE_GAP (10)
+/* maximum time between the updates of a resource group's members */
+#define RESOURCE_GROUP_MAX_GAP_MS   (10 * 1000)
+
+enum {
+    REGISTER_CONNECTION_ID,
+    REGISTER_DEVICE_ID,
+    REGISTER_AUTH_REQUEST_URL,
+    REGISTER_AGENT_MANAGER_BASE_URL,
+    REGISTER_MEMBER_CNT
+};
+
+static const char *const register_keys[REGISTER_MEMBER_CNT] = {
+    "connectionId",
+    "deviceId",
+    "authRequestUrl",
+    "agentManagerBaseUrl",
+};
+
+enum {
+    UPDATE_AUTH_ACCESS_TOKEN,
+    UPDATE_AUTH_ID_TOKEN,
+    UPDATE_AUTH_STATE,
+    UPDATE_AUTH_MEMBER_CNT
+};
+
+static const char *const update_auth_keys[UPDATE_AUTH_MEMBER_CNT] = {
+    "accessToken",
+    "idToken",
+    "state",
+};
+
+/* what is done with a resource's value when it is updated (PUT) */
+enum res_action {
+    /* nothing (other than logging it) */
+    RES_ACTION_NONE,
+    /* send it to the agent as an agent-manager message */
+    RES_ACTION_AGENT_MSG,
+    /* set it as a resource group member */
+    RES_ACTION_GROUP_MEMBER,
+    /* reply with the agent info instead */
+    RES_ACTION_AGENT_INFO,
+};
+
+struct EnebularAgentMbedCloudClient::resource_def {
+    uint16_t object_id;
+    uint16_t resource_id;
+    const char *type;
+    bool observable;
+    uint32_t max_age;
+    res_action action;
+    /* message type (RES_ACTION_AGENT_MSG) */
+    const char *msg_type;
+    /* group and member index (RES_ACTION_GROUP_MEMBER) */
+    int group;
+    int member;
+};
+
+/*
+ * The resources, indexed by resource_index. All are GET/PUT string resources
+ * on instance 0 of their object.
+ */
+const struct EnebularAgentMbedCloudClient::resource_def EnebularAgentMbedCloudClient::_resource_defs[RES_CNT] = {
+    { OBJECT_ID_REGISTER,       RESOURCE_ID_CONNECTION_ID,          "connection_id",            false,  0,
+        RES_ACTION_GROUP_MEMBER,    NULL,                   GROUP_REGISTER,     REGISTER_CONNECTION_ID },
+    { OBJECT_ID_REGISTER,       RESOURCE_ID_DEVICE_ID,              "device_id",                false,  0,
+        RES_ACTION_GROUP_MEMBER,    NULL,                   GROUP_REGISTER,     REGISTER_DEVICE_ID },
+    { OBJECT_ID_REGISTER,       RESOURCE_ID_AUTH_REQUEST_URL,       "auth_request_url",         false,  0,
+        RES_ACTION_GROUP_MEMBER,    NULL,                   GROUP_REGISTER,     REGISTER_AUTH_REQUEST_URL },
+    { OBJECT_ID_REGISTER,       RESOURCE_ID_AGENT_MANAGER_BASE_URL, "agent_manager_base_url",   false,  0,
+        RES_ACTION_GROUP_MEMBER,    NULL,                   GROUP_REGISTER,     REGISTER_AGENT_MANAGER_BASE_URL },
+    { OBJECT_ID_AUTH_TOKEN,     RESOURCE_ID_ACCEESS_TOKEN,          "access_token",             false,  0,
+        RES_ACTION_GROUP_MEMBER,    NULL,                   GROUP_UPDATE_AUTH,  UPDATE_AUTH_ACCESS_TOKEN },
+    { OBJECT_ID_AUTH_TOKEN,     RESOURCE_ID_ID_TOKEN,               "id_token",                 false,  0,
+        RES_ACTION_GROUP_MEMBER,    NULL,                   GROUP_UPDATE_AUTH,  UPDATE_AUTH_ID_TOKEN },
+    { OBJECT_ID_AUTH_TOKEN,     RESOURCE_ID_STATE,                  "state",                    false,  0,
+        RES_ACTION_GROUP_MEMBER,    NULL,                   GROUP_UPDATE_AUTH,  UPDATE_AUTH_STATE },
+    { OBJECT_ID_AGENT_INFO,     RESOURCE_ID_AGENT_INFO,             "agent_info",               true,   30,
+        RES_ACTION_AGENT_INFO,      NULL,                   0,                  0 },
+    { OBJECT_ID_DEVICE_STATE,   RESOURCE_ID_DEVICE_STATE_CHANGE,    "device_state_change",      false,  0,
+        RES_ACTION_AGENT_MSG,       "deviceStateChange",    0,                  0 },
+    { OBJECT_ID_ENEBULAR_MSG,   RESOURCE_ID_TO_DEVICE,              "to_device",                false,  0,
+        RES_ACTION_AGENT_MSG,       "ctrlMessage",          0,                  0 },
+    { OBJECT_ID_ENEBULAR_MSG,   RESOURCE_ID_FROM_DEVICE,            "from_device",              true,   0,
+        RES_ACTION_NONE,            NULL,                   0,                  0 },
+    { OBJECT_ID_DEVICE_COMMAND, RESOURCE_ID_DEVICE_COMMAND_SEND,    "device_command_send",      false,  0,
+        RES_ACTION_AGENT_MSG,       "deviceCommandSend",    0,                  0 },
+};
+
+#define CLIENT_ERROR(code)  { MbedCloudClient::code, #code }
+
+/* the client errors that are told apart (in the log and metrics) */
+static const struct {
+    int code;
+    const char *name;
+} client_errors[] = {
+    CLIENT_ERROR(ConnectErrorNone),
+    CLIENT_ERROR(ConnectAlreadyExists),
+    CLIENT_ERROR(ConnectBootstrapFailed),
+    CLIENT_ERROR(ConnectInvalidParameters),
+    CLIENT_ERROR(ConnectNotRegistered),
+    CLIENT_ERROR(ConnectTimeout),
+    CLIENT_ERROR(ConnectNetworkError),
+    CLIENT_ERROR(ConnectResponseParseFailed),
+    CLIENT_ERROR(ConnectUnknownError),
+    CLIENT_ERROR(ConnectMemoryConnectFail),
+    CLIENT_ERROR(ConnectNotAllowed),
+    CLIENT_ERROR(ConnectSecureConnectionFailed),
+    CLIENT_ERROR(ConnectDnsResolvingFailed),
+#ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
+    CLIENT_ERROR(UpdateWarningCertificateNotFound),
+    CLIENT_ERROR(UpdateWarningIdentityNotFound),
+    CLIENT_ERROR(UpdateWarningCertificateInvalid),
+    CLIENT_ERROR(UpdateWarningSignatureInvalid),
+    CLIENT_ERROR(UpdateWarningVendorMismatch),
+    CLIENT_ERROR(UpdateWarningClassMismatch),
+    CLIENT_ERROR(UpdateWarningDeviceMismatch),
+    CLIENT_ERROR(UpdateWarningURINotFound),
+    CLIENT_ERROR(UpdateWarningRollbackProtection),
+    CLIENT_ERROR(UpdateWarningUnknown),
+    CLIENT_ERROR(UpdateErrorWriteToStorage),
+    CLIENT_ERROR(UpdateErrorInvalidHash),
+#endif
+};
+
+#define CLIENT_ERROR_CNT    ((int)(sizeof(client_errors) / sizeof(client_errors[0])))
+
+/* resource value as a printf "%.*s" argument pair, without copying it */
+#define RES_VALUE_ARGS(res) \
+    (int)(res)->value_length(), ((res)->value() ? (const char *)(res)->value() : "")
 
 #ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
 
@@ -78,12 +206,30 @@ EnebularAgentMbedCloudClient::EnebularAgentMbedCloudClient(EnebularAgentMbedClou
     _connector(connector),
     _clientCallback(new EnebularAgentMbedCloudClientCallback()),
     _logger(Logger::get_instance()),
+    _tracer(connector->get_tracer()),
     _connecting(false),
     _registered(false),
     _registered_state_updated(false),
+    _agent_info(NULL),
     _mbed_cloud_dev_credentials_path(mbed_cloud_dev_credentials_path)
 {
     pthread_mutex_init(&_lock, NULL);
+
+    for (int i = 0; i < RES_CNT; i++) {
+        _resources[i].client = this;
+        _resources[i].def = &_resource_defs[i];
+        _resources[i].res = NULL;
+    }
+    _groups[GROUP_REGISTER] = new ResourceGroup(connector, "register",
+        register_keys, REGISTER_MEMBER_CNT, RESOURCE_GROUP_MAX_GAP_MS);
+    _groups[GROUP_UPDATE_AUTH] = new ResourceGroup(connector, "updateAuth",
+        update_auth_keys, UPDATE_AUTH_MEMBER_CNT, RESOURCE_GROUP_MAX_GAP_MS);
+    for (int i = 0; i < GROUP_CNT; i++) {
+        _groups[i]->on_complete(
+            ResourceGroupCompleteCB(this, &EnebularAgentMbedCloudClient::resource_group_complete_cb));
+    }
+
+    add_metrics(connector->get_metrics());
 }
 
 EnebularAgentMbedCloudClient::~EnebularAgentMbedCloudClient()
@@ -91,269 +237,146 @@ EnebularAgentMbedCloudClient::~EnebularAgentMbedCloudClient()
     if (_agent_info) {
         free(_agent_info);
     }
+    agent_msg_t msg;
+    while (_agent_man_msgs.pop(msg)) {
+        msg.content->unref();
+    }
+    for (int i = 0; i < GROUP_CNT; i++) {
+        delete _groups[i];
+    }
     delete _clientCallback;
     pthread_mutex_destroy(&_lock);
 }
 
-void EnebularAgentMbedCloudClient::setup_objects()
+void EnebularAgentMbedCloudClient::add_metrics(Metrics *metrics)
 {
-    _register_connection_id_res = add_rw_resource(
-        OBJECT_ID_REGISTER, 0, RESOURCE_ID_CONNECTION_ID, "connection_id",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::register_connection_id_cb), 0);
-    _register_device_id_res = add_rw_resource(
-        OBJECT_ID_REGISTER, 0, RESOURCE_ID_DEVICE_ID, "device_id",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::register_device_id_cb), 0);
-    _register_auth_request_url_res = add_rw_resource(
-        OBJECT_ID_REGISTER, 0, RESOURCE_ID_AUTH_REQUEST_URL, "auth_request_url",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::register_auth_request_url_cb), 0);
-    _register_agent_manager_base_url_res = add_rw_resource(
-        OBJECT_ID_REGISTER, 0, RESOURCE_ID_AGENT_MANAGER_BASE_URL, "agent_manager_base_url",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::register_agent_manager_base_url_cb), 0);
-
-    _update_auth_access_token_res = add_rw_resource(
-        OBJECT_ID_AUTH_TOKEN, 0, RESOURCE_ID_ACCEESS_TOKEN, "access_token",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::update_auth_access_token_cb), 0);
-    _update_auth_id_token_res = add_rw_resource(
-        OBJECT_ID_AUTH_TOKEN, 0, RESOURCE_ID_ID_TOKEN, "id_token",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::update_auth_id_token_cb), 0);
-    _update_auth_state_res = add_rw_resource(
-        OBJECT_ID_AUTH_TOKEN, 0, RESOURCE_ID_STATE, "state",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::update_auth_state_cb), 0);
-
-    _agent_info_res = add_rw_resource(
-        OBJECT_ID_AGENT_INFO, 0, RESOURCE_ID_AGENT_INFO, "agent_info",
-        M2MResourceInstance::STRING, NULL, true,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::agent_info_cb), 30);
-
-    _device_state_change_res = add_rw_resource(
-        OBJECT_ID_DEVICE_STATE, 0, RESOURCE_ID_DEVICE_STATE_CHANGE, "device_state_change",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::device_state_change_cb), 0);
-
-    _enebular_msg_to_device_res = add_rw_resource(
-        OBJECT_ID_ENEBULAR_MSG, 0, RESOURCE_ID_TO_DEVICE, "to_device",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::enebular_msg_to_device_cb), 0);
-
-    _enebular_msg_from_device_res = add_rw_resource(
-        OBJECT_ID_ENEBULAR_MSG, 0, RESOURCE_ID_FROM_DEVICE, "from_device",
-        M2MResourceInstance::STRING, NULL, true,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::enebular_msg_from_device_cb), 0);
-
-    _device_command_send_res = add_rw_resource(
-        OBJECT_ID_DEVICE_COMMAND, 0, RESOURCE_ID_DEVICE_COMMAND_SEND, "device_command_send",
-        M2MResourceInstance::STRING, NULL, false,
-        value_updated_callback(this, &EnebularAgentMbedCloudClient::device_command_send_cb), 0);
-}
-
-
-void EnebularAgentMbedCloudClient::process_register_update()
-{
-    char msg[1024*4];
-    unsigned long long now;
-
-    now = time(NULL);
-
-    if (now - _register_connection_id_time > MAX_RESOURCE_SET_UPDATE_GAP ||
-            now - _register_device_id_time > MAX_RESOURCE_SET_UPDATE_GAP ||
-            now - _register_auth_request_url_time > MAX_RESOURCE_SET_UPDATE_GAP ||
-            now - _register_agent_manager_base_url_time > MAX_RESOURCE_SET_UPDATE_GAP) {
-        return;
+    for (int i = 0; i < RES_CNT; i++) {
+        _resources[i].update_cnt = metrics->add_counter(METRICS_PREFIX "cloud_callbacks_total",
+            "Resource value updates from Mbed Cloud", "resource", _resource_defs[i].type);
     }
 
-    snprintf(msg, sizeof(msg)-1,
-        "{"
-            "\"connectionId\": \"%s\","
-            "\"deviceId\": \"%s\","
-            "\"authRequestUrl\": \"%s\","
-            "\"agentManagerBaseUrl\": \"%s\""
-        "}",
-        _register_connection_id_res->get_value_string().c_str(),
-        _register_device_id_res->get_value_string().c_str(),
-        _register_auth_request_url_res->get_value_string().c_str(),
-        _register_agent_manager_base_url_res->get_value_string().c_str()
-    );
-    msg[sizeof(msg)-1] = '\0';
-
-    queue_agent_man_msg("register", msg);
-
-    _register_connection_id_time = 0;
-    _register_device_id_time = 0;
-    _register_auth_request_url_time = 0;
-    _register_agent_manager_base_url_time = 0;
-}
-
-void EnebularAgentMbedCloudClient::process_update_auth_update()
-{
-    char msg[1024*4];
-    unsigned long long now;
-
-    now = time(NULL);
-
-    if (now - _update_auth_access_token_time > MAX_RESOURCE_SET_UPDATE_GAP ||
-            now - _update_auth_id_token_time > MAX_RESOURCE_SET_UPDATE_GAP ||
-            now - _update_auth_state_time > MAX_RESOURCE_SET_UPDATE_GAP) {
-        return;
+    metrics->add_gauge(METRICS_PREFIX "client_message_queue_depth",
+        "Messages from Mbed Cloud waiting to be handled by the main loop",
+        MetricValueCB(this, &EnebularAgentMbedCloudClient::get_agent_man_msg_cnt));
+    metrics->add_counter(METRICS_PREFIX "client_message_queue_dropped_total",
+        "Messages from Mbed Cloud dropped due to the queue being full",
+        MetricValueCB(this, &EnebularAgentMbedCloudClient::get_agent_man_msg_dropped_cnt));
+
+    _metric_connects = metrics->add_counter(METRICS_PREFIX "client_connect_attempts_total",
+        "Mbed Cloud connection (registration) attempts");
+    _metric_registrations = metrics->add_counter(METRICS_PREFIX "client_registrations_total",
+        "Successful Mbed Cloud registrations");
+    _metric_registration_updates = metrics->add_counter(METRICS_PREFIX "client_registration_updates_total",
+        "Mbed Cloud registration updates");
+    _metric_unregistrations = metrics->add_counter(METRICS_PREFIX "client_unregistrations_total",
+        "Mbed Cloud unregistrations");
+
+    for (int i = 0; i < CLIENT_ERROR_CNT; i++) {
+        _metric_errors.push_back(metrics->add_counter(METRICS_PREFIX "client_errors_total",
+            "Mbed Cloud client errors", "error", client_errors[i].name));
     }
+    _metric_errors.push_back(metrics->add_counter(METRICS_PREFIX "client_errors_total",
+        "Mbed Cloud client errors", "error", "UNKNOWN"));
 
-    snprintf(msg, sizeof(msg)-1,
-        "{"
-            "\"accessToken\": \"%s\","
-            "\"idToken\": \"%s\","
-            "\"state\": \"%s\""
-        "}",
-        _update_auth_access_token_res->get_value_string().c_str(),
-        _update_auth_id_token_res->get_value_string().c_str(),
-        _update_auth_state_res->get_value_string().c_str()
-    );
-    msg[sizeof(msg)-1] = '\0';
-
-    queue_agent_man_msg("updateAuth", msg);
-
-    _update_auth_access_token_time = 0;
-    _update_auth_id_token_time = 0;
-    _update_auth_state_time = 0;
+    for (int i = 0; i < GROUP_CNT; i++) {
+        metrics->add_counter(METRICS_PREFIX "resource_group_completed_total",
+            "Resource groups completed and sent to the agent",
+            MetricValueCB(_groups[i], &ResourceGroup::get_completed_cnt), "group", _groups[i]->get_name());
+    }
+    for (int i = 0; i < GROUP_CNT; i++) {
+        metrics->add_counter(METRICS_PREFIX "resource_group_expired_total",
+            "Partially set resource groups discarded after timing out",
+            MetricValueCB(_groups[i], &ResourceGroup::get_expired_cnt), "group", _groups[i]->get_name());
+    }
 }
 
-void EnebularAgentMbedCloudClient::process_device_state_change()
+uint64_t EnebularAgentMbedCloudClient::get_agent_man_msg_cnt()
 {
-    queue_agent_man_msg("deviceStateChange",
-        _device_state_change_res->get_value_string().c_str());
+    return _agent_man_msgs.get_cnt();
 }
 
-void EnebularAgentMbedCloudClient::process_device_command_send()
+uint64_t EnebularAgentMbedCloudClient::get_agent_man_msg_dropped_cnt()
 {
-    queue_agent_man_msg("deviceCommandSend",
-        _device_command_send_res->get_value_string().c_str());
+    return _agent_man_msgs.get_overflow_cnt();
 }
 
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::register_connection_id_cb(const char *name)
+void EnebularAgentMbedCloudClient::setup_objects()
 {
-    _logger->log_console(DEBUG, "Client: register_connection_id: %s",
-        _register_connection_id_res->get_value_string().c_str());
-
-    _register_connection_id_time = time(NULL);
-    process_register_update();
+    for (int i = 0; i < RES_CNT; i++) {
+        const struct resource_def *def = &_resource_defs[i];
+        _resources[i].res = add_resource(
+            def->object_id, 0, def->resource_id, def->type,
+            M2MResourceInstance::STRING, M2MBase::GET_PUT_ALLOWED, NULL, def->observable,
+            value_updated_callback(&_resources[i], &resource_binding::value_updated), NULL,
+            def->max_age);
+    }
 }
 
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::register_device_id_cb(const char *name)
+/* called from the main loop */
+void EnebularAgentMbedCloudClient::resource_group_complete_cb(ResourceGroup *group)
 {
-    _logger->log_console(DEBUG, "Client: register_device_id: %s",
-        _register_device_id_res->get_value_string().c_str());
-
-    _register_device_id_time = time(NULL);
-    process_register_update();
-}
+    _msg_json.reset();
+    group->write_json(_msg_json);
 
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::register_auth_request_url_cb(const char *name)
-{
-    _logger->log_console(DEBUG, "Client: register_auth_request_url: %s",
-        _register_auth_request_url_res->get_value_string().c_str());
+    if (_msg_json.failed()) {
+        _logger->log_console(ERROR, "Client: oom");
+        return;
+    }
 
-    _register_auth_request_url_time = time(NULL);
-    process_register_update();
-}
+    SharedBuffer *buf = SharedBuffer::create(_msg_json.data(), _msg_json.len());
+    if (!buf) {
+        _logger->log_console(ERROR, "Client: oom");
+        return;
+    }
 
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::register_agent_manager_base_url_cb(const char *name)
-{
-    _logger->log_console(DEBUG, "Client: register_agent_manager_base_url: %s",
-        _register_agent_manager_base_url_res->get_value_string().c_str());
+    notify_agent_man_msg(group->get_name(), buf);
 
-    _register_agent_manager_base_url_time = time(NULL);
-    process_register_update();
+    buf->unref();
 }
 
 /* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::update_auth_access_token_cb(const char *name)
+void EnebularAgentMbedCloudClient::resource_binding::value_updated(const char *name)
 {
-    _logger->log_console(DEBUG, "Client: update_auth_access_token: %s",
-        _update_auth_access_token_res->get_value_string().c_str());
-
-    _update_auth_access_token_time = time(NULL);
-    process_update_auth_update();
+    client->resource_updated(this);
 }
 
 /* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::update_auth_id_token_cb(const char *name)
+void EnebularAgentMbedCloudClient::resource_updated(struct resource_binding *binding)
 {
-    _logger->log_console(DEBUG, "Client: update_auth_id_token: %s",
-        _update_auth_id_token_res->get_value_string().c_str());
+    uint64_t callback_ts = MessageTracer::now();
+    const struct resource_def *def = binding->def;
+    M2MResource *res = binding->res;
 
-    _update_auth_id_token_time = time(NULL);
-    process_update_auth_update();
-}
+    CONNECTOR_PROBE2(cloud_resource_callback, def->type, res->value_length());
+    binding->update_cnt->inc();
 
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::update_auth_state_cb(const char *name)
-{
-    _logger->log_console(DEBUG, "Client: update_auth_state: %s",
-        _update_auth_state_res->get_value_string().c_str());
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Client: %s: %.*s", def->type, RES_VALUE_ARGS(res));
 
-    _update_auth_state_time = time(NULL);
-    process_update_auth_update();
+    switch (def->action) {
+        case RES_ACTION_AGENT_MSG:
+            queue_agent_man_msg(def->msg_type, res, callback_ts);
+            break;
+        case RES_ACTION_GROUP_MEMBER:
+            queue_group_member(_groups[def->group], def->member, res);
+            break;
+        case RES_ACTION_AGENT_INFO:
+            reply_agent_info(res);
+            break;
+        case RES_ACTION_NONE:
+            break;
+    }
 }
 
 /* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::agent_info_cb(const char *name)
+void EnebularAgentMbedCloudClient::reply_agent_info(M2MResource *res)
 {
-    _logger->log_console(DEBUG, "Client: update_agent_info: %s",
-        _agent_info_res->get_value_string().c_str());
-
     const char *val;
 
     pthread_mutex_lock(&_lock);
     val = (_agent_info) ? _agent_info : "-";
     pthread_mutex_unlock(&_lock);
 
-    _agent_info_res->set_value((uint8_t *)val, strlen(val));
-}
-
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::device_state_change_cb(const char *name)
-{
-    _logger->log_console(DEBUG, "Client: device_state_change: %s",
-        _device_state_change_res->get_value_string().c_str());
-
-    process_device_state_change();
-}
-
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::enebular_msg_to_device_cb(const char *name)
-{
-    _logger->log_console(DEBUG, "Client: enebular_msg_to_device: %s",
-        _enebular_msg_to_device_res->get_value_string().c_str());
-
-    queue_agent_man_msg("ctrlMessage",
-        _enebular_msg_to_device_res->get_value_string().c_str());
-}
-
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::enebular_msg_from_device_cb(const char *name)
-{
-    _logger->log_console(DEBUG, "Client: enebular_msg_from_device: %s",
-        _enebular_msg_from_device_res->get_value_string().c_str());
-
-    //
-}
-
-/* Note: called from separate thread */
-void EnebularAgentMbedCloudClient::device_command_send_cb(const char *name)
-{
-    _logger->log_console(DEBUG, "Client: device_command_send: %s",
-        _device_command_send_res->get_value_string().c_str());
-
-    process_device_command_send();
+    res->set_value((uint8_t *)val, strlen(val));
 }
 
 bool EnebularAgentMbedCloudClient::init_fcc()
@@ -390,6 +413,11 @@ bool EnebularAgentMbedCloudClient::init_fcc()
 
 bool EnebularAgentMbedCloudClient::setup()
 {
+    if (!_agent_man_msgs.init(AGENT_MAN_MSG_RING_SIZE)) {
+        _logger->log_console(ERROR, "Client: oom");
+        return false;
+    }
+
     if (!init_fcc()) {
         return false;
     }
@@ -435,6 +463,8 @@ bool EnebularAgentMbedCloudClient::connect(void *iface)
     }
 
     _connecting = true;
+    _metric_connects->inc();
+    CONNECTOR_PROBE(client_connect);
 
     return _cloud_client.setup(iface);
 }
@@ -470,7 +500,9 @@ void EnebularAgentMbedCloudClient::set_agent_info(const char *info)
 
 void EnebularAgentMbedCloudClient::set_from_device_ctrl_message(const char *message)
 {
-    _enebular_msg_from_device_res->set_value((uint8_t *)message, strlen(message));
+    _tracer->mark(MSG_TRACE_DELIVERED);
+    _resources[RES_ENEBULAR_MSG_FROM_DEVICE].res->set_value((uint8_t *)message, strlen(message));
+    _tracer->mark(MSG_TRACE_SET);
 }
 
 void EnebularAgentMbedCloudClient::on_connection_change(ClientConnectionStateCB cb)
@@ -511,34 +543,114 @@ void EnebularAgentMbedCloudClient::notify_conntection_state()
     }
 }
 
+void EnebularAgentMbedCloudClient::notify_agent_man_msg(const char *type, SharedBuffer *content)
+{
+    vector<AgentManagerMessageCB>::iterator it;
+    for (it = _agent_man_msg_callbacks.begin(); it != _agent_man_msg_callbacks.end(); it++) {
+        it->call(type, content);
+    }
+}
+
 void EnebularAgentMbedCloudClient::notify_agent_man_msgs()
 {
-    while (!_agent_man_msgs.empty()) {
+    uint64_t woken_ts = MessageTracer::now();
+    agent_msg_t msg;
+
+    while (_agent_man_msgs.pop(msg)) {
+
+        CONNECTOR_PROBE2(message_dequeue,
+            msg.group ? msg.group->get_name() : msg.type, msg.content->len());
+
+        if (msg.group) {
+            /* the group takes over the reference */
+            msg.group->set(msg.member, msg.content);
+            continue;
+        }
+
+        /* a message queued during the drain didn't wait for the loop to wake up */
+        msg.trace.ts[MSG_TRACE_WOKEN] = max(woken_ts, msg.trace.ts[MSG_TRACE_QUEUED]);
+        msg.trace.ts[MSG_TRACE_DEQUEUED] = MessageTracer::now();
+
+        _tracer->begin(&msg.trace);
+        notify_agent_man_msg(msg.type, msg.content);
+        _tracer->end();
+
+        msg.content->unref();
+
+    }
+}
+
+void EnebularAgentMbedCloudClient::queue_agent_man_msg(agent_msg_t &msg)
+{
+    const char *name = msg.group ? msg.group->get_name() : msg.type;
+    bool was_empty;
+
+    msg.trace.ts[MSG_TRACE_QUEUED] = MessageTracer::now();
 
-        pthread_mutex_lock(&_lock);
-        agent_msg_t msg = _agent_man_msgs.front();
-        _agent_man_msgs.pop();
-        pthread_mutex_unlock(&_lock);
+    /* once pushed, the message belongs to the main loop */
+    CONNECTOR_PROBE2(message_enqueue, name, msg.content->len());
 
-        vector<AgentManagerMessageCB>::iterator it;
-        for (it = _agent_man_msg_callbacks.begin(); it != _agent_man_msg_callbacks.end(); it++) {
-            it->call(msg.type.c_str(), msg.content.c_str());
+    if (!_agent_man_msgs.push(msg, &was_empty)) {
+        CONNECTOR_PROBE2(message_dropped, name, msg.content->len());
+        uint32_t cnt = _agent_man_msgs.get_overflow_cnt();
+        if (cnt == 1 || !(cnt % 100)) {
+            _logger->log_console(ERROR, "Client: message queue full, dropped %s message (%u dropped in total)",
+                name, cnt);
         }
+        msg.content->unref();
+        return;
+    }
 
+    /* the main loop drains the whole queue, so only kick it if it was idle */
+    if (was_empty) {
+        _connector->kick();
     }
 }
 
-void EnebularAgentMbedCloudClient::queue_agent_man_msg(const char *type, const char *content)
+void EnebularAgentMbedCloudClient::queue_agent_man_msg(const char *type, SharedBuffer *content,
+        uint64_t callback_ts)
 {
     agent_msg_t msg;
+
     msg.type = type;
     msg.content = content;
+    msg.group = NULL;
+    msg.member = 0;
 
-    pthread_mutex_lock(&_lock);
-    _agent_man_msgs.push(msg);
-    pthread_mutex_unlock(&_lock);
+    MessageTracer::init(&msg.trace, MSG_TRACE_TO_AGENT, type, content->len());
+    msg.trace.ts[MSG_TRACE_CALLBACK] = callback_ts;
 
-    _connector->kick();
+    queue_agent_man_msg(msg);
+}
+
+/* captures the resource's value with a single copy */
+void EnebularAgentMbedCloudClient::queue_agent_man_msg(const char *type, M2MResource *res,
+        uint64_t callback_ts)
+{
+    SharedBuffer *buf = SharedBuffer::create(res->value(), res->value_length());
+    if (!buf) {
+        _logger->log_console(ERROR, "Client: oom");
+        return;
+    }
+
+    queue_agent_man_msg(type, buf, callback_ts);
+}
+
+/* captures the resource's value for the group (on the main loop) */
+void EnebularAgentMbedCloudClient::queue_group_member(ResourceGroup *group, int member, M2MResource *res)
+{
+    agent_msg_t msg;
+
+    msg.content = SharedBuffer::create(res->value(), res->value_length());
+    if (!msg.content) {
+        _logger->log_console(ERROR, "Client: oom");
+        return;
+    }
+    msg.type = NULL;
+    msg.group = group;
+    msg.member = member;
+
+    queue_agent_man_msg(msg);
 }
 
 void EnebularAgentMbedCloudClient::update_registered_state(bool registered)
@@ -547,6 +659,7 @@ void EnebularAgentMbedCloudClient::update_registered_state(bool registered)
 
     _registered = registered;
     _registered_state_updated = true;
+    CONNECTOR_PROBE1(client_registration_state, (int)registered);
 
     _connector->kick();
 }
@@ -554,107 +667,40 @@ void EnebularAgentMbedCloudClient::update_registered_state(bool registered)
 /* Note: called from separate thread */
 void EnebularAgentMbedCloudClient::client_registered()
 {
+    _metric_registrations->inc();
     update_registered_state(true);
 }
 
 /* Note: called from separate thread */
 void EnebularAgentMbedCloudClient::client_registration_updated()
 {
-    _logger->log_console(DEBUG, "Client: Client registration updated");
+    _metric_registration_updates->inc();
+    CONNECTOR_PROBE(client_registration_updated);
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Client: Client registration updated");
 }
 
 /* Note: called from separate thread */
 void EnebularAgentMbedCloudClient::client_unregistered()
 {
+    _metric_unregistrations->inc();
     update_registered_state(false);
 }
 
 /* Note: called from separate thread */
 void EnebularAgentMbedCloudClient::client_error(int error_code)
 {
-    const char * err;
+    const char *err = "UNKNOWN";
+    int i;
 
-    switch (error_code) {
-        case MbedCloudClient::ConnectErrorNone:
-            err = "ConnectErrorNone";
-            break;
-        case MbedCloudClient::ConnectAlreadyExists:
-            err = "ConnectAlreadyExists";
-            break;
-        case MbedCloudClient::ConnectBootstrapFailed:
-            err = "ConnectBootstrapFailed";
-            break;
-        case MbedCloudClient::ConnectInvalidParameters:
-            err = "ConnectInvalidParameters";
-            break;
-        case MbedCloudClient::ConnectNotRegistered:
-            err = "ConnectNotRegistered";
-            break;
-        case MbedCloudClient::ConnectTimeout:
-            err = "ConnectTimeout";
-            break;
-        case MbedCloudClient::ConnectNetworkError:
-            err = "ConnectNetworkError";
-            break;
-        case MbedCloudClient::ConnectResponseParseFailed:
-            err = "ConnectResponseParseFailed";
-            break;
-        case MbedCloudClient::ConnectUnknownError:
-            err = "ConnectUnknownError";
-            break;
-        case MbedCloudClient::ConnectMemoryConnectFail:
-            err = "ConnectMemoryConnectFail";
-            break;
-        case MbedCloudClient::ConnectNotAllowed:
-            err = "ConnectNotAllowed";
-            break;
-        case MbedCloudClient::ConnectSecureConnectionFailed:
-            err = "ConnectSecureConnectionFailed";
-            break;
-        case MbedCloudClient::ConnectDnsResolvingFailed:
-            err = "ConnectDnsResolvingFailed";
-            break;
-#ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
-        case MbedCloudClient::UpdateWarningCertificateNotFound:
-            err = "UpdateWarningCertificateNotFound";
+    for (i = 0; i < CLIENT_ERROR_CNT; i++) {
+        if (client_errors[i].code == error_code) {
+            err = client_errors[i].name;
             break;
-        case MbedCloudClient::UpdateWarningIdentityNotFound:
-            err = "UpdateWarningIdentityNotFound";
-            break;
-        case MbedCloudClient::UpdateWarningCertificateInvalid:
-            err = "UpdateWarningCertificateInvalid";
-            break;
-        case MbedCloudClient::UpdateWarningSignatureInvalid:
-            err = "UpdateWarningSignatureInvalid";
-            break;
-        case MbedCloudClient::UpdateWarningVendorMismatch:
-            err = "UpdateWarningVendorMismatch";
-            break;
-        case MbedCloudClient::UpdateWarningClassMismatch:
-            err = "UpdateWarningClassMismatch";
-            break;
-        case MbedCloudClient::UpdateWarningDeviceMismatch:
-            err = "UpdateWarningDeviceMismatch";
-            break;
-        case MbedCloudClient::UpdateWarningURINotFound:
-            err = "UpdateWarningURINotFound";
-            break;
-        case MbedCloudClient::UpdateWarningRollbackProtection:
-            err = "UpdateWarningRollbackProtection";
-            break;
-        case MbedCloudClient::UpdateWarningUnknown:
-            err = "UpdateWarningUnknown";
-            break;
-        case MbedCloudClient::UpdateErrorWriteToStorage:
-            err = "UpdateErrorWriteToStorage";
-            break;
-        case MbedCloudClient::UpdateErrorInvalidHash:
-            err = "UpdateErrorInvalidHash";
-            break;
-#endif
-        default:
-            err = "UNKNOWN";
+        }
     }
+    /* the last counter is for unknown errors */
+    _metric_errors[i]->inc();
+    CONNECTOR_PROBE1(client_error, error_code);
 
     _logger->log_console(INFO, "Client: Client error occurred: %s (%d)", err, error_code);
     _logger->log_console(INFO, "Client: Error details: %s", _cloud_client.error_description());
@@ -679,17 +725,15 @@ M2MResource *EnebularAgentMbedCloudClient::add_resource(
     char name[8];
 
     /* find exiting object and instance or create a new one */
-    M2MObjectList::const_iterator it;
-    for (it = _object_list.begin(); it != _object_list.end(); it++) {
-        if ((*it)->name_id() == object_id) {
-            obj = (*it);
-            break;
-        }
+    unordered_map<uint16_t, M2MObject *>::iterator it = _objects.find(object_id);
+    if (it != _objects.end()) {
+        obj = it->second;
     }
     if (!obj) {
         snprintf(name, sizeof(name), "%d", object_id);
         obj = M2MInterfaceFactory::create_object(name);
         _object_list.push_back(obj);
+        _objects[object_id] = obj;
     } else {
         obj_inst = obj->object_instance(instance_id);
     }
@@ -726,50 +770,3 @@ M2MResource *EnebularAgentMbedCloudClient::add_resource(
 
     return resource;
 }
-
-M2MResource *EnebularAgentMbedCloudClient::add_execute_resource(
-    uint16_t object_id,
-    uint16_t instance_id,
-    uint16_t resource_id,
-    const char *resource_type,
-    execute_callback execute_cb,
-    uint32_t max_age)
-{
-    return add_resource(
-        object_id,
-        instance_id,
-        resource_id,
-        resource_type,
-        M2MResourceInstance::STRING,
-        M2MBase::GET_POST_ALLOWED,
-        NULL,
-        false,
-        NULL,
-        execute_cb,
-        max_age);
-}
-
-M2MResource *EnebularAgentMbedCloudClient::add_rw_resource(
-    uint16_t object_id,
-    uint16_t instance_id,
-    uint16_t resource_id,
-    const char *resource_type,
-    M2MResourceInstance::ResourceType data_type,
-    const char *value,
-    bool observable,
-    value_updated_callback value_updated_cb,
-    uint32_t max_age)
-{
-    return add_resource(
-        object_id,
-        instance_id,
-        resource_id,
-        resource_type,
-        data_type,
-        M2MBase::GET_PUT_ALLOWED,
-        value,
-        observable,
-        value_updated_cb,
-        NULL,
-        max_age);
-}
@@ -2,9 +2,18 @@
 #ifndef ENEBULAR_AGENT_MBED_CLOUD_CLIENT_H
 #define ENEBULAR_AGENT_MBED_CLOUD_CLIENT_H
 
-#include <queue>
+#include <unordered_map>
 #include "mbed-cloud-client/MbedCloudClient.h"
 #include "logger.h"
+#include "shared_buffer.h"
+#include "json_writer.h"
+#include "spsc_ring.h"
+#include "resource_group.h"
+#include "metrics.h"
+#include "message_tracer.h"
+
+/* capacity of the agent-manager message hand-off ring */
+#define AGENT_MAN_MSG_RING_SIZE (256)
 
 class EnebularAgentMbedCloudClientCallback: public MbedCloudClientCallback {
 public:
@@ -14,11 +23,16 @@ public:
 class EnebularAgentMbedCloudConnector;
 
 typedef FP0<void> ClientConnectionStateCB;
-typedef FP2<void,const char *,const char *> AgentManagerMessageCB;
+typedef FP2<void,const char *,SharedBuffer *> AgentManagerMessageCB;
 
 typedef struct _agent_msg {
-    string type;
-    string content;
+    const char *type;
+    SharedBuffer *content;
+    /* set if the content is the value of a resource group member */
+    ResourceGroup *group;
+    int member;
+    /* set if the content is sent to the agent as it is */
+    struct msg_trace trace;
 } agent_msg_t;
 
 /**
@@ -131,48 +145,81 @@ private:
 
     EnebularAgentMbedCloudConnector * _connector;
     Logger *_logger;
+    MessageTracer *_tracer;
     EnebularAgentMbedCloudClientCallback *_clientCallback;
 
     MbedCloudClient _cloud_client;
     M2MObjectList _object_list;
     vector<ClientConnectionStateCB> _connection_state_callbacks;
     vector<AgentManagerMessageCB> _agent_man_msg_callbacks;
+    JsonWriter _msg_json;
 
     /* the following are thread-shared */
     bool _connecting;
     bool _registered;
     bool _registered_state_updated;
-    queue<agent_msg_t> _agent_man_msgs;
+    SpscRing<agent_msg_t> _agent_man_msgs;
     char *_agent_info;
     const char *_mbed_cloud_dev_credentials_path;
     pthread_mutex_t _lock;
 
-    M2MResource *_register_connection_id_res;
-    M2MResource *_register_device_id_res;
-    M2MResource *_register_auth_request_url_res;
-    M2MResource *_register_agent_manager_base_url_res;
-    M2MResource *_update_auth_access_token_res;
-    M2MResource *_update_auth_id_token_res;
-    M2MResource *_update_auth_state_res;
-    M2MResource *_agent_info_res;
-    M2MResource *_device_state_change_res;
-    M2MResource *_enebular_msg_to_device_res;
-    M2MResource *_enebular_msg_from_device_res;
-    M2MResource *_device_command_send_res;
-
-    unsigned long long _register_connection_id_time;
-    unsigned long long _register_device_id_time;
-    unsigned long long _register_auth_request_url_time;
-    unsigned long long _register_agent_manager_base_url_time;
-    unsigned long long _update_auth_access_token_time;
-    unsigned long long _update_auth_id_token_time;
-    unsigned long long _update_auth_state_time;
+    /* resources, in the order of the resource table */
+    enum resource_index {
+        RES_REGISTER_CONNECTION_ID,
+        RES_REGISTER_DEVICE_ID,
+        RES_REGISTER_AUTH_REQUEST_URL,
+        RES_REGISTER_AGENT_MANAGER_BASE_URL,
+        RES_UPDATE_AUTH_ACCESS_TOKEN,
+        RES_UPDATE_AUTH_ID_TOKEN,
+        RES_UPDATE_AUTH_STATE,
+        RES_AGENT_INFO,
+        RES_DEVICE_STATE_CHANGE,
+        RES_ENEBULAR_MSG_TO_DEVICE,
+        RES_ENEBULAR_MSG_FROM_DEVICE,
+        RES_DEVICE_COMMAND_SEND,
+        RES_CNT
+    };
+
+    /* resource groups, in the order of the group table */
+    enum resource_group_index {
+        GROUP_REGISTER,
+        GROUP_UPDATE_AUTH,
+        GROUP_CNT
+    };
+
+    struct resource_def;
+
+    /* binds a resource's value updated callback to its definition */
+    struct resource_binding {
+        EnebularAgentMbedCloudClient *client;
+        const struct resource_def *def;
+        M2MResource *res;
+        MetricCounter *update_cnt;
+        void value_updated(const char *name);
+    };
+
+    static const struct resource_def _resource_defs[RES_CNT];
+
+    struct resource_binding _resources[RES_CNT];
+    unordered_map<uint16_t, M2MObject *> _objects;
+    ResourceGroup *_groups[GROUP_CNT];
+
+    MetricCounter *_metric_connects;
+    MetricCounter *_metric_registrations;
+    MetricCounter *_metric_registration_updates;
+    MetricCounter *_metric_unregistrations;
+    /* per client error, and then for unknown errors */
+    vector<MetricCounter *> _metric_errors;
 
     void client_registered();
     void client_registration_updated();
     void client_unregistered();
     void client_error(int error_code);
 
+    void add_metrics(Metrics *metrics);
+    uint64_t get_agent_man_msg_cnt();
+    uint64_t get_agent_man_msg_dropped_cnt();
+
     bool init_fcc();
     void setup_objects();
     void update_registered_state(bool registered);
@@ -190,52 +237,19 @@ private:
         execute_callback execute_cb,
         uint32_t max_age);
 
-    // PUT/GET
-    M2MResource *add_rw_resource(
-        uint16_t object_id,
-        uint16_t instance_id,
-        uint16_t resource_id,
-        const char *resource_type,
-        M2MResourceInstance::ResourceType data_type,
-        const char *value,
-        bool observable,
-        value_updated_callback value_updated_cb,
-        uint32_t max_age);
+    void resource_updated(struct resource_binding *binding);
+    void reply_agent_info(M2MResource *res);
 
-    // POST
-    M2MResource *add_execute_resource(
-        uint16_t object_id,
-        uint16_t instance_id,
-        uint16_t resource_id,
-        const char *resource_type,
-        execute_callback execute_cb,
-        uint32_t max_age);
+    void resource_group_complete_cb(ResourceGroup *group);
 
-    void register_connection_id_cb(const char *name);
-    void register_device_id_cb(const char *name);
-    void register_auth_request_url_cb(const char *name);
-    void register_agent_manager_base_url_cb(const char *name);
-    void update_auth_access_token_cb(const char *name);
-    void update_auth_id_token_cb(const char *name);
-    void update_auth_state_cb(const char *name);
-    void agent_info_cb(const char *name);
-    void device_state_change_cb(const char *name);
-    void enebular_msg_to_device_cb(const char *name);
-    void enebular_msg_from_device_cb(const char *name);
-    void device_command_send_cb(const char *name);
-
-    //void example_execute_function(void * argument);
-
-    void process_deploy_flow_update();
-    void process_register_update();
-    void process_update_auth_update();
-    void process_device_state_change();
-    void process_device_command_send();
-
-    void queue_agent_man_msg(const char *type, const char *content);
+    void queue_agent_man_msg(const char *type, SharedBuffer *content, uint64_t callback_ts);
+    void queue_agent_man_msg(const char *type, M2MResource *res, uint64_t callback_ts);
+    void queue_agent_man_msg(agent_msg_t &msg);
+    void queue_group_member(ResourceGroup *group, int member, M2MResource *res);
 
     void notify_conntection_state();
     void notify_agent_man_msgs();
+    void notify_agent_man_msg(const char *type, SharedBuffer *content);
 
 };
 
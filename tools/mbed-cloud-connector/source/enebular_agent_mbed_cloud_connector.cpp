@@ -4,25 +4,59 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <time.h>
 #include "enebular_agent_mbed_cloud_connector.h"
 
 #define MAX_EPOLL_EVENT_CNT (10)
 
+/* main loop pass (event handling) time histogram buckets, in us */
+static const uint64_t loop_time_buckets[] = {
+    10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000
+};
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 EnebularAgentMbedCloudConnector::EnebularAgentMbedCloudConnector(const char* server_socket,
         const char* mbed_cloud_dev_credentials_path):
+    _tracer(&_metrics),
+    _monitor(&_metrics),
     _agent(new EnebularAgentInterface(this, server_socket)),
     _mbed_cloud_client(new EnebularAgentMbedCloudClient(this, mbed_cloud_dev_credentials_path)),
     _logger(Logger::get_instance()),
     _started(false),
     _running(false),
     _registering(false),
-    _can_connect(false)
+    _can_connect(false),
+    _epoll_fd(-1),
+    _kick_fd(-1),
+    _signal_fd(-1),
+    _metrics_server(NULL)
 {
     _logger->set_agent_interface(_agent);
+    _metrics.add_counter(METRICS_PREFIX "log_agent_rate_limited_total",
+        "Log messages not sent to the agent due to rate limiting",
+        MetricValueCB(_logger, &Logger::get_rate_limited_cnt));
+    _metrics.add_counter(METRICS_PREFIX "log_agent_repeated_total",
+        "Log messages not sent to the agent due to being repeats",
+        MetricValueCB(_logger, &Logger::get_repeated_cnt));
+
+    _loop_time = _metrics.add_histogram(METRICS_PREFIX "loop_iteration_seconds",
+        "Time taken to handle the events of a main loop pass",
+        loop_time_buckets, sizeof(loop_time_buckets) / sizeof(loop_time_buckets[0]), 1e-6);
 }
 
 EnebularAgentMbedCloudConnector::~EnebularAgentMbedCloudConnector()
 {
+    delete _metrics_server;
     delete _mbed_cloud_client;
     delete _agent;
 }
@@ -90,6 +124,8 @@ void EnebularAgentMbedCloudConnector::shutdown()
 
     _logger->log(INFO, "Shutting down...");
 
+    _monitor.stop_watchdog();
+
     _mbed_cloud_client->disconnect();
     int cnt = 30;
     while (_mbed_cloud_client->is_connected() && --cnt) {
@@ -99,27 +135,92 @@ void EnebularAgentMbedCloudConnector::shutdown()
          _logger->log(INFO, "Client failed to disconnect");
     }
 
+    /* send any log messages still on their way to the agent */
+    _logger->flush();
+    _logger->run();
+
     _agent->notify_connection(false);
     _agent->disconnect();
 
+    if (_metrics_server) {
+        _metrics_server->stop();
+    }
+
     uninit_wait_events();
 }
 
-void EnebularAgentMbedCloudConnector::register_wait_fd(int fd)
+bool EnebularAgentMbedCloudConnector::register_wait_fd(int fd, const char *name, WaitFdCB cb,
+        bool edge_triggered)
 {
     struct epoll_event ev;
+    struct wait_fd *wait_fd;
+
+    if (_wait_fds.find(fd) != _wait_fds.end()) {
+        _logger->log_console(ERROR, "Wait fd already registered");
+        return false;
+    }
 
-    ev.events = EPOLLIN;
-    ev.data.fd = fd;
+    wait_fd = new struct wait_fd;
+    wait_fd->fd = fd;
+    wait_fd->name = name;
+    wait_fd->events = EPOLLIN | EPOLLRDHUP;
+    if (edge_triggered) {
+        wait_fd->events |= EPOLLET;
+    }
+    wait_fd->cb = cb;
+    wait_fd->removed = false;
+
+    ev.events = wait_fd->events;
+    ev.data.ptr = wait_fd;
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
-        _logger->log(ERROR, "Failed to register wait fd");
+        _logger->log_console(ERROR, "Failed to register wait fd");
+        delete wait_fd;
+        return false;
     }
+
+    _wait_fds[fd] = wait_fd;
+
+    return true;
 }
 
 void EnebularAgentMbedCloudConnector::deregister_wait_fd(int fd)
 {
+    map<int, struct wait_fd *>::iterator it = _wait_fds.find(fd);
+    if (it == _wait_fds.end()) {
+        return;
+    }
+
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
-        _logger->log(ERROR, "Failed to deregister wait fd");
+        _logger->log_console(ERROR, "Failed to deregister wait fd");
+    }
+
+    /* it may still be in the ready list, so it's freed after dispatch */
+    it->second->removed = true;
+    _removed_wait_fds.push_back(it->second);
+    _wait_fds.erase(it);
+}
+
+void EnebularAgentMbedCloudConnector::set_wait_fd_writable(int fd, bool enable)
+{
+    struct epoll_event ev;
+    struct wait_fd *wait_fd;
+
+    map<int, struct wait_fd *>::iterator it = _wait_fds.find(fd);
+    if (it == _wait_fds.end()) {
+        return;
+    }
+    wait_fd = it->second;
+
+    if (enable) {
+        wait_fd->events |= EPOLLOUT;
+    } else {
+        wait_fd->events &= ~EPOLLOUT;
+    }
+
+    ev.events = wait_fd->events;
+    ev.data.ptr = wait_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        _logger->log_console(ERROR, "Failed to modify wait fd");
     }
 }
 
@@ -132,9 +233,17 @@ void EnebularAgentMbedCloudConnector::run()
     _running = true;
 
     while (_running) {
-        _agent->run();
-        _mbed_cloud_client->run();
         wait_for_events();
+        _monitor.pass_begin();
+        uint64_t start = now_us();
+        /* send all messages produced during the pass together */
+        _agent->cork();
+        handle_events();
+        _monitor.handler_begin("agent-flush");
+        _agent->uncork();
+        _monitor.handler_end();
+        _loop_time->observe(now_us() - start);
+        _monitor.pass_end();
     }
 }
 
@@ -153,7 +262,35 @@ void EnebularAgentMbedCloudConnector::kick()
 
 void EnebularAgentMbedCloudConnector::halt()
 {
+    uint64_t val = 1;
+
     _running = false;
+
+    /* wake up the loop (the kick fd write is async-signal-safe) */
+    if (write(_kick_fd, &val, sizeof(val)) < 0) {
+        return;
+    }
+}
+
+uint32_t EnebularAgentMbedCloudConnector::add_timer(uint32_t delay_ms, uint32_t interval_ms,
+        const char *name, TimerCB cb)
+{
+    uint32_t id = _timers.add(delay_ms, interval_ms, name, cb);
+    if (id == 0) {
+        _logger->log_console(ERROR, "Failed to add timer");
+    }
+
+    return id;
+}
+
+void EnebularAgentMbedCloudConnector::cancel_timer(uint32_t id)
+{
+    _timers.cancel(id);
+}
+
+void EnebularAgentMbedCloudConnector::set_agent_send_queue_limits(size_t max_bytes, size_t max_frames)
+{
+    _agent->set_send_queue_limits(max_bytes, max_frames);
 }
 
 void EnebularAgentMbedCloudConnector::set_log_level(LogLevel level)
@@ -166,72 +303,211 @@ void EnebularAgentMbedCloudConnector::enable_log_console(bool enable)
     _logger->enable_console(enable);
 }
 
+bool EnebularAgentMbedCloudConnector::enable_log_recorder(const char *path, size_t size)
+{
+    return _logger->enable_recorder(path, size);
+}
+
+Metrics *EnebularAgentMbedCloudConnector::get_metrics()
+{
+    return &_metrics;
+}
+
+bool EnebularAgentMbedCloudConnector::enable_metrics_server(const char *address)
+{
+    if (!_metrics_server) {
+        _metrics_server = new MetricsServer(this, &_metrics);
+    }
+
+    return _metrics_server->start(address);
+}
+
+MessageTracer *EnebularAgentMbedCloudConnector::get_tracer()
+{
+    return &_tracer;
+}
+
+bool EnebularAgentMbedCloudConnector::enable_message_trace_dump(const char *path)
+{
+    return _tracer.enable_dump(path);
+}
+
+bool EnebularAgentMbedCloudConnector::set_loop_budgets(const char *budgets)
+{
+    return _monitor.set_budgets(budgets);
+}
+
+bool EnebularAgentMbedCloudConnector::enable_loop_watchdog(uint32_t stall_ms)
+{
+    return _monitor.start_watchdog(stall_ms);
+}
+
 bool EnebularAgentMbedCloudConnector::init_wait_events()
 {
-    struct epoll_event ev;
+    sigset_t mask;
 
-    _kick_fd = eventfd(0, 0);
-    if (_kick_fd < 0) {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd < 0) {
         return false;
     }
 
-    _epoll_fd = epoll_create1(0);
-    if (_epoll_fd == -1) {
-        close(_kick_fd);
-        return false;
+    _kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_kick_fd < 0) {
+        goto err;
+    }
+    if (!register_wait_fd(_kick_fd, "client",
+            WaitFdCB(this, &EnebularAgentMbedCloudConnector::kick_fd_cb))) {
+        goto err;
     }
 
-    ev.events = EPOLLIN;
-    ev.data.fd = _kick_fd;
-    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _kick_fd, &ev) < 0) {
-        close(_kick_fd);
-        close(_epoll_fd);
-        return false;
+    if (!_timers.init()) {
+        goto err;
+    }
+    /* each timer's callback is reported to the monitor by the timers themselves */
+    _timers.set_monitor(&_monitor);
+    if (!register_wait_fd(_timers.get_fd(), NULL,
+            WaitFdCB(this, &EnebularAgentMbedCloudConnector::timer_fd_cb))) {
+        goto err;
+    }
+
+    if (_logger->get_fd() >= 0 && !register_wait_fd(_logger->get_fd(), "logger",
+            WaitFdCB(this, &EnebularAgentMbedCloudConnector::logger_fd_cb))) {
+        goto err;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    _signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (_signal_fd < 0) {
+        goto err;
+    }
+    if (!register_wait_fd(_signal_fd, "signal",
+            WaitFdCB(this, &EnebularAgentMbedCloudConnector::signal_fd_cb))) {
+        goto err;
     }
 
     return true;
+ err:
+    uninit_wait_events();
+    return false;
 }
 
 void EnebularAgentMbedCloudConnector::uninit_wait_events()
 {
-    close(_kick_fd);
-    close(_epoll_fd);
+    map<int, struct wait_fd *>::iterator it;
+    vector<struct wait_fd *>::iterator rit;
+
+    for (it = _wait_fds.begin(); it != _wait_fds.end(); it++) {
+        delete it->second;
+    }
+    _wait_fds.clear();
+    for (rit = _removed_wait_fds.begin(); rit != _removed_wait_fds.end(); rit++) {
+        delete *rit;
+    }
+    _removed_wait_fds.clear();
+    _ready_fds.clear();
+
+    _timers.uninit();
+    if (_signal_fd >= 0) {
+        close(_signal_fd);
+        _signal_fd = -1;
+    }
+    if (_kick_fd >= 0) {
+        close(_kick_fd);
+        _kick_fd = -1;
+    }
+    if (_epoll_fd >= 0) {
+        close(_epoll_fd);
+        _epoll_fd = -1;
+    }
 }
 
 void EnebularAgentMbedCloudConnector::wait_for_events()
 {
     struct epoll_event events[MAX_EPOLL_EVENT_CNT];
+    struct ready_fd ready;
     int nfds;
 
-    //printf("waiting...\n");
-
     while (1) {
-        nfds = epoll_wait(_epoll_fd, events, MAX_EPOLL_EVENT_CNT, 100);
+        /* no timeout: timers are waited on via their timerfd */
+        nfds = epoll_wait(_epoll_fd, events, MAX_EPOLL_EVENT_CNT, -1);
         if (nfds < 0) {
             if (errno != EINTR) {
                 _logger->log_console(ERROR, "Wait failed: %s", strerror(errno));
                 break;
             }
-        } else if (nfds == 0) {
-            //printf("timeout\n");
-            break;
+            if (!_running) {
+                break;
+            }
         } else {
             break;
         }
     }
 
     for (int i = 0; i < nfds; ++i) {
-        //printf("triggered fd: %d\n", events[i].data.fd);
-        if (events[i].data.fd == _kick_fd) {
-            uint64_t val;
-            ssize_t ret = read(_kick_fd, &val, sizeof(val));
-            if (ret != sizeof(val)) {
-                //printf("kick fd read failed\n");
-            }
+        ready.wait_fd = (struct wait_fd *)events[i].data.ptr;
+        ready.events = events[i].events;
+        _ready_fds.push_back(ready);
+    }
+}
+
+void EnebularAgentMbedCloudConnector::handle_events()
+{
+    vector<struct ready_fd>::iterator it;
+    vector<struct wait_fd *>::iterator rit;
+
+    for (it = _ready_fds.begin(); it != _ready_fds.end(); it++) {
+        /* a previous handler may have deregistered it */
+        if (it->wait_fd->removed) {
+            continue;
+        }
+        if (it->wait_fd->name) {
+            _monitor.handler_begin(it->wait_fd->name);
+            it->wait_fd->cb.call(it->events);
+            _monitor.handler_end();
+        } else {
+            it->wait_fd->cb.call(it->events);
         }
     }
+    _ready_fds.clear();
+
+    for (rit = _removed_wait_fds.begin(); rit != _removed_wait_fds.end(); rit++) {
+        delete *rit;
+    }
+    _removed_wait_fds.clear();
+}
+
+void EnebularAgentMbedCloudConnector::kick_fd_cb(uint32_t events)
+{
+    uint64_t val;
+
+    if (read(_kick_fd, &val, sizeof(val)) != sizeof(val)) {
+        return;
+    }
 
-    //printf("finished waiting\n");
+    /* the client is the only one that kicks (other than halt()) */
+    _mbed_cloud_client->run();
+}
+
+void EnebularAgentMbedCloudConnector::timer_fd_cb(uint32_t events)
+{
+    _timers.run();
+}
+
+void EnebularAgentMbedCloudConnector::logger_fd_cb(uint32_t events)
+{
+    _logger->run();
+}
+
+void EnebularAgentMbedCloudConnector::signal_fd_cb(uint32_t events)
+{
+    struct signalfd_siginfo info;
+
+    while (read(_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        _logger->log(INFO, "Received %s", strsignal(info.ssi_signo));
+        halt();
+    }
 }
 
 void EnebularAgentMbedCloudConnector::agent_connection_change_cb()
@@ -239,6 +515,18 @@ void EnebularAgentMbedCloudConnector::agent_connection_change_cb()
     bool connected = _agent->is_connected();
 
     _logger->log(INFO, "Agent: %s", connected ? "connected" : "disconnected");
+
+    /*
+     * The client stays connected while the agent is away (restarting etc), so
+     * bring a (re)connected agent up to date with the client's state.
+     */
+    if (connected && _mbed_cloud_client->is_connected()) {
+        const char *device_id = _mbed_cloud_client->get_device_id();
+        if (device_id && strlen(device_id) > 0) {
+            _agent->notify_registration(true, device_id);
+        }
+        _agent->notify_connection(true);
+    }
 }
 
 void EnebularAgentMbedCloudConnector::registration_request_cb()
@@ -336,9 +624,11 @@ void EnebularAgentMbedCloudConnector::client_connection_change_cb()
     }
 }
 
-void EnebularAgentMbedCloudConnector::agent_manager_message_cb(const char *type, const char *content)
+void EnebularAgentMbedCloudConnector::agent_manager_message_cb(const char *type, SharedBuffer *content)
 {
-    _logger->log_console(DEBUG, "Agent-man message: type:%s, content:%s", type, content);
+    _tracer.mark(MSG_TRACE_DISPATCHED);
+
+    LOGGER_LOG_CONSOLE(_logger, DEBUG, "Agent-man message: type:%s, content:%s", type, content->data());
 
     if (_agent->is_connected()) {
         if (strcmp(type, "ctrlMessage") == 0) {
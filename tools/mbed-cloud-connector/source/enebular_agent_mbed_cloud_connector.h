@@ -5,6 +5,16 @@
 #include "enebular_agent_mbed_cloud_client.h"
 #include "enebular_agent_interface.h"
 #include "logger.h"
+#include "event_timers.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "message_tracer.h"
+#include "loop_monitor.h"
+
+/**
+ * Wait file descriptor handler. It is passed the ready events (EPOLLIN etc).
+ */
+typedef FP1<void, uint32_t> WaitFdCB;
 
 /**
  * The enebular agent mbed cloud connector.
@@ -14,8 +24,18 @@
  * Mbed Cloud client and the enebular agent interface.
  *
  * It implements a very simple (bare minimium) main loop construct for other
- * modules to utilize. It currently has no support for timers (delayed/repeating
- * events).
+ * modules to utilize, with support for one-shot and repeating timers. The loop
+ * sleeps until there is activity on a registered file descriptor, it is kicked,
+ * or a timer is due, so it doesn't wake up at all while idle. Each registered
+ * file descriptor has its own handler, and only the handlers of the file
+ * descriptors that are ready are run.
+ *
+ * Each handler invocation is timed by a loop monitor (see LoopMonitor), which
+ * logs the handlers that exceed their time budget, and can also have a
+ * watchdog thread report loop passes that are stuck.
+ *
+ * SIGINT and SIGTERM are received via a signalfd and halt the main loop. They
+ * must be blocked in all threads (before any are created) for this to work.
  */
 class EnebularAgentMbedCloudConnector {
 
@@ -50,12 +70,19 @@ public:
     /**
      * Register a file descriptor to wait on.
      *
-     * The connector's main loop will run when the file descriptor is ready to
-     * be read.
-     * 
-     * @param fd File descriptor to wait on.
+     * The handler is called from the connector's main loop when the file
+     * descriptor is ready to be read (or its peer has hung up). In
+     * edge-triggered mode it is only called again once new data arrives, so
+     * the handler must read until EAGAIN.
+     *
+     * @param fd             File descriptor to wait on.
+     * @param name           Handler name, for the loop monitor (static string),
+     *                       or NULL if the handler reports to it itself
+     * @param cb             Handler to call when the file descriptor is ready.
+     * @param edge_triggered Use edge-triggered mode.
+     * @return False if the file descriptor could not be registered
      */
-    void register_wait_fd(int fd);
+    bool register_wait_fd(int fd, const char *name, WaitFdCB cb, bool edge_triggered = false);
 
     /**
      * Deregister a file descriptor that had been registered to wait on.
@@ -64,12 +91,51 @@ public:
      */
     void deregister_wait_fd(int fd);
 
+    /**
+     * Enable/disable waiting for a registered file descriptor to be writable.
+     *
+     * While enabled, the connector's main loop will also run when the file
+     * descriptor is ready to be written.
+     *
+     * @param fd     Registered file descriptor.
+     * @param enable Enable/disable
+     */
+    void set_wait_fd_writable(int fd, bool enable);
+
+    /**
+     * Add a timer to the connector's main loop.
+     *
+     * The callback is called from the main loop.
+     *
+     * @param delay_ms    Delay until the timer first fires
+     * @param interval_ms Interval to repeat at, or 0 for a one-shot timer
+     * @param name        Name, for the loop monitor (static string)
+     * @param cb          Callback to call when the timer fires
+     * @return The timer's ID, or 0 on failure
+     */
+    uint32_t add_timer(uint32_t delay_ms, uint32_t interval_ms, const char *name, TimerCB cb);
+
+    /**
+     * Cancel a timer added with add_timer().
+     *
+     * @param id Timer ID
+     */
+    void cancel_timer(uint32_t id);
+
+    /**
+     * Set the limits of the agent interface's outbound message queue.
+     *
+     * @param max_bytes  Maximum number of queued bytes
+     * @param max_frames Maximum number of queued messages
+     */
+    void set_agent_send_queue_limits(size_t max_bytes, size_t max_frames);
+
     /**
      * Run the connector's main loop.
      *
      * This doesn't return until halt is called. It also waits (sleeps) until
      * either there is activity on the file descriptors registered with
-     * register_wait_fd(), or it is kicked with kick().
+     * register_wait_fd(), it is kicked with kick(), or a timer is due.
      */
     void run();
 
@@ -101,8 +167,72 @@ public:
      */
     void enable_log_console(bool enable);
 
+    /**
+     * Enable the logger's flight recorder.
+     *
+     * @param path Flight recorder file path
+     * @param size Flight recorder size
+     * @return False if the flight recorder could not be opened
+     */
+    bool enable_log_recorder(const char *path, size_t size);
+
+    /**
+     * Get the connector's metrics registry.
+     *
+     * @return Metrics
+     */
+    Metrics *get_metrics();
+
+    /**
+     * Serve the connector's metrics (see MetricsServer).
+     *
+     * This must be called after startup().
+     *
+     * @param address Unix socket path or TCP port to listen on
+     * @return False if the address could not be listened on
+     */
+    bool enable_metrics_server(const char *address);
+
+    /**
+     * Get the connector's message tracer.
+     *
+     * @return Message tracer
+     */
+    MessageTracer *get_tracer();
+
+    /**
+     * Write the trace of each message between Mbed Cloud and the agent to a
+     * file (see MessageTracer).
+     *
+     * @param path Dump file path
+     * @return False if the file could not be opened
+     */
+    bool enable_message_trace_dump(const char *path);
+
+    /**
+     * Set the time budgets of the main loop's handlers (see
+     * LoopMonitor::set_budgets()).
+     *
+     * @param budgets Budgets
+     * @return False if the budgets are invalid
+     */
+    bool set_loop_budgets(const char *budgets);
+
+    /**
+     * Enable the main loop watchdog, which reports loop passes that take
+     * longer than the stall time.
+     *
+     * @param stall_ms Stall time
+     * @return False if the watchdog could not be started
+     */
+    bool enable_loop_watchdog(uint32_t stall_ms);
+
 private:
 
+    /* constructed first, as the other modules add their metrics to it */
+    Metrics _metrics;
+    MessageTracer _tracer;
+    LoopMonitor _monitor;
     Logger *_logger;
     EnebularAgentMbedCloudClient *_mbed_cloud_client;
     EnebularAgentInterface *_agent;
@@ -111,19 +241,44 @@ private:
     bool _registering;
     bool _can_connect;
     volatile bool _running;
+    struct wait_fd {
+        int fd;
+        const char *name;
+        uint32_t events;
+        WaitFdCB cb;
+        bool removed;
+    };
+
+    struct ready_fd {
+        struct wait_fd *wait_fd;
+        uint32_t events;
+    };
+
     int _epoll_fd;
     int _kick_fd;
+    int _signal_fd;
+    EventTimers _timers;
+    MetricsServer *_metrics_server;
+    MetricHistogram *_loop_time;
+    map<int, struct wait_fd *> _wait_fds;
+    vector<struct wait_fd *> _removed_wait_fds;
+    vector<struct ready_fd> _ready_fds;
 
     bool init_wait_events();
     void uninit_wait_events();
     void wait_for_events();
+    void handle_events();
+    void kick_fd_cb(uint32_t events);
+    void timer_fd_cb(uint32_t events);
+    void logger_fd_cb(uint32_t events);
+    void signal_fd_cb(uint32_t events);
 
     void update_connection_state();
     void agent_connection_change_cb();
     void registration_request_cb();
     void connection_request_cb(bool connect);
     void client_connection_change_cb();
-    void agent_manager_message_cb(const char *type, const char *content);
+    void agent_manager_message_cb(const char *type, SharedBuffer *content);
     void agent_info_cb(const char *type);
     void ctrl_message_cb(const char *message);
 
@@ -0,0 +1,206 @@
+
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+#include <sys/timerfd.h>
+#include "event_timers.h"
+
+EventTimers::EventTimers():
+    _fd(-1),
+    _next_id(1),
+    _armed(0),
+    _monitor(NULL)
+{
+}
+
+EventTimers::~EventTimers()
+{
+    uninit();
+}
+
+bool EventTimers::init()
+{
+    if (_fd >= 0) {
+        return true;
+    }
+
+    _fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_fd < 0) {
+        return false;
+    }
+    _armed = 0;
+
+    return true;
+}
+
+void EventTimers::uninit()
+{
+    _timers.clear();
+    _deadlines.clear();
+
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+int EventTimers::get_fd()
+{
+    return _fd;
+}
+
+uint64_t EventTimers::now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void EventTimers::push_deadline(uint64_t time, uint32_t id)
+{
+    deadline d;
+    d.time = time;
+    d.id = id;
+
+    _deadlines.push_back(d);
+    push_heap(_deadlines.begin(), _deadlines.end(), deadline_later());
+}
+
+void EventTimers::pop_deadline()
+{
+    pop_heap(_deadlines.begin(), _deadlines.end(), deadline_later());
+    _deadlines.pop_back();
+}
+
+void EventTimers::set_monitor(LoopMonitor *monitor)
+{
+    _monitor = monitor;
+}
+
+uint32_t EventTimers::add(uint32_t delay_ms, uint32_t interval_ms, const char *name, TimerCB cb)
+{
+    uint32_t id;
+    timer t;
+
+    if (_fd < 0) {
+        return 0;
+    }
+
+    id = _next_id++;
+    if (_next_id == 0) {
+        _next_id = 1;
+    }
+
+    t.deadline = now_ms() + delay_ms;
+    t.interval = interval_ms;
+    t.name = name;
+    t.cb = cb;
+    _timers[id] = t;
+    push_deadline(t.deadline, id);
+
+    arm();
+
+    return id;
+}
+
+void EventTimers::cancel(uint32_t id)
+{
+    /* its deadline is dropped once it reaches the top of the heap */
+    if (_timers.erase(id) > 0) {
+        arm();
+    }
+}
+
+bool EventTimers::is_pending(uint32_t id)
+{
+    return _timers.find(id) != _timers.end();
+}
+
+void EventTimers::run()
+{
+    uint64_t expirations;
+    uint64_t now;
+
+    if (_fd < 0) {
+        return;
+    }
+
+    /* clear the timerfd's readable state */
+    if (read(_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return;
+    }
+    _armed = 0;
+
+    now = now_ms();
+
+    while (!_deadlines.empty() && _deadlines.front().time <= now) {
+
+        deadline d = _deadlines.front();
+        pop_deadline();
+
+        map<uint32_t, timer>::iterator it = _timers.find(d.id);
+        if (it == _timers.end() || it->second.deadline != d.time) {
+            /* cancelled */
+            continue;
+        }
+
+        TimerCB cb = it->second.cb;
+        const char *name = it->second.name;
+        if (it->second.interval > 0) {
+            uint64_t next = d.time + it->second.interval;
+            /* don't try to catch up on missed intervals */
+            if (next <= now) {
+                next = now + it->second.interval;
+            }
+            it->second.deadline = next;
+            push_deadline(next, d.id);
+        } else {
+            _timers.erase(it);
+        }
+
+        /* the callback may add or cancel timers (including this one) */
+        if (_monitor) {
+            _monitor->handler_begin(name);
+        }
+        cb.call();
+        if (_monitor) {
+            _monitor->handler_end();
+        }
+    }
+
+    arm();
+}
+
+void EventTimers::arm()
+{
+    struct itimerspec its = {};
+    uint64_t next;
+
+    /* drop cancelled deadlines so they don't cause needless wakeups */
+    while (!_deadlines.empty()) {
+        const deadline &d = _deadlines.front();
+        map<uint32_t, timer>::iterator it = _timers.find(d.id);
+        if (it != _timers.end() && it->second.deadline == d.time) {
+            break;
+        }
+        pop_deadline();
+    }
+
+    next = _deadlines.empty() ? 0 : _deadlines.front().time;
+    if (next == _armed) {
+        return;
+    }
+
+    /* an all zero value disarms the timer */
+    if (next > 0) {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000;
+    }
+    if (timerfd_settime(_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        return;
+    }
+    _armed = next;
+}
@@ -0,0 +1,130 @@
+#ifndef EVENT_TIMERS_H
+#define EVENT_TIMERS_H
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include "mbed-cloud-client/MbedCloudClient.h"
+#include "loop_monitor.h"
+
+typedef FP0<void> TimerCB;
+
+/**
+ * One-shot and repeating timers for a main loop.
+ *
+ * All timers share a single timerfd (on the monotonic clock) that is armed for
+ * the earliest deadline only, so the owning loop can wait on it alongside its
+ * other file descriptors and sleep for as long as no timer is due. Pending
+ * deadlines are kept in a min-heap.
+ *
+ * Timers must only be added, cancelled and run from the owning loop's thread.
+ */
+class EventTimers {
+
+public:
+
+    /**
+     * Constructor
+     */
+    EventTimers();
+
+    /**
+     * Deconstructor
+     */
+    ~EventTimers();
+
+    /**
+     * Create the timerfd.
+     */
+    bool init();
+
+    /**
+     * Cancel all timers and close the timerfd.
+     */
+    void uninit();
+
+    /**
+     * Get the timerfd, which is readable when a timer has expired.
+     */
+    int get_fd();
+
+    /**
+     * Set the loop monitor that timer callback invocations are reported to.
+     *
+     * @param monitor Loop monitor
+     */
+    void set_monitor(LoopMonitor *monitor);
+
+    /**
+     * Add a timer.
+     *
+     * @param delay_ms    Delay until the timer first fires
+     * @param interval_ms Interval to repeat at, or 0 for a one-shot timer
+     * @param name        Name, for the loop monitor (static string)
+     * @param cb          Callback to call when the timer fires
+     * @return The timer's ID, or 0 on failure
+     */
+    uint32_t add(uint32_t delay_ms, uint32_t interval_ms, const char *name, TimerCB cb);
+
+    /**
+     * Cancel a timer.
+     *
+     * Cancelling a timer that has already fired (one-shot) or been cancelled
+     * does nothing.
+     *
+     * @param id Timer ID
+     */
+    void cancel(uint32_t id);
+
+    /**
+     * Checks if a timer is still pending.
+     *
+     * @param id Timer ID
+     */
+    bool is_pending(uint32_t id);
+
+    /**
+     * Call the callbacks of all the timers that have expired, and re-arm the
+     * timerfd for the next deadline.
+     */
+    void run();
+
+    /**
+     * Get the current monotonic time in milliseconds.
+     */
+    static uint64_t now_ms();
+
+private:
+
+    struct timer {
+        uint64_t deadline;
+        uint32_t interval;
+        const char *name;
+        TimerCB cb;
+    };
+
+    struct deadline {
+        uint64_t time;
+        uint32_t id;
+    };
+
+    struct deadline_later {
+        bool operator()(const deadline &a, const deadline &b) const {
+            return a.time > b.time;
+        }
+    };
+
+    int _fd;
+    uint32_t _next_id;
+    uint64_t _armed;
+    LoopMonitor *_monitor;
+    map<uint32_t, timer> _timers;
+    vector<deadline> _deadlines;
+
+    void push_deadline(uint64_t time, uint32_t id);
+    void pop_deadline();
+    void arm();
+
+};
+
+#endif // EVENT_TIMERS_H
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flight_recorder.h"
+
+FlightRecorder::FlightRecorder():
+    _fd(-1),
+    _header(NULL),
+    _data(NULL),
+    _mask(0),
+    _map_size(0)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    close();
+}
+
+bool FlightRecorder::open(const char *path, size_t size)
+{
+    struct flight_recorder_header *header;
+    uint64_t data_size = FLIGHT_RECORDER_MIN_SIZE;
+    struct stat st;
+    bool reuse;
+    void *map;
+
+    close();
+
+    while (data_size * 2 <= size) {
+        data_size *= 2;
+    }
+    _map_size = FLIGHT_RECORDER_HEADER_SIZE + data_size;
+
+    _fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        return false;
+    }
+
+    reuse = (fstat(_fd, &st) == 0 && (size_t)st.st_size == _map_size);
+    if (!reuse) {
+        /* the ring starts out zeroed (so without any entries) */
+        if (ftruncate(_fd, 0) < 0 || ftruncate(_fd, _map_size) < 0) {
+            goto err;
+        }
+    }
+
+    map = mmap(NULL, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED) {
+        goto err;
+    }
+    header = (struct flight_recorder_header *)map;
+
+    if (reuse && (memcmp(header->magic, FLIGHT_RECORDER_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != FLIGHT_RECORDER_VERSION ||
+            header->header_size != FLIGHT_RECORDER_HEADER_SIZE ||
+            header->data_size != data_size)) {
+        memset(map, 0, _map_size);
+        reuse = false;
+    }
+    if (!reuse) {
+        header->version = FLIGHT_RECORDER_VERSION;
+        header->header_size = FLIGHT_RECORDER_HEADER_SIZE;
+        header->data_size = data_size;
+        header->write_pos = 0;
+        header->start_cnt = 0;
+        /* written last, so a half-initialized file isn't reused */
+        memcpy(header->magic, FLIGHT_RECORDER_MAGIC, sizeof(header->magic));
+    }
+    header->start_cnt++;
+
+    _header = header;
+    _data = (char *)map + FLIGHT_RECORDER_HEADER_SIZE;
+    _mask = data_size - 1;
+
+    return true;
+ err:
+    ::close(_fd);
+    _fd = -1;
+    return false;
+}
+
+void FlightRecorder::close()
+{
+    if (_header) {
+        munmap(_header, _map_size);
+        _header = NULL;
+        _data = NULL;
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool FlightRecorder::is_open()
+{
+    return _header != NULL;
+}
+
+void FlightRecorder::copy_in(uint64_t pos, const void *src, size_t len)
+{
+    size_t off = pos & _mask;
+    size_t first = _mask + 1 - off;
+
+    if (len <= first) {
+        memcpy(_data + off, src, len);
+    } else {
+        memcpy(_data + off, src, first);
+        memcpy(_data, (const char *)src + first, len - first);
+    }
+}
+
+void FlightRecorder::write(uint8_t level, uint64_t ts, const char *msg, size_t len)
+{
+    struct flight_recorder_entry entry;
+    uint32_t *magic;
+    uint64_t pos;
+
+    if (!_header) {
+        return;
+    }
+
+    if (len > UINT16_MAX) {
+        len = UINT16_MAX;
+    }
+
+    pos = __atomic_fetch_add(&_header->write_pos, FLIGHT_RECORDER_ENTRY_SIZE(len),
+        __ATOMIC_RELAXED);
+
+    /* entries are aligned, so the magic never wraps */
+    magic = (uint32_t *)(_data + (pos & _mask));
+    __atomic_store_n(magic, 0, __ATOMIC_RELAXED);
+
+    entry.magic = 0;
+    entry.level = level;
+    entry.reserved = 0;
+    entry.len = len;
+    entry.pos = pos;
+    entry.ts = ts;
+    copy_in(pos + sizeof(entry.magic), (const char *)&entry + sizeof(entry.magic),
+        sizeof(entry) - sizeof(entry.magic));
+    copy_in(pos + sizeof(entry), msg, len);
+
+    __atomic_store_n(magic, FLIGHT_RECORDER_ENTRY_MAGIC, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,133 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Flight recorder file format.
+ *
+ * The file is a header followed by a ring of variable-length entries. Each
+ * entry is a flight_recorder_entry followed by its message, padded to a
+ * multiple of 8 bytes. Entries may wrap around the end of the ring.
+ *
+ * The header's write_pos is the total number of bytes ever reserved for
+ * entries, so the ring holds the entries between write_pos - data_size and
+ * write_pos. Each entry records its own position, so that the entries of
+ * older laps (and entries that were never completed) can be told apart. An
+ * entry is complete once its magic has been written (last).
+ */
+
+#define FLIGHT_RECORDER_MAGIC           "ENEBFR01"
+#define FLIGHT_RECORDER_VERSION         (1)
+#define FLIGHT_RECORDER_HEADER_SIZE     (64)
+#define FLIGHT_RECORDER_ENTRY_MAGIC     (0x43455246)
+#define FLIGHT_RECORDER_ALIGN           (8)
+
+#define FLIGHT_RECORDER_MIN_SIZE        (64 * 1024)
+#define FLIGHT_RECORDER_DEFAULT_SIZE    (1024 * 1024)
+
+struct flight_recorder_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    /* size of the ring (a power of two) */
+    uint64_t data_size;
+    /* updated atomically */
+    uint64_t write_pos;
+    /* number of times the recorder has been started with this file */
+    uint32_t start_cnt;
+};
+
+struct flight_recorder_entry {
+    uint32_t magic;
+    uint8_t level;
+    uint8_t reserved;
+    uint16_t len;
+    /* position in the ring (as write_pos) */
+    uint64_t pos;
+    /* ns since the epoch */
+    uint64_t ts;
+};
+
+#define FLIGHT_RECORDER_ENTRY_SIZE(len) \
+    ((sizeof(struct flight_recorder_entry) + (len) + FLIGHT_RECORDER_ALIGN - 1) & \
+        ~(uint64_t)(FLIGHT_RECORDER_ALIGN - 1))
+
+/**
+ * A crash-surviving log: a fixed-size ring of log entries in a memory-mapped
+ * file.
+ *
+ * Writing an entry only reserves space with an atomic add and copies it into
+ * the mapping, so it costs no more than a memory write and is safe from any
+ * thread. As the mapping is shared with the file, the entries written are
+ * kept even if the process crashes. When opened again, the recorder carries
+ * on after the entries already in the file.
+ *
+ * The file is decoded with flight-recorder-dump (utils/).
+ */
+class FlightRecorder {
+
+public:
+
+    /**
+     * Constructor
+     */
+    FlightRecorder();
+
+    /**
+     * Deconstructor
+     */
+    ~FlightRecorder();
+
+    /**
+     * Open (or create) the recorder file.
+     *
+     * If the file is an existing recorder file of the same size, its entries
+     * are kept. Otherwise it is recreated.
+     *
+     * @param path File path
+     * @param size Size of the ring (rounded down to a power of two)
+     * @return False if the file could not be opened or mapped
+     */
+    bool open(const char *path, size_t size);
+
+    /**
+     * Close the recorder file.
+     */
+    void close();
+
+    /**
+     * Checks if the recorder file is open or not.
+     */
+    bool is_open();
+
+    /**
+     * Write an entry.
+     *
+     * This is thread-safe (can be called from any thread).
+     *
+     * @param level Log level
+     * @param ts    Time, in ns since the epoch
+     * @param msg   Message
+     * @param len   Message length
+     */
+    void write(uint8_t level, uint64_t ts, const char *msg, size_t len);
+
+private:
+
+    int _fd;
+    struct flight_recorder_header *_header;
+    char *_data;
+    uint64_t _mask;
+    size_t _map_size;
+
+    void copy_in(uint64_t pos, const void *src, size_t len);
+
+    /* not copyable */
+    FlightRecorder(const FlightRecorder &);
+    FlightRecorder &operator=(const FlightRecorder &);
+
+};
+
+#endif // FLIGHT_RECORDER_H
@@ -0,0 +1,295 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "json_writer.h"
+
+#define INIT_BUF_SIZE   (1024)
+
+#define NEEDS_ESCAPE(c) ((unsigned char)(c) < 0x20 || (c) == '"' || (c) == '\\')
+
+/**
+ * Returns the index of the first character that needs escaping, or len if
+ * there are none. Most strings need no escaping at all, so this checks 16
+ * (SSE2) or 8 (word-at-a-time) characters per step.
+ */
+static size_t find_escape(const char *str, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl_max = _mm_set1_epi8(0x1f);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, str + i, sizeof(w));
+        uint64_t q = w ^ (ones * '"');
+        uint64_t b = w ^ (ones * '\\');
+        uint64_t hit = ((w - ones * 0x20) & ~w) |
+            ((q - ones) & ~q) |
+            ((b - ones) & ~b);
+        if (hit & highs) {
+            break;
+        }
+    }
+
+    for (; i < len; i++) {
+        if (NEEDS_ESCAPE(str[i])) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+JsonWriter::JsonWriter():
+    _buf(NULL),
+    _size(0),
+    _len(0),
+    _need_comma(false),
+    _failed(false)
+{
+}
+
+JsonWriter::~JsonWriter()
+{
+    free(_buf);
+}
+
+void JsonWriter::reset()
+{
+    _len = 0;
+    _need_comma = false;
+    _failed = false;
+    if (_buf) {
+        _buf[0] = '\0';
+    }
+}
+
+bool JsonWriter::reserve(size_t cnt)
+{
+    size_t size;
+    char *buf;
+
+    if (_failed) {
+        return false;
+    }
+    if (_len + cnt + 1 <= _size) {
+        return true;
+    }
+
+    size = (_size > 0) ? _size : INIT_BUF_SIZE;
+    while (size < _len + cnt + 1) {
+        size *= 2;
+    }
+    buf = (char *)realloc(_buf, size);
+    if (!buf) {
+        _failed = true;
+        return false;
+    }
+    _buf = buf;
+    _size = size;
+
+    return true;
+}
+
+void JsonWriter::append(const char *str, size_t len)
+{
+    if (!reserve(len)) {
+        return;
+    }
+    memcpy(_buf + _len, str, len);
+    _len += len;
+    _buf[_len] = '\0';
+}
+
+void JsonWriter::append(char c)
+{
+    if (!reserve(1)) {
+        return;
+    }
+    _buf[_len++] = c;
+    _buf[_len] = '\0';
+}
+
+void JsonWriter::separate()
+{
+    if (_need_comma) {
+        append(',');
+    }
+    _need_comma = true;
+}
+
+void JsonWriter::append_escaped(const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char esc[6];
+    size_t i;
+
+    while (len > 0) {
+
+        i = find_escape(str, len);
+        append(str, i);
+        if (i == len) {
+            break;
+        }
+
+        esc[0] = '\\';
+        switch (str[i]) {
+            case '"':  esc[1] = '"';  append(esc, 2); break;
+            case '\\': esc[1] = '\\'; append(esc, 2); break;
+            case '\b': esc[1] = 'b';  append(esc, 2); break;
+            case '\f': esc[1] = 'f';  append(esc, 2); break;
+            case '\n': esc[1] = 'n';  append(esc, 2); break;
+            case '\r': esc[1] = 'r';  append(esc, 2); break;
+            case '\t': esc[1] = 't';  append(esc, 2); break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex[(str[i] >> 4) & 0xf];
+                esc[5] = hex[str[i] & 0xf];
+                append(esc, 6);
+                break;
+        }
+
+        str += i + 1;
+        len -= i + 1;
+    }
+}
+
+void JsonWriter::begin_object()
+{
+    separate();
+    append('{');
+    _need_comma = false;
+}
+
+void JsonWriter::end_object()
+{
+    append('}');
+    _need_comma = true;
+}
+
+void JsonWriter::begin_array()
+{
+    separate();
+    append('[');
+    _need_comma = false;
+}
+
+void JsonWriter::end_array()
+{
+    append(']');
+    _need_comma = true;
+}
+
+void JsonWriter::key(const char *key)
+{
+    separate();
+    append('"');
+    append_escaped(key, strlen(key));
+    append("\":", 2);
+    _need_comma = false;
+}
+
+void JsonWriter::string(const char *str)
+{
+    string(str, strlen(str));
+}
+
+void JsonWriter::string(const char *str, size_t len)
+{
+    string_begin();
+    string_append(str, len);
+    string_end();
+}
+
+void JsonWriter::string_begin()
+{
+    separate();
+    append('"');
+}
+
+void JsonWriter::string_append(const char *str, size_t len)
+{
+    append_escaped(str, len);
+}
+
+void JsonWriter::string_end()
+{
+    append('"');
+}
+
+void JsonWriter::boolean(bool val)
+{
+    separate();
+    if (val) {
+        append("true", 4);
+    } else {
+        append("false", 5);
+    }
+}
+
+void JsonWriter::number(long long val)
+{
+    char str[24];
+    int len = snprintf(str, sizeof(str), "%lld", val);
+
+    separate();
+    append(str, len);
+}
+
+void JsonWriter::raw(const char *json, size_t len)
+{
+    separate();
+    append(json, len);
+}
+
+void JsonWriter::member(const char *key, const char *str)
+{
+    this->key(key);
+    string(str);
+}
+
+void JsonWriter::member(const char *key, const char *str, size_t len)
+{
+    this->key(key);
+    string(str, len);
+}
+
+const char *JsonWriter::data()
+{
+    return _buf ? _buf : "";
+}
+
+size_t JsonWriter::len()
+{
+    return _len;
+}
+
+bool JsonWriter::failed()
+{
+    return _failed;
+}
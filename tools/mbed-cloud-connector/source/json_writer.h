@@ -0,0 +1,163 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stddef.h>
+
+/**
+ * A small streaming JSON writer.
+ *
+ * JSON is appended into a growable buffer that is kept between uses (call
+ * reset() to start a new document), so output is never truncated. Separators
+ * are inserted automatically and strings are escaped. If memory runs out, the
+ * writer stops appending and is marked as failed.
+ *
+ * Example:
+ *
+ *     writer.reset();
+ *     writer.begin_object();
+ *     writer.member("type", "log");
+ *     writer.end_object();
+ */
+class JsonWriter {
+
+public:
+
+    /**
+     * Constructor
+     */
+    JsonWriter();
+
+    /**
+     * Deconstructor
+     */
+    ~JsonWriter();
+
+    /**
+     * Discard the current contents (the buffer is kept).
+     */
+    void reset();
+
+    /**
+     * Begin an object.
+     */
+    void begin_object();
+
+    /**
+     * End the current object.
+     */
+    void end_object();
+
+    /**
+     * Begin an array.
+     */
+    void begin_array();
+
+    /**
+     * End the current array.
+     */
+    void end_array();
+
+    /**
+     * Write an object member key. It must be followed by a value.
+     *
+     * @param key Key
+     */
+    void key(const char *key);
+
+    /**
+     * Write a string value.
+     *
+     * @param str String
+     */
+    void string(const char *str);
+
+    /**
+     * Write a string value.
+     *
+     * @param str String
+     * @param len String length
+     */
+    void string(const char *str, size_t len);
+
+    /**
+     * Begin a string value that is to be built up with string_append().
+     */
+    void string_begin();
+
+    /**
+     * Append to the string value started with string_begin().
+     *
+     * @param str String
+     * @param len String length
+     */
+    void string_append(const char *str, size_t len);
+
+    /**
+     * End the string value started with string_begin().
+     */
+    void string_end();
+
+    /**
+     * Write a boolean value.
+     *
+     * @param val Value
+     */
+    void boolean(bool val);
+
+    /**
+     * Write a number value.
+     *
+     * @param val Value
+     */
+    void number(long long val);
+
+    /**
+     * Write a value that is already JSON, as-is.
+     *
+     * @param json JSON
+     * @param len  JSON length
+     */
+    void raw(const char *json, size_t len);
+
+    /**
+     * Write an object member with a string value.
+     */
+    void member(const char *key, const char *str);
+
+    /**
+     * Write an object member with a string value.
+     */
+    void member(const char *key, const char *str, size_t len);
+
+    /**
+     * Get the JSON written so far (NUL terminated).
+     */
+    const char *data();
+
+    /**
+     * Get the length of the JSON written so far.
+     */
+    size_t len();
+
+    /**
+     * Checks if writing failed (due to lack of memory).
+     */
+    bool failed();
+
+private:
+
+    char *_buf;
+    size_t _size;
+    size_t _len;
+    bool _need_comma;
+    bool _failed;
+
+    bool reserve(size_t cnt);
+    void append(const char *str, size_t len);
+    void append(char c);
+    void separate();
+    void append_escaped(const char *str, size_t len);
+
+};
+
+#endif // JSON_WRITER_H
@@ -1,7 +1,34 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "logger.h"
+#include "connector_probes.h"
+
+/* console output is written in batches of up to this size */
+#define CONSOLE_BATCH_SIZE      (16 * 1024)
+#define FLUSH_TIMEOUT_MS        (1000)
+/*
+ * once woken up, the writer waits this long before writing, so that messages
+ * logged in a burst are written together (and logging them doesn't wake it)
+ */
+#define WRITE_DELAY_US          (1000)
+
+#define TRUNCATION_MARKER       "..."
+
+#define NSEC_PER_SEC            (1000000000ULL)
+#define NSEC_PER_MSEC           (1000000ULL)
+
+/* length of a call site's format string quoted in its suppression report */
+#define SUMMARY_SITE_LEN        (64)
 
 Logger *Logger::_instance = 0;
 
@@ -11,6 +38,15 @@ const char *log_level_str[] =  {
     [ERROR] = "error",
 };
 
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
 Logger* Logger::get_instance()
 {
     if (_instance == 0) {
@@ -22,10 +58,50 @@ Logger* Logger::get_instance()
 
 Logger::Logger()
 {
+    pthread_condattr_t attr;
+
     _level = INFO;
     _console_enabled = false;
     _agent = 0;
+    _recorder = NULL;
+    _writer_started = false;
+    _reported_overflow_cnt = 0;
+    _reported_agent_overflow_cnt = 0;
+    _written_cnt = 0;
+    _suppressed_site_cnt = 0;
+    _last_agent_record.len = 0;
+    _repeat_cnt = 0;
+    _repeat_since_ns = 0;
+    _force_summaries = false;
+    _rate_limited_cnt = 0;
+    _repeated_cnt = 0;
+    _agent_batch_cnt = 0;
+    _agent_batch_bytes = 0;
+    _agent_batch_since_ns = 0;
+
     pthread_mutex_init(&_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    _agent_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _writer_fd = eventfd(0, EFD_CLOEXEC);
+
+    if (!_records.init(LOG_RING_SIZE) || !_agent_records.init(LOG_AGENT_RING_SIZE)) {
+        fprintf(stderr, "Logger: oom\n");
+        return;
+    }
+
+    /* without the writer thread, records are written by the thread logging them */
+    if (_writer_fd >= 0 && pthread_create(&_writer, NULL, writer_main, this) == 0) {
+        pthread_detach(_writer);
+        _writer_started = true;
+    } else {
+        fprintf(stderr, "Logger: failed to start writer thread, logging synchronously\n");
+    }
+
+    atexit(flush_at_exit);
 }
 
 void Logger::set_agent_interface(EnebularAgentInterface *agent)
@@ -43,85 +119,506 @@ void Logger::enable_console(bool enable)
     _console_enabled = enable;
 }
 
-void Logger::out_console(LogLevel level, const char *msg)
+bool Logger::enable_recorder(const char *path, size_t size)
 {
-    pthread_mutex_lock(&_lock);
+    FlightRecorder *recorder = new FlightRecorder();
 
-    if (_console_enabled) {
-        fprintf((level == ERROR) ? stderr : stdout, "%s\n", msg);
+    if (!recorder->open(path, size)) {
+        log_console(ERROR, "Logger: failed to open flight recorder %s: %s", path, strerror(errno));
+        delete recorder;
+        return false;
     }
 
-    pthread_mutex_unlock(&_lock);
+    _recorder = recorder;
+    log(INFO, "Logger: flight recorder: %s (pid %d)", path, getpid());
+
+    return true;
 }
 
-void Logger::out_agent(LogLevel level, const char *msg)
+int Logger::get_fd()
 {
-    if (_agent && _agent->is_connected()) {
-        _agent->send_log_message(log_level_str[level], "Mbed Cloud", msg);
+    return _agent_fd;
+}
+
+void *Logger::writer_main(void *arg)
+{
+    Logger *logger = (Logger *)arg;
+    sigset_t mask;
+    uint64_t val;
+
+    /* signals are left to the main thread */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    pthread_setname_np(pthread_self(), "logger");
+
+    while (1) {
+        struct pollfd pfd;
+        int ret;
+
+        /* batches and summaries that are due are sent even if nothing else is logged */
+        pfd.fd = logger->_writer_fd;
+        pfd.events = POLLIN;
+        ret = poll(&pfd, 1, logger->get_writer_timeout());
+        if (ret < 0 && errno != EINTR) {
+            break;
+        }
+        if (ret > 0) {
+            if (read(logger->_writer_fd, &val, sizeof(val)) < 0 && errno != EINTR) {
+                break;
+            }
+            usleep(WRITE_DELAY_US);
+        }
+
+        logger->write_records();
+
+        pthread_mutex_lock(&logger->_lock);
+        logger->_written_cnt = logger->_records.get_popped_cnt();
+        pthread_cond_broadcast(&logger->_cond);
+        pthread_mutex_unlock(&logger->_lock);
     }
+
+    return NULL;
 }
 
-#define MAX_MSG_SIZE (1024*4)
+void Logger::flush_at_exit()
+{
+    if (_instance) {
+        _instance->flush();
+    }
+}
 
-void Logger::log(LogLevel level, const char *fmt, ...)
+void Logger::flush()
 {
-    if (level > ERROR) {
+    struct timespec deadline;
+    uint64_t val = 1;
+    size_t cnt;
+
+    if (!_writer_started) {
         return;
     }
-    if (level < _level) {
+
+    cnt = _records.get_claimed_cnt();
+    _force_summaries = true;
+
+    if (write(_writer_fd, &val, sizeof(val)) != sizeof(val)) {
         return;
     }
 
-    char *str = (char *)malloc(MAX_MSG_SIZE);
-    if (str == NULL) {
-        return;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += FLUSH_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&_lock);
+    while (_written_cnt < cnt) {
+        if (pthread_cond_timedwait(&_cond, &_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+/* writer thread (or, without it, the logging thread with the lock held) */
+void Logger::write_records()
+{
+    static char batch[CONSOLE_BATCH_SIZE];
+    struct log_record *rec;
+    FILE *stream = NULL;
+    size_t len = 0;
+    bool wake_main_loop = false;
+    uint64_t now = now_ns();
+
+    while ((rec = _records.front()) != NULL) {
+
+        if (_console_enabled && rec->len > 0) {
+            FILE *rec_stream = (rec->level == ERROR) ? stderr : stdout;
+            /* keeps the order of messages across the two streams */
+            if (rec_stream != stream || len + rec->len + 1 > sizeof(batch)) {
+                if (len > 0) {
+                    fwrite(batch, 1, len, stream);
+                }
+                stream = rec_stream;
+                len = 0;
+            }
+            memcpy(batch + len, rec->msg, rec->len);
+            len += rec->len;
+            batch[len++] = '\n';
+        }
+
+        if (rec->to_agent && rec->len > 0) {
+            if (forward_to_agent(rec, now)) {
+                wake_main_loop = true;
+            }
+        }
+
+        _records.pop();
+
+    }
+
+    if (len > 0) {
+        fwrite(batch, 1, len, stream);
+    }
+
+    if (report_summaries(now, _force_summaries.exchange(false))) {
+        wake_main_loop = true;
+    }
+
+    if (_agent_batch_cnt > 0 &&
+            now_ns() - _agent_batch_since_ns >= LOG_AGENT_BATCH_DELAY_MS * NSEC_PER_MSEC) {
+        wake_main_loop = true;
+    }
+
+    if (wake_main_loop) {
+        uint64_t val = 1;
+        /* the main loop takes everything handed on so far */
+        _agent_batch_cnt = 0;
+        _agent_batch_bytes = 0;
+        if (write(_agent_fd, &val, sizeof(val)) != sizeof(val)) {
+            out_console(ERROR, "Logger: failed to wake main loop");
+        }
+    }
+
+    report_overflows();
+}
+
+/* returns true if the main loop needs to be woken up */
+bool Logger::forward_to_agent(struct log_record *rec, uint64_t now)
+{
+    bool wake_main_loop = false;
+
+    if (rec->level == _last_agent_record.level && rec->len == _last_agent_record.len &&
+            memcmp(rec->msg, _last_agent_record.msg, rec->len) == 0) {
+        if (_repeat_cnt++ == 0) {
+            _repeat_since_ns = now;
+        }
+        _repeated_cnt++;
+        return false;
+    }
+
+    wake_main_loop = report_repeats();
+
+    if (!take_token(rec, now)) {
+        return wake_main_loop;
+    }
+
+    memcpy(&_last_agent_record, rec, offsetof(struct log_record, msg) + rec->len + 1);
+
+    return push_agent_record(rec) || wake_main_loop;
+}
+
+bool Logger::take_token(struct log_record *rec, uint64_t now)
+{
+    struct log_site &site = _sites[rec->site];
+
+    if (site.last_ns == 0) {
+        site.tokens = LOG_AGENT_RATE_BURST;
+    } else {
+        site.tokens += (double)(now - site.last_ns) * LOG_AGENT_RATE_PER_SEC / NSEC_PER_SEC;
+        if (site.tokens > LOG_AGENT_RATE_BURST) {
+            site.tokens = LOG_AGENT_RATE_BURST;
+        }
+    }
+    site.last_ns = now;
+    site.level = rec->level;
+
+    if (site.tokens >= 1) {
+        site.tokens -= 1;
+        return true;
+    }
+
+    if (site.suppressed_cnt++ == 0) {
+        site.suppressed_since_ns = now;
+        _suppressed_site_cnt++;
+    }
+    _rate_limited_cnt++;
+
+    return false;
+}
+
+bool Logger::report_repeats()
+{
+    uint32_t cnt = _repeat_cnt;
+
+    if (cnt == 0) {
+        return false;
+    }
+    _repeat_cnt = 0;
+
+    return push_agent_message((LogLevel)_last_agent_record.level,
+        "Last message repeated %u times", cnt);
+}
+
+bool Logger::has_summaries()
+{
+    return _repeat_cnt > 0 || _suppressed_site_cnt > 0;
+}
+
+int Logger::get_writer_timeout()
+{
+    if (_agent_batch_cnt > 0) {
+        return LOG_AGENT_BATCH_DELAY_MS;
+    }
+    if (has_summaries()) {
+        return LOG_SUMMARY_INTERVAL_MS / 5;
+    }
+
+    return -1;
+}
+
+/* reports the repeats and suppressed messages counted for long enough */
+bool Logger::report_summaries(uint64_t now, bool force)
+{
+    uint64_t interval_ns = LOG_SUMMARY_INTERVAL_MS * NSEC_PER_MSEC;
+    bool wake_main_loop = false;
+
+    if (_repeat_cnt > 0 && (force || now - _repeat_since_ns >= interval_ns)) {
+        wake_main_loop = report_repeats();
+    }
+
+    if (_suppressed_site_cnt == 0) {
+        return wake_main_loop;
     }
 
+    unordered_map<const char *, struct log_site>::iterator it;
+    for (it = _sites.begin(); it != _sites.end(); it++) {
+        struct log_site &site = it->second;
+        if (site.suppressed_cnt == 0 ||
+                (!force && now - site.suppressed_since_ns < interval_ns)) {
+            continue;
+        }
+        if (push_agent_message((LogLevel)site.level, "%u messages like \"%.*s\" suppressed",
+                site.suppressed_cnt, SUMMARY_SITE_LEN, it->first)) {
+            wake_main_loop = true;
+        }
+        site.suppressed_cnt = 0;
+        _suppressed_site_cnt--;
+    }
+
+    return wake_main_loop;
+}
+
+/* returns true if the main loop needs to be woken up to send the batch */
+bool Logger::push_agent_record(struct log_record *rec)
+{
+    if (!_agent_records.push(*rec)) {
+        return false;
+    }
+
+    if (_agent_batch_cnt++ == 0) {
+        _agent_batch_since_ns = now_ns();
+    }
+    _agent_batch_bytes += rec->len;
+
+    return rec->level == ERROR ||
+        _agent_batch_cnt >= LOG_AGENT_BATCH_CNT ||
+        _agent_batch_bytes >= LOG_AGENT_BATCH_BYTES ||
+        /* don't leave the main loop behind with a full ring */
+        _agent_batch_cnt >= _agent_records.get_capacity() / 2;
+}
+
+bool Logger::push_agent_message(LogLevel level, const char *fmt, ...)
+{
+    struct log_record rec;
+    struct timespec ts;
     va_list ap;
+    int size;
+
     va_start(ap, fmt);
-    int size = vsnprintf(str, MAX_MSG_SIZE-1, fmt, ap);
+    size = vsnprintf(rec.msg, sizeof(rec.msg), fmt, ap);
     va_end(ap);
     if (size < 0) {
-       free(str);
-       return;
+        return false;
     }
-    if (str[size-1] == '\n') {
-        str[size-1] = '\0';
+
+    rec.site = NULL;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec.ts = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / NSEC_PER_MSEC;
+    rec.level = level;
+    rec.to_agent = true;
+    rec.len = ((size_t)size < sizeof(rec.msg)) ? size : sizeof(rec.msg) - 1;
+
+    return push_agent_record(&rec);
+}
+
+uint64_t Logger::get_rate_limited_cnt()
+{
+    return _rate_limited_cnt.load(std::memory_order_relaxed);
+}
+
+uint64_t Logger::get_repeated_cnt()
+{
+    return _repeated_cnt.load(std::memory_order_relaxed);
+}
+
+void Logger::report_overflows()
+{
+    uint32_t cnt = _records.get_overflow_cnt();
+    uint32_t agent_cnt = _agent_records.get_overflow_cnt();
+    char msg[128];
+
+    if (cnt != _reported_overflow_cnt) {
+        snprintf(msg, sizeof(msg), "Logger: %u messages dropped (log full)",
+            cnt - _reported_overflow_cnt);
+        out_console(ERROR, msg);
+        _reported_overflow_cnt = cnt;
+    }
+    /* reported once the main loop has caught up, rather than for each batch */
+    if (agent_cnt != _reported_agent_overflow_cnt && _agent_records.is_empty()) {
+        snprintf(msg, sizeof(msg), "Logger: %u messages not sent to agent (queue full)",
+            agent_cnt - _reported_agent_overflow_cnt);
+        out_console(ERROR, msg);
+        _reported_agent_overflow_cnt = agent_cnt;
     }
+}
 
-    out_console(level, str);
-    out_agent(level, str);
+void Logger::out_console(LogLevel level, const char *msg)
+{
+    if (_console_enabled) {
+        fprintf((level == ERROR) ? stderr : stdout, "%s\n", msg);
+    }
+}
+
+void Logger::run()
+{
+    struct agent_log_entry entries[LOG_AGENT_BATCH_CNT];
+    struct log_record *rec;
+    bool connected = _agent && _agent->is_connected();
+    bool batch = connected && _agent->supports_log_batches();
+    bool flush = false;
+    size_t cnt = 0;
+    uint64_t val;
 
-    free(str);
+    /* reset before draining, so that later records wake us up again */
+    if (read(_agent_fd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+        return;
+    }
+
+    while (_agent_records.pop(_agent_batch[cnt])) {
+        rec = &_agent_batch[cnt];
+        if (!connected) {
+            continue;
+        }
+        if (rec->level == ERROR) {
+            flush = true;
+        }
+        if (!batch) {
+            _agent->send_log_message(log_level_str[rec->level], "Mbed Cloud", rec->msg);
+            continue;
+        }
+        entries[cnt].level = log_level_str[rec->level];
+        entries[cnt].ts = rec->ts;
+        entries[cnt].message = rec->msg;
+        if (++cnt == LOG_AGENT_BATCH_CNT) {
+            _agent->send_log_messages("Mbed Cloud", entries, cnt);
+            cnt = 0;
+        }
+    }
+    if (cnt > 0) {
+        _agent->send_log_messages("Mbed Cloud", entries, cnt);
+    }
+
+    if (flush) {
+        _agent->flush();
+    }
 }
 
-void Logger::log_console(LogLevel level, const char *fmt, ...)
+void Logger::vlog(LogLevel level, bool to_agent, const char *site, const char *fmt, va_list ap)
 {
+    struct log_record *rec = NULL;
+    char recorder_msg[sizeof(rec->msg)];
+    struct timespec ts;
+    char *msg;
+    int size;
+
     if (level > ERROR) {
         return;
     }
-    if (level < _level) {
+    if (!is_enabled(level, to_agent)) {
         return;
     }
 
-    char *str = (char *)malloc(MAX_MSG_SIZE);
-    if (str == NULL) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    /*
+     * the flight recorder gets every message, so those for it alone are
+     * formatted on the stack. if the ring is full, the writer reports the
+     * overflow.
+     */
+    if (level >= _level && (_console_enabled || to_agent)) {
+        rec = _records.claim();
+    }
+    if (!rec && !_recorder) {
         return;
     }
+    msg = rec ? rec->msg : recorder_msg;
 
-    va_list ap;
-    va_start(ap, fmt);
-    int size = vsnprintf(str, MAX_MSG_SIZE-1, fmt, ap);
-    va_end(ap);
+    size = vsnprintf(msg, sizeof(rec->msg), fmt, ap);
     if (size < 0) {
-       free(str);
-       return;
+        size = 0;
+        msg[0] = '\0';
+    } else if ((size_t)size >= sizeof(rec->msg)) {
+        size = sizeof(rec->msg) - 1;
+        memcpy(msg + size - strlen(TRUNCATION_MARKER), TRUNCATION_MARKER,
+            strlen(TRUNCATION_MARKER));
+    }
+    if (size > 0 && msg[size-1] == '\n') {
+        msg[--size] = '\0';
+    }
+
+    CONNECTOR_PROBE3(logger_emit, (int)level, site, msg);
+
+    if (_recorder) {
+        _recorder->write(level, (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec, msg, size);
+    }
+    if (!rec) {
+        return;
+    }
+
+    rec->site = site;
+    rec->ts = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / NSEC_PER_MSEC;
+    rec->level = level;
+    rec->to_agent = to_agent;
+    rec->len = size;
+
+    if (!_records.publish(rec)) {
+        return;
     }
-    if (str[size-1] == '\n') {
-        str[size-1] = '\0';
+
+    /* the writer had caught up, so it may be waiting */
+    if (_writer_started) {
+        uint64_t val = 1;
+        if (write(_writer_fd, &val, sizeof(val)) != sizeof(val)) {
+            return;
+        }
+    } else {
+        pthread_mutex_lock(&_lock);
+        write_records();
+        _written_cnt = _records.get_popped_cnt();
+        pthread_mutex_unlock(&_lock);
     }
+}
+
+void Logger::log(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
 
-    out_console(level, str);
+    va_start(ap, fmt);
+    vlog(level, _agent != NULL, fmt, fmt, ap);
+    va_end(ap);
+}
 
-    free(str);
+void Logger::log_console(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vlog(level, false, fmt, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::log_relayed(const char *site, LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vlog(level, _agent != NULL, site, fmt, ap);
+    va_end(ap);
 }
@@ -2,8 +2,14 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdarg.h>
 #include <pthread.h>
+#include <atomic>
+#include <unordered_map>
 #include "enebular_agent_interface.h"
+#include "mpsc_ring.h"
+#include "spsc_ring.h"
+#include "flight_recorder.h"
 
 enum LogLevel {
     DEBUG   = 0,
@@ -11,6 +17,81 @@ enum LogLevel {
     ERROR   = 2
 };
 
+/*
+ * Messages below this level are compiled out (0: DEBUG, 1: INFO, 2: ERROR),
+ * for example with -DLOGGER_MIN_LEVEL=1 to build without debug logging.
+ */
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL        (0)
+#endif
+
+/**
+ * Log with Logger::log(), only evaluating the arguments (and formatting the
+ * message) if the message will be logged.
+ */
+#define LOGGER_LOG(logger, level, ...) \
+    do { \
+        if ((level) >= LOGGER_MIN_LEVEL && (logger)->is_enabled((level), true)) { \
+            (logger)->log((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * Log with Logger::log_console(), only evaluating the arguments (and
+ * formatting the message) if the message will be logged.
+ */
+#define LOGGER_LOG_CONSOLE(logger, level, ...) \
+    do { \
+        if ((level) >= LOGGER_MIN_LEVEL && (logger)->is_enabled((level), false)) { \
+            (logger)->log_console((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/* size of a log record, which limits the length of a message */
+#define LOG_RECORD_SIZE         (512)
+/* capacity of the ring of log records waiting to be written */
+#define LOG_RING_SIZE           (1024)
+/* capacity of the ring of log records waiting to be sent to the agent */
+#define LOG_AGENT_RING_SIZE     (256)
+/* messages each call site may send to the agent in a burst, and per second after */
+#define LOG_AGENT_RATE_BURST    (10)
+#define LOG_AGENT_RATE_PER_SEC  (1)
+/* how long suppressed or repeated messages are counted before being reported */
+#define LOG_SUMMARY_INTERVAL_MS (5000)
+/*
+ * messages for the agent are sent in batches of up to this many messages or
+ * bytes, or after this delay (ERROR messages are sent immediately)
+ */
+#define LOG_AGENT_BATCH_CNT     (64)
+#define LOG_AGENT_BATCH_BYTES   (16 * 1024)
+#define LOG_AGENT_BATCH_DELAY_MS (250)
+
+/**
+ * The connector's logger.
+ *
+ * Logging is asynchronous. A message is formatted straight into a fixed-size
+ * record in a lock-free ring shared by all threads, and a writer thread writes
+ * the records to the console in batches. The records to also be sent to the
+ * agent are handed on to the connector's main loop (via the file descriptor
+ * returned by get_fd()), as the agent interface may only be used from there.
+ *
+ * If the ring is full, messages are dropped (and the number dropped is
+ * logged), so logging never blocks.
+ *
+ * If enabled, every message of every level (that is compiled in) is also
+ * written straight into a flight recorder file by the thread logging it, so
+ * that the latest messages can be recovered after a crash.
+ *
+ * To keep log storms (such as a flapping connection's) from flooding the
+ * agent, the messages sent to it are rate limited per call site (format
+ * string) with a token bucket, and repeats of the last message sent are
+ * collapsed into a "repeated N times" message. The console still gets every
+ * message.
+ *
+ * The messages for the agent are also batched. The main loop is only woken up
+ * to send them when a batch is full or old enough, or has an ERROR message in
+ * it, and then sends them as one message if the agent supports it.
+ */
 class Logger {
 
 public:
@@ -43,10 +124,38 @@ public:
      */
     void enable_console(bool enable);
 
+    /**
+     * Checks if a message would be logged, so that its arguments need not be
+     * evaluated if not (see LOGGER_LOG()).
+     *
+     * @param level    Log level
+     * @param to_agent Whether the message would also go to the agent (log())
+     * @return True if the message would be logged
+     */
+    bool is_enabled(LogLevel level, bool to_agent) const
+    {
+        if (level < LOGGER_MIN_LEVEL) {
+            return false;
+        }
+        return _recorder ||
+            (level >= _level && (_console_enabled || (to_agent && _agent)));
+    }
+
+    /**
+     * Record all messages, of every level, in a flight recorder file.
+     *
+     * This is meant to be called once, before logging from other threads.
+     *
+     * @param path Flight recorder file path
+     * @param size Flight recorder size
+     * @return False if the flight recorder could not be opened
+     */
+    bool enable_recorder(const char *path, size_t size);
+
     /**
      * Log to all destinations (both agent and console).
      *
-     * This is not thread-safe (can only be called from the main thread).
+     * This is thread-safe (can be called from any thread).
      */
     void log(LogLevel level, const char *fmt, ...);
 
@@ -57,17 +166,134 @@ public:
      */
     void log_console(LogLevel level, const char *fmt, ...);
 
+    /**
+     * Log to all destinations, for messages relayed from another source (such
+     * as mbed-trace) with a format shared by many call sites.
+     *
+     * The agent rate limit is applied per site, instead of per format.
+     *
+     * This is thread-safe (can be called from any thread).
+     *
+     * @param site  Call site (a string that stays valid, quoted in the
+     *              agent rate limit reports)
+     * @param level Log level
+     */
+    void log_relayed(const char *site, LogLevel level, const char *fmt, ...);
+
+    /**
+     * Wait for all messages logged so far to be written to the console (and
+     * handed on for the agent).
+     *
+     * This is also done at exit.
+     */
+    void flush();
+
+    /**
+     * Get the file descriptor that becomes readable when there are messages
+     * to send to the agent.
+     *
+     * The connector waits on this in its main loop and then calls run().
+     *
+     * @return The file descriptor, or -1 if there is none
+     */
+    int get_fd();
+
+    /**
+     * Sends the messages waiting to be sent to the agent.
+     *
+     * This is designed to be run from the connector's main loop and it will not
+     * block.
+     */
+    void run();
+
+    /**
+     * Get the number of messages not sent to the agent due to rate limiting.
+     */
+    uint64_t get_rate_limited_cnt();
+
+    /**
+     * Get the number of messages not sent to the agent due to being repeats.
+     */
+    uint64_t get_repeated_cnt();
+
 private:
 
+    struct log_record {
+        /* the call site (format string) */
+        const char *site;
+        /* when it was logged, in ms since the epoch */
+        uint64_t ts;
+        uint8_t level;
+        bool to_agent;
+        uint16_t len;
+        char msg[LOG_RECORD_SIZE - sizeof(const char *) - sizeof(uint64_t) - 4];
+    };
+
+    /* a call site's agent rate limit state (writer thread only) */
+    struct log_site {
+        uint8_t level;
+        double tokens;
+        uint64_t last_ns;
+        uint32_t suppressed_cnt;
+        uint64_t suppressed_since_ns;
+    };
+
     static Logger *_instance;
     LogLevel _level;
     bool _console_enabled;
     EnebularAgentInterface *_agent;
+    FlightRecorder *_recorder;
+
+    /* written by all threads, read by the writer thread */
+    MpscRing<struct log_record> _records;
+    /* written by the writer thread, read by the main loop */
+    SpscRing<struct log_record> _agent_records;
+
+    pthread_t _writer;
+    bool _writer_started;
+    int _writer_fd;
+    int _agent_fd;
+    uint32_t _reported_overflow_cnt;
+    uint32_t _reported_agent_overflow_cnt;
+
+    /* agent rate limiting and repeat collapsing (writer thread only) */
+    unordered_map<const char *, struct log_site> _sites;
+    uint32_t _suppressed_site_cnt;
+    struct log_record _last_agent_record;
+    uint32_t _repeat_cnt;
+    uint64_t _repeat_since_ns;
+    std::atomic<bool> _force_summaries;
+    std::atomic<uint32_t> _rate_limited_cnt;
+    std::atomic<uint32_t> _repeated_cnt;
+
+    /* the batch handed on to the main loop so far (writer thread only) */
+    uint32_t _agent_batch_cnt;
+    size_t _agent_batch_bytes;
+    uint64_t _agent_batch_since_ns;
+
+    /* the batch being sent (main loop only) */
+    struct log_record _agent_batch[LOG_AGENT_BATCH_CNT];
+
+    /* for flush() */
     pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    size_t _written_cnt;
 
     Logger();
+    static void *writer_main(void *arg);
+    static void flush_at_exit();
+    void vlog(LogLevel level, bool to_agent, const char *site, const char *fmt, va_list ap);
+    void write_records();
+    bool forward_to_agent(struct log_record *rec, uint64_t now);
+    bool take_token(struct log_record *rec, uint64_t now);
+    bool report_repeats();
+    bool report_summaries(uint64_t now, bool force);
+    bool has_summaries();
+    int get_writer_timeout();
+    bool push_agent_record(struct log_record *rec);
+    bool push_agent_message(LogLevel level, const char *fmt, ...);
+    void report_overflows();
     void out_console(LogLevel level, const char *msg);
-    void out_agent(LogLevel level, const char *msg);
 
 };
 
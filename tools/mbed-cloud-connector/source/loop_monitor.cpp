@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include "loop_monitor.h"
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+LoopMonitor::LoopMonitor(Metrics *metrics):
+    _logger(Logger::get_instance()),
+    _budget_cnt(0),
+    _default_budget_us(LOOP_MONITOR_DEFAULT_BUDGET_MS * 1000),
+    _min_budget_us(LOOP_MONITOR_DEFAULT_BUDGET_MS * 1000),
+    _handler_name(NULL),
+    _handler_start_us(0),
+    _pass_start_us(0),
+    _running_handler(NULL),
+    _reported_pass_us(0),
+    _stall_ms(0),
+    _watchdog_idle(false),
+    _watchdog_started(false),
+    _watchdog_stop(false)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    _overruns = metrics->add_counter(METRICS_PREFIX "loop_budget_overruns_total",
+        "Main loop handler invocations that exceeded their time budget");
+    _stalls = metrics->add_counter(METRICS_PREFIX "loop_stalls_total",
+        "Main loop passes reported by the watchdog as stalled");
+}
+
+LoopMonitor::~LoopMonitor()
+{
+    stop_watchdog();
+
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_lock);
+}
+
+bool LoopMonitor::set_budgets(const char *budgets)
+{
+    struct budget parsed[LOOP_MONITOR_MAX_BUDGETS];
+    uint64_t default_budget_us = _default_budget_us;
+    int cnt = 0;
+    const char *p = budgets;
+
+    while (*p != '\0') {
+        const char *end = strchr(p, ',');
+        const char *eq;
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        unsigned long ms;
+        char *num_end;
+
+        eq = (const char *)memchr(p, '=', len);
+        ms = strtoul(eq ? eq + 1 : p, &num_end, 10);
+        if (num_end != p + len || num_end == (eq ? eq + 1 : p)) {
+            return false;
+        }
+
+        if (eq) {
+            size_t name_len = eq - p;
+            if (name_len == 0 || name_len > LOOP_MONITOR_MAX_NAME_LEN ||
+                    cnt == LOOP_MONITOR_MAX_BUDGETS) {
+                return false;
+            }
+            memcpy(parsed[cnt].name, p, name_len);
+            parsed[cnt].name[name_len] = '\0';
+            parsed[cnt].budget_us = (uint64_t)ms * 1000;
+            cnt++;
+        } else {
+            default_budget_us = (uint64_t)ms * 1000;
+        }
+
+        if (!end) {
+            break;
+        }
+        p = end + 1;
+    }
+
+    memcpy(_budgets, parsed, cnt * sizeof(parsed[0]));
+    _budget_cnt = cnt;
+    _default_budget_us = default_budget_us;
+    update_min_budget();
+
+    return true;
+}
+
+/* a budget of 0 is no budget */
+void LoopMonitor::update_min_budget()
+{
+    _min_budget_us = _default_budget_us ? _default_budget_us : UINT64_MAX;
+
+    for (int i = 0; i < _budget_cnt; i++) {
+        if (_budgets[i].budget_us && _budgets[i].budget_us < _min_budget_us) {
+            _min_budget_us = _budgets[i].budget_us;
+        }
+    }
+}
+
+uint64_t LoopMonitor::get_budget(const char *name)
+{
+    for (int i = 0; i < _budget_cnt; i++) {
+        if (strcmp(_budgets[i].name, name) == 0) {
+            return _budgets[i].budget_us;
+        }
+    }
+
+    return _default_budget_us;
+}
+
+void LoopMonitor::pass_begin()
+{
+    _pass_start_us.store(now_us(), std::memory_order_seq_cst);
+
+    /* wake the watchdog to arm the pass's deadline, if it is waiting for one */
+    if (_watchdog_idle.load(std::memory_order_seq_cst)) {
+        pthread_mutex_lock(&_lock);
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_lock);
+    }
+}
+
+void LoopMonitor::pass_end()
+{
+    uint64_t start = _pass_start_us.exchange(0, std::memory_order_acq_rel);
+
+    if (start && _reported_pass_us.load(std::memory_order_acquire) == start) {
+        _logger->log(INFO, "Loop: recovered from stall after %llu ms",
+            (unsigned long long)((now_us() - start) / 1000));
+    }
+}
+
+void LoopMonitor::handler_begin(const char *name)
+{
+    _handler_name = name;
+    _handler_start_us = now_us();
+    _running_handler.store(name, std::memory_order_release);
+}
+
+void LoopMonitor::handler_end()
+{
+    uint64_t elapsed_us = now_us() - _handler_start_us;
+    uint64_t budget_us;
+
+    _running_handler.store(NULL, std::memory_order_release);
+
+    if (elapsed_us <= _min_budget_us) {
+        return;
+    }
+
+    budget_us = get_budget(_handler_name);
+    if (budget_us && elapsed_us > budget_us) {
+        _overruns->inc();
+        _logger->log(INFO, "Loop: %s took %llu.%03llu ms (budget %llu ms)", _handler_name,
+            (unsigned long long)(elapsed_us / 1000), (unsigned long long)(elapsed_us % 1000),
+            (unsigned long long)(budget_us / 1000));
+    }
+}
+
+bool LoopMonitor::start_watchdog(uint32_t stall_ms)
+{
+    if (_watchdog_started) {
+        return true;
+    }
+
+    _stall_ms = stall_ms;
+    _watchdog_stop = false;
+
+    if (pthread_create(&_watchdog, NULL, watchdog_main, this) != 0) {
+        _logger->log_console(ERROR, "Loop: failed to start watchdog thread");
+        return false;
+    }
+    _watchdog_started = true;
+
+    return true;
+}
+
+void LoopMonitor::stop_watchdog()
+{
+    if (!_watchdog_started) {
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _watchdog_stop = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_lock);
+
+    pthread_join(_watchdog, NULL);
+    _watchdog_started = false;
+}
+
+/*
+ * The watchdog only wakes up at the stall deadline of a running pass. While
+ * there is no pass to watch (the loop is waiting, or the pass has already been
+ * reported) it waits without a timeout, so an idle loop does not wake it, and
+ * the next pass_begin() wakes it up.
+ */
+void *LoopMonitor::watchdog_main(void *arg)
+{
+    LoopMonitor *monitor = (LoopMonitor *)arg;
+    struct timespec deadline;
+    uint64_t start;
+    uint64_t deadline_us;
+    sigset_t mask;
+
+    /* signals are left to the main thread */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    pthread_setname_np(pthread_self(), "watchdog");
+
+    pthread_mutex_lock(&monitor->_lock);
+    while (!monitor->_watchdog_stop) {
+
+        start = monitor->_pass_start_us.load(std::memory_order_seq_cst);
+        if (!start || monitor->_reported_pass_us.load(std::memory_order_relaxed) == start) {
+            /* re-check after going idle so a pass_begin() in between is not missed */
+            monitor->_watchdog_idle.store(true, std::memory_order_seq_cst);
+            if (monitor->_pass_start_us.load(std::memory_order_seq_cst) == start) {
+                pthread_cond_wait(&monitor->_cond, &monitor->_lock);
+            }
+            monitor->_watchdog_idle.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        deadline_us = start + (uint64_t)monitor->_stall_ms * 1000;
+        deadline.tv_sec = deadline_us / 1000000;
+        deadline.tv_nsec = (deadline_us % 1000000) * 1000;
+        if (pthread_cond_timedwait(&monitor->_cond, &monitor->_lock, &deadline) != ETIMEDOUT) {
+            continue;
+        }
+
+        pthread_mutex_unlock(&monitor->_lock);
+        monitor->check_stall();
+        pthread_mutex_lock(&monitor->_lock);
+    }
+    pthread_mutex_unlock(&monitor->_lock);
+
+    return NULL;
+}
+
+/* watchdog thread. each stalled pass is reported once. */
+void LoopMonitor::check_stall()
+{
+    uint64_t start = _pass_start_us.load(std::memory_order_acquire);
+    const char *handler;
+    uint64_t elapsed_ms;
+
+    if (!start || _reported_pass_us.load(std::memory_order_relaxed) == start) {
+        return;
+    }
+
+    elapsed_ms = (now_us() - start) / 1000;
+    if (elapsed_ms < _stall_ms) {
+        return;
+    }
+
+    _reported_pass_us.store(start, std::memory_order_release);
+    _stalls->inc();
+
+    handler = _running_handler.load(std::memory_order_acquire);
+    _logger->log(ERROR, "Loop: stalled for %llu ms (in %s)", (unsigned long long)elapsed_ms,
+        handler ? handler : "between handlers");
+}
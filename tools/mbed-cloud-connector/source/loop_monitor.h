@@ -0,0 +1,130 @@
+#ifndef LOOP_MONITOR_H
+#define LOOP_MONITOR_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "logger.h"
+#include "metrics.h"
+
+/* default time budget of a handler invocation */
+#define LOOP_MONITOR_DEFAULT_BUDGET_MS  (100)
+/* default time a loop pass can take before the watchdog reports a stall */
+#define LOOP_MONITOR_DEFAULT_STALL_MS   (2000)
+/* maximum number of handlers with their own budget */
+#define LOOP_MONITOR_MAX_BUDGETS        (16)
+#define LOOP_MONITOR_MAX_NAME_LEN       (31)
+
+/**
+ * Monitors a main loop for handlers that block it.
+ *
+ * Each handler invocation is timed against its budget (the default budget,
+ * or its own if it has one), and budget overruns are logged with the
+ * handler's name and the time it took. A watchdog thread also reports when a
+ * loop pass is taking longer than the stall time, while it is still stuck,
+ * along with the handler that is running.
+ *
+ * Other than the watchdog, this must only be used from the loop's thread.
+ */
+class LoopMonitor {
+
+public:
+
+    /**
+     * Constructor
+     *
+     * @param metrics Metrics to add the monitor's metrics to
+     */
+    LoopMonitor(Metrics *metrics);
+
+    /**
+     * Deconstructor
+     */
+    ~LoopMonitor();
+
+    /**
+     * Set the handler budgets.
+     *
+     * @param budgets Comma-separated budgets in ms, each either the default
+     *                budget ("50") or a handler's own ("client=200"). A budget
+     *                of 0 disables the check.
+     * @return False if the budgets are invalid (nothing is changed)
+     */
+    bool set_budgets(const char *budgets);
+
+    /**
+     * Start the watchdog thread.
+     *
+     * @param stall_ms Time a loop pass can take before it is reported
+     * @return False if the thread could not be started
+     */
+    bool start_watchdog(uint32_t stall_ms);
+
+    /**
+     * Stop the watchdog thread.
+     */
+    void stop_watchdog();
+
+    /**
+     * Notify the monitor that the loop has started a pass (has events to
+     * handle).
+     */
+    void pass_begin();
+
+    /**
+     * Notify the monitor that the loop has finished a pass (and is going back
+     * to waiting).
+     */
+    void pass_end();
+
+    /**
+     * Notify the monitor that a handler is being called.
+     *
+     * @param name Handler name (static string)
+     */
+    void handler_begin(const char *name);
+
+    /**
+     * Notify the monitor that the handler has returned.
+     */
+    void handler_end();
+
+private:
+
+    struct budget {
+        char name[LOOP_MONITOR_MAX_NAME_LEN + 1];
+        uint64_t budget_us;
+    };
+
+    Logger *_logger;
+    struct budget _budgets[LOOP_MONITOR_MAX_BUDGETS];
+    int _budget_cnt;
+    uint64_t _default_budget_us;
+    /* the smallest budget, so most invocations need no lookup */
+    uint64_t _min_budget_us;
+    const char *_handler_name;
+    uint64_t _handler_start_us;
+    MetricCounter *_overruns;
+    MetricCounter *_stalls;
+
+    /* the following are shared with the watchdog */
+    std::atomic<uint64_t> _pass_start_us;
+    std::atomic<const char *> _running_handler;
+    std::atomic<uint64_t> _reported_pass_us;
+    uint32_t _stall_ms;
+    /* the watchdog is waiting for a pass to start */
+    std::atomic<bool> _watchdog_idle;
+    bool _watchdog_started;
+    bool _watchdog_stop;
+    pthread_t _watchdog;
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+
+    uint64_t get_budget(const char *name);
+    void update_min_budget();
+    static void *watchdog_main(void *arg);
+    void check_stall();
+
+};
+
+#endif // LOOP_MONITOR_H
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "mbed-trace/mbed_trace.h"
+#include "mbed_trace_bridge.h"
+
+#define SITE_PREFIX     "Trace"
+
+Logger *MbedTraceBridge::_logger = NULL;
+uint8_t MbedTraceBridge::_level_mask = TRACE_ACTIVE_LEVEL_WARN;
+char MbedTraceBridge::_filter[MBED_TRACE_BRIDGE_FILTER_LEN];
+bool MbedTraceBridge::_filter_has_includes = false;
+struct MbedTraceBridge::trace_group MbedTraceBridge::_groups[MBED_TRACE_BRIDGE_MAX_GROUPS];
+int MbedTraceBridge::_group_cnt = 0;
+struct MbedTraceBridge::trace_group MbedTraceBridge::_other_group = {
+    "", SITE_PREFIX " [other]", true
+};
+
+static const struct {
+    const char *name;
+    uint8_t mask;
+} trace_levels[] = {
+    { "debug",  TRACE_ACTIVE_LEVEL_ALL },
+    { "info",   TRACE_ACTIVE_LEVEL_INFO },
+    { "warn",   TRACE_ACTIVE_LEVEL_WARN },
+    { "error",  TRACE_ACTIVE_LEVEL_ERROR },
+    { "none",   TRACE_ACTIVE_LEVEL_NONE },
+};
+
+bool MbedTraceBridge::set_level(const char *level)
+{
+    for (size_t i = 0; i < sizeof(trace_levels) / sizeof(trace_levels[0]); i++) {
+        if (strcasecmp(level, trace_levels[i].name) == 0) {
+            _level_mask = trace_levels[i].mask;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MbedTraceBridge::set_groups(const char *groups)
+{
+    const char *name;
+
+    if (strlen(groups) >= sizeof(_filter)) {
+        return false;
+    }
+    strcpy(_filter, groups);
+
+    _filter_has_includes = false;
+    for (name = _filter; *name; name += strcspn(name, ",")) {
+        name += strspn(name, ",");
+        if (*name && *name != '-') {
+            _filter_has_includes = true;
+        }
+    }
+
+    return true;
+}
+
+bool MbedTraceBridge::is_group_enabled(const char *name)
+{
+    size_t name_len = strlen(name);
+    bool enabled = !_filter_has_includes;
+    const char *entry = _filter;
+
+    while (*entry) {
+        size_t len = strcspn(entry, ",");
+        bool exclude = (*entry == '-');
+        const char *entry_name = exclude ? entry + 1 : entry;
+        size_t entry_len = exclude ? len - 1 : len;
+
+        if (entry_len == name_len && strncmp(entry_name, name, name_len) == 0) {
+            /* an exclusion wins over an inclusion */
+            if (exclude) {
+                return false;
+            }
+            enabled = true;
+        }
+        entry += len;
+        entry += strspn(entry, ",");
+    }
+
+    return enabled;
+}
+
+struct MbedTraceBridge::trace_group *MbedTraceBridge::find_group(const char *name)
+{
+    struct trace_group *group;
+
+    for (int i = 0; i < _group_cnt; i++) {
+        if (strcmp(_groups[i].name, name) == 0) {
+            return &_groups[i];
+        }
+    }
+    if (_group_cnt == MBED_TRACE_BRIDGE_MAX_GROUPS) {
+        return NULL;
+    }
+
+    group = &_groups[_group_cnt++];
+    strcpy(group->name, name);
+    snprintf(group->site, sizeof(group->site), SITE_PREFIX " [%s]", name);
+    group->enabled = is_group_enabled(name);
+
+    return group;
+}
+
+/*
+ * Called by mbed-trace with its mutex held, so the groups need no locking of
+ * their own.
+ */
+void MbedTraceBridge::print(const char *str)
+{
+    char name[MBED_TRACE_BRIDGE_GROUP_LEN + 1] = "";
+    struct trace_group *group;
+    LogLevel level = DEBUG;
+    const char *msg = str;
+
+    /* "[LEVL][grp ]: message" (command traces have no prefix) */
+    if (str[0] == '[' && strlen(str) > 7 && str[5] == ']' && str[6] == '[') {
+        const char *grp = str + 7;
+        const char *end = strstr(grp, "]: ");
+        if (end) {
+            size_t len = end - grp;
+            while (len > 0 && grp[len-1] == ' ') {
+                len--;
+            }
+            if (len > MBED_TRACE_BRIDGE_GROUP_LEN) {
+                len = MBED_TRACE_BRIDGE_GROUP_LEN;
+            }
+            memcpy(name, grp, len);
+            name[len] = '\0';
+            msg = end + 3;
+
+            if (strncmp(str + 1, "ERR ", 4) == 0) {
+                level = ERROR;
+            } else if (strncmp(str + 1, "WARN", 4) == 0) {
+                level = INFO;
+            }
+        }
+    }
+
+    group = find_group(name);
+    if (!group) {
+        if (!is_group_enabled(name)) {
+            return;
+        }
+        group = &_other_group;
+    } else if (!group->enabled) {
+        return;
+    }
+
+    _logger->log_relayed(group->site, level, "%s: %s", group->site, msg);
+}
+
+void MbedTraceBridge::start(Logger *logger)
+{
+    uint8_t mask = _level_mask;
+
+    _logger = logger;
+
+    /* no point in formatting traces that would be dropped */
+    if (!logger->is_enabled(DEBUG, true)) {
+        mask &= ~(TRACE_LEVEL_INFO | TRACE_LEVEL_DEBUG | TRACE_LEVEL_CMD);
+    }
+    if (!logger->is_enabled(INFO, true)) {
+        mask &= ~TRACE_LEVEL_WARN;
+    }
+
+    mbed_trace_print_function_set(print);
+    /* no color or carriage returns, which would end up in the messages */
+    mbed_trace_config_set(mask);
+}
@@ -0,0 +1,89 @@
+#ifndef MBED_TRACE_BRIDGE_H
+#define MBED_TRACE_BRIDGE_H
+
+#include <stdint.h>
+#include "logger.h"
+
+/* number of trace groups that get their own agent rate limit */
+#define MBED_TRACE_BRIDGE_MAX_GROUPS    (32)
+/* longest group name kept (longer names are truncated) */
+#define MBED_TRACE_BRIDGE_GROUP_LEN     (15)
+/* longest include/exclude group list */
+#define MBED_TRACE_BRIDGE_FILTER_LEN    (256)
+
+/**
+ * Routes the Mbed Cloud Client's mbed-trace output into the connector's
+ * logger, instead of mbed-trace printing each line to stdout itself.
+ *
+ * Trace levels are mapped to log levels as follows:
+ *
+ *   ERR  -> ERROR
+ *   WARN -> INFO
+ *   INFO, DBG, CMD -> DEBUG
+ *
+ * (the client's info traces are detailed protocol progress, which is debug
+ * output from the connector's point of view). Traces are relayed with
+ * Logger::log_relayed() with each group as its own call site, so they are
+ * rate limited per group when sent to the agent, and also go to the console
+ * and flight recorder like any other message.
+ *
+ * Groups can be filtered with a comma-separated list of group names. Groups
+ * prefixed with '-' are excluded, and if any groups are listed without a '-',
+ * only those are included. Levels are filtered by mbed-trace itself, before
+ * the line is formatted, and levels the logger would drop are not enabled.
+ */
+class MbedTraceBridge {
+
+public:
+
+    /**
+     * Set the lowest trace level to route.
+     *
+     * @param level "debug", "info", "warn", "error" or "none"
+     * @return False if the level is not valid
+     */
+    static bool set_level(const char *level);
+
+    /**
+     * Set the trace groups to route.
+     *
+     * @param groups Comma-separated group names (see above)
+     * @return False if the list is too long
+     */
+    static bool set_groups(const char *groups);
+
+    /**
+     * Configure mbed-trace and set its print function.
+     *
+     * This must be called after mbed-trace has been initialized and the
+     * logger has been configured.
+     *
+     * @param logger Logger to route the traces to
+     */
+    static void start(Logger *logger);
+
+private:
+
+    struct trace_group {
+        char name[MBED_TRACE_BRIDGE_GROUP_LEN + 1];
+        /* also the logger call site */
+        char site[MBED_TRACE_BRIDGE_GROUP_LEN + 16];
+        bool enabled;
+    };
+
+    static Logger *_logger;
+    static uint8_t _level_mask;
+    static char _filter[MBED_TRACE_BRIDGE_FILTER_LEN];
+    static bool _filter_has_includes;
+    static struct trace_group _groups[MBED_TRACE_BRIDGE_MAX_GROUPS];
+    static int _group_cnt;
+    /* for groups beyond MBED_TRACE_BRIDGE_MAX_GROUPS */
+    static struct trace_group _other_group;
+
+    static void print(const char *str);
+    static struct trace_group *find_group(const char *name);
+    static bool is_group_enabled(const char *name);
+
+};
+
+#endif // MBED_TRACE_BRIDGE_H
@@ -0,0 +1,214 @@
+#include <string.h>
+#include <time.h>
+#include "message_tracer.h"
+
+/* stage time histogram buckets, in us */
+static const uint64_t stage_time_buckets[] = {
+    1, 5, 10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000
+};
+
+/* stages, named after the point they end at */
+static const char *const to_agent_stages[MSG_TRACE_TO_AGENT_POINT_CNT - 1] = {
+    "capture",      /* value copied out of the resource */
+    "wakeup",       /* main loop kicked and woken up */
+    "drain",        /* earlier messages in the queue handled */
+    "dispatch",
+    "send",         /* message framed and sent (or queued) */
+    "write",        /* send queue flushed */
+};
+
+static const char *const from_agent_stages[MSG_TRACE_FROM_AGENT_POINT_CNT - 1] = {
+    "receive",      /* frame parsed (after any earlier frames were handled) */
+    "dispatch",
+    "set_value",    /* Mbed Cloud Client resource value set */
+};
+
+static const struct {
+    const char *name;
+    int point_cnt;
+    const char *const *stages;
+    const char *stage_metric;
+    const char *stage_help;
+    const char *total_metric;
+    const char *total_help;
+} dirs[MSG_TRACE_DIR_CNT] = {
+    {
+        "cloud->agent", MSG_TRACE_TO_AGENT_POINT_CNT, to_agent_stages,
+        METRICS_PREFIX "to_agent_message_stage_seconds",
+        "Time spent in each stage by messages from Mbed Cloud to the agent",
+        METRICS_PREFIX "to_agent_message_seconds",
+        "Time from Mbed Cloud callback to agent socket write of messages to the agent",
+    },
+    {
+        "agent->cloud", MSG_TRACE_FROM_AGENT_POINT_CNT, from_agent_stages,
+        METRICS_PREFIX "from_agent_message_stage_seconds",
+        "Time spent in each stage by messages from the agent to Mbed Cloud",
+        METRICS_PREFIX "from_agent_message_seconds",
+        "Time from agent socket read to resource value set of messages from the agent",
+    },
+};
+
+MessageTracer::MessageTracer(Metrics *metrics):
+    _dump_fp(NULL),
+    _current(NULL),
+    _pending_cnt(0)
+{
+    add_metrics(metrics);
+}
+
+MessageTracer::~MessageTracer()
+{
+    if (_dump_fp) {
+        fclose(_dump_fp);
+    }
+}
+
+void MessageTracer::add_metrics(Metrics *metrics)
+{
+    int bucket_cnt = sizeof(stage_time_buckets) / sizeof(stage_time_buckets[0]);
+
+    for (int d = 0; d < MSG_TRACE_DIR_CNT; d++) {
+        for (int i = 0; i < dirs[d].point_cnt - 1; i++) {
+            _stage_times[d][i] = metrics->add_histogram(dirs[d].stage_metric, dirs[d].stage_help,
+                stage_time_buckets, bucket_cnt, 1e-6, "stage", dirs[d].stages[i]);
+        }
+    }
+    for (int d = 0; d < MSG_TRACE_DIR_CNT; d++) {
+        _total_times[d] = metrics->add_histogram(dirs[d].total_metric, dirs[d].total_help,
+            stage_time_buckets, bucket_cnt, 1e-6);
+    }
+}
+
+uint64_t MessageTracer::now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void MessageTracer::init(struct msg_trace *trace, MessageTraceDir dir, const char *type, size_t len)
+{
+    trace->dir = dir;
+    trace->type = type;
+    trace->len = len;
+    memset(trace->ts, 0, sizeof(trace->ts));
+}
+
+bool MessageTracer::enable_dump(const char *path)
+{
+    FILE *fp = fopen(path, "ae");
+    if (!fp) {
+        return false;
+    }
+    setvbuf(fp, NULL, _IOLBF, 0);
+
+    if (_dump_fp) {
+        fclose(_dump_fp);
+    }
+    _dump_fp = fp;
+
+    return true;
+}
+
+void MessageTracer::begin(struct msg_trace *trace)
+{
+    _current = trace;
+}
+
+void MessageTracer::mark(MessageTracePoint point)
+{
+    if (!_current || point >= dirs[_current->dir].point_cnt || _current->ts[point]) {
+        return;
+    }
+
+    _current->ts[point] = now();
+}
+
+void MessageTracer::end()
+{
+    struct msg_trace *trace = _current;
+
+    if (!trace) {
+        return;
+    }
+    _current = NULL;
+
+    if (trace->dir == MSG_TRACE_TO_AGENT &&
+            trace->ts[MSG_TRACE_SENT] && !trace->ts[MSG_TRACE_WRITTEN] &&
+            _pending_cnt < MESSAGE_TRACER_MAX_PENDING) {
+        _pending[_pending_cnt++] = *trace;
+        return;
+    }
+
+    finish(trace);
+}
+
+void MessageTracer::written()
+{
+    uint64_t ts;
+
+    if (_pending_cnt == 0) {
+        return;
+    }
+
+    ts = now();
+    for (int i = 0; i < _pending_cnt; i++) {
+        _pending[i].ts[MSG_TRACE_WRITTEN] = ts;
+        finish(&_pending[i]);
+    }
+    _pending_cnt = 0;
+}
+
+void MessageTracer::dropped()
+{
+    for (int i = 0; i < _pending_cnt; i++) {
+        finish(&_pending[i]);
+    }
+    _pending_cnt = 0;
+}
+
+/* observes the stages between the points reached, and the total if it got all the way */
+void MessageTracer::finish(struct msg_trace *trace)
+{
+    int point_cnt = dirs[trace->dir].point_cnt;
+    uint64_t *ts = trace->ts;
+
+    for (int i = 1; i < point_cnt; i++) {
+        if (ts[i - 1] && ts[i]) {
+            _stage_times[trace->dir][i - 1]->observe(ts[i] - ts[i - 1]);
+        }
+    }
+    if (ts[0] && ts[point_cnt - 1]) {
+        _total_times[trace->dir]->observe(ts[point_cnt - 1] - ts[0]);
+    }
+
+    if (_dump_fp) {
+        dump(trace);
+    }
+}
+
+/* e.g. "12.345678 cloud->agent ctrlMessage 120 bytes: capture 3 wakeup 52 ... total 410 us" */
+void MessageTracer::dump(struct msg_trace *trace)
+{
+    int point_cnt = dirs[trace->dir].point_cnt;
+    uint64_t *ts = trace->ts;
+
+    fprintf(_dump_fp, "%llu.%06llu %s %s %zu bytes:",
+        (unsigned long long)(ts[0] / 1000000), (unsigned long long)(ts[0] % 1000000),
+        dirs[trace->dir].name, trace->type, trace->len);
+    for (int i = 1; i < point_cnt; i++) {
+        if (ts[i - 1] && ts[i]) {
+            fprintf(_dump_fp, " %s %llu", dirs[trace->dir].stages[i - 1],
+                (unsigned long long)(ts[i] - ts[i - 1]));
+        } else {
+            fprintf(_dump_fp, " %s -", dirs[trace->dir].stages[i - 1]);
+        }
+    }
+    if (ts[0] && ts[point_cnt - 1]) {
+        fprintf(_dump_fp, " total %llu us\n", (unsigned long long)(ts[point_cnt - 1] - ts[0]));
+    } else {
+        fprintf(_dump_fp, " total - us (not completed)\n");
+    }
+}
@@ -0,0 +1,160 @@
+#ifndef MESSAGE_TRACER_H
+#define MESSAGE_TRACER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "metrics.h"
+
+/* maximum number of traced messages waiting for their frame to be written */
+#define MESSAGE_TRACER_MAX_PENDING  (32)
+
+/* directions of traced messages */
+enum MessageTraceDir {
+    /* Mbed Cloud resource value updates sent to the agent */
+    MSG_TRACE_TO_AGENT,
+    /* agent ctrl messages set as the from_device resource value */
+    MSG_TRACE_FROM_AGENT,
+    MSG_TRACE_DIR_CNT
+};
+
+/*
+ * The points timestamped on a traced message's way, per direction. Each stage
+ * of the way is the time from the previous point.
+ */
+enum MessageTracePoint {
+    /* to the agent */
+    MSG_TRACE_CALLBACK = 0,     /* value updated callback (client thread) */
+    MSG_TRACE_QUEUED,           /* value captured and being queued (client thread) */
+    MSG_TRACE_WOKEN,            /* main loop started draining the queue */
+    MSG_TRACE_DEQUEUED,         /* taken off the queue */
+    MSG_TRACE_DISPATCHED,       /* passed to the connector */
+    MSG_TRACE_SENT,             /* frame sent, or queued for sending */
+    MSG_TRACE_WRITTEN,          /* frame written to the agent socket */
+    MSG_TRACE_TO_AGENT_POINT_CNT,
+
+    /* from the agent */
+    MSG_TRACE_RECEIVED = 0,     /* read from the agent socket */
+    MSG_TRACE_HANDLED,          /* frame parsed and handled */
+    MSG_TRACE_DELIVERED,        /* passed to the client */
+    MSG_TRACE_SET,              /* resource value set */
+    MSG_TRACE_FROM_AGENT_POINT_CNT,
+
+    MSG_TRACE_MAX_POINT_CNT = MSG_TRACE_TO_AGENT_POINT_CNT
+};
+
+/* a traced message */
+struct msg_trace {
+    MessageTraceDir dir;
+    const char *type;
+    size_t len;
+    /* CLOCK_MONOTONIC us, or 0 if not reached */
+    uint64_t ts[MSG_TRACE_MAX_POINT_CNT];
+};
+
+/**
+ * Traces the latency of messages between Mbed Cloud and the agent.
+ *
+ * Messages are timestamped at each point on their way through the connector,
+ * and the time spent in each stage (and in total) is observed in histograms.
+ * Each message's trace can also be written to a dump file.
+ *
+ * A message is timestamped directly up until it reaches the main loop. There,
+ * its trace is made the current one with begin() while it is handled, so that
+ * the modules it passes through can mark() their points without it being
+ * passed along, and is then finished with end(). A message whose frame is
+ * queued for sending is held until its frame is written.
+ *
+ * Other than now() and init(), this must only be used from the main loop.
+ */
+class MessageTracer {
+
+public:
+
+    /**
+     * Constructor
+     *
+     * @param metrics Metrics to add the histograms to
+     */
+    MessageTracer(Metrics *metrics);
+
+    /**
+     * Deconstructor
+     */
+    ~MessageTracer();
+
+    /**
+     * Get the current time, for timestamping.
+     *
+     * @return CLOCK_MONOTONIC us
+     */
+    static uint64_t now();
+
+    /**
+     * Initialize a message's trace.
+     *
+     * @param trace Trace
+     * @param dir   Direction
+     * @param type  Message type (static string)
+     * @param len   Message length
+     */
+    static void init(struct msg_trace *trace, MessageTraceDir dir, const char *type, size_t len);
+
+    /**
+     * Write each message's trace to a file, one line per message.
+     *
+     * This is meant for debugging, as the file is written from the main loop.
+     *
+     * @param path File path (appended to)
+     * @return False if the file could not be opened
+     */
+    bool enable_dump(const char *path);
+
+    /**
+     * Make a trace the current one, while its message is handled.
+     *
+     * @param trace Trace
+     */
+    void begin(struct msg_trace *trace);
+
+    /**
+     * Timestamp a point of the current trace (if there is one, and the point
+     * has not already been reached).
+     *
+     * @param point Point
+     */
+    void mark(MessageTracePoint point);
+
+    /**
+     * Finish the current trace, or hold it if its frame is waiting to be
+     * written.
+     */
+    void end();
+
+    /**
+     * Notify the tracer that all queued frames have been written to the agent.
+     */
+    void written();
+
+    /**
+     * Notify the tracer that all queued frames have been dropped.
+     */
+    void dropped();
+
+private:
+
+    FILE *_dump_fp;
+    struct msg_trace *_current;
+    struct msg_trace _pending[MESSAGE_TRACER_MAX_PENDING];
+    int _pending_cnt;
+    /* per direction, per stage */
+    MetricHistogram *_stage_times[MSG_TRACE_DIR_CNT][MSG_TRACE_MAX_POINT_CNT - 1];
+    MetricHistogram *_total_times[MSG_TRACE_DIR_CNT];
+
+    void add_metrics(Metrics *metrics);
+    void finish(struct msg_trace *trace);
+    void dump(struct msg_trace *trace);
+
+};
+
+#endif // MESSAGE_TRACER_H
@@ -0,0 +1,209 @@
+#include <string.h>
+#include "metrics.h"
+
+MetricHistogram::MetricHistogram(const uint64_t *bounds, int bound_cnt, double scale):
+    _bounds(bounds),
+    _bound_cnt(bound_cnt > METRICS_MAX_BUCKETS ? METRICS_MAX_BUCKETS : bound_cnt),
+    _scale(scale),
+    _sum(0)
+{
+    for (int i = 0; i <= METRICS_MAX_BUCKETS; i++) {
+        _counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void MetricHistogram::observe(uint64_t val)
+{
+    int i;
+
+    for (i = 0; i < _bound_cnt; i++) {
+        if (val <= _bounds[i]) {
+            break;
+        }
+    }
+
+    _counts[i].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(val, std::memory_order_relaxed);
+}
+
+Metrics::Metrics()
+{
+}
+
+Metrics::~Metrics()
+{
+    vector<struct metric>::iterator it;
+
+    for (it = _metrics.begin(); it != _metrics.end(); it++) {
+        delete it->counter;
+        delete it->histogram;
+    }
+}
+
+void Metrics::add(const char *name, const char *help, metric_type type,
+        const char *label, const char *label_value)
+{
+    struct metric m;
+
+    m.name = name;
+    m.help = help;
+    m.label = label;
+    m.label_value = label_value;
+    m.type = type;
+    m.counter = NULL;
+    m.histogram = NULL;
+
+    _metrics.push_back(m);
+}
+
+MetricCounter *Metrics::add_counter(const char *name, const char *help,
+        const char *label, const char *label_value)
+{
+    MetricCounter *counter = new MetricCounter();
+
+    add(name, help, METRIC_COUNTER, label, label_value);
+    _metrics.back().counter = counter;
+
+    return counter;
+}
+
+void Metrics::add_counter(const char *name, const char *help, MetricValueCB cb,
+        const char *label, const char *label_value)
+{
+    add(name, help, METRIC_COUNTER, label, label_value);
+    _metrics.back().value_cb = cb;
+}
+
+void Metrics::add_gauge(const char *name, const char *help, MetricValueCB cb)
+{
+    add(name, help, METRIC_GAUGE, NULL, NULL);
+    _metrics.back().value_cb = cb;
+}
+
+MetricHistogram *Metrics::add_histogram(const char *name, const char *help,
+        const uint64_t *bounds, int bound_cnt, double scale,
+        const char *label, const char *label_value)
+{
+    MetricHistogram *histogram = new MetricHistogram(bounds, bound_cnt, scale);
+
+    add(name, help, METRIC_HISTOGRAM, label, label_value);
+    _metrics.back().histogram = histogram;
+
+    return histogram;
+}
+
+uint64_t Metrics::get_value(struct metric &m)
+{
+    return m.counter ? m.counter->get() : m.value_cb.call();
+}
+
+void Metrics::write_histogram_text(FILE *fp, struct metric &m)
+{
+    MetricHistogram *h = m.histogram;
+    char labels[128] = "";
+    uint64_t cnt = 0;
+
+    if (m.label) {
+        snprintf(labels, sizeof(labels), "%s=\"%s\"", m.label, m.label_value);
+    }
+
+    for (int i = 0; i < h->_bound_cnt; i++) {
+        cnt += h->_counts[i].load(std::memory_order_relaxed);
+        fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %llu\n", m.name, labels, m.label ? "," : "",
+            h->_bounds[i] * h->_scale, (unsigned long long)cnt);
+    }
+    cnt += h->_counts[h->_bound_cnt].load(std::memory_order_relaxed);
+    fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", m.name, labels, m.label ? "," : "",
+        (unsigned long long)cnt);
+    if (m.label) {
+        fprintf(fp, "%s_sum{%s} %g\n", m.name, labels,
+            h->_sum.load(std::memory_order_relaxed) * h->_scale);
+        fprintf(fp, "%s_count{%s} %llu\n", m.name, labels, (unsigned long long)cnt);
+    } else {
+        fprintf(fp, "%s_sum %g\n", m.name, h->_sum.load(std::memory_order_relaxed) * h->_scale);
+        fprintf(fp, "%s_count %llu\n", m.name, (unsigned long long)cnt);
+    }
+}
+
+void Metrics::write_text(FILE *fp)
+{
+    static const char *type_names[] = { "counter", "gauge", "histogram" };
+    const char *last_name = NULL;
+    vector<struct metric>::iterator it;
+
+    for (it = _metrics.begin(); it != _metrics.end(); it++) {
+        /* labelled metrics of the same name share their help and type */
+        if (!last_name || strcmp(it->name, last_name) != 0) {
+            fprintf(fp, "# HELP %s %s\n", it->name, it->help);
+            fprintf(fp, "# TYPE %s %s\n", it->name, type_names[it->type]);
+            last_name = it->name;
+        }
+
+        if (it->type == METRIC_HISTOGRAM) {
+            write_histogram_text(fp, *it);
+        } else if (it->label) {
+            fprintf(fp, "%s{%s=\"%s\"} %llu\n", it->name, it->label, it->label_value,
+                (unsigned long long)get_value(*it));
+        } else {
+            fprintf(fp, "%s %llu\n", it->name, (unsigned long long)get_value(*it));
+        }
+    }
+}
+
+void Metrics::write_histogram_json(JsonWriter &json, struct metric &m)
+{
+    MetricHistogram *h = m.histogram;
+    uint64_t cnt = 0;
+    char str[32];
+    int len;
+
+    json.begin_object();
+    json.key("buckets");
+    json.begin_object();
+    for (int i = 0; i < h->_bound_cnt; i++) {
+        cnt += h->_counts[i].load(std::memory_order_relaxed);
+        snprintf(str, sizeof(str), "%g", h->_bounds[i] * h->_scale);
+        json.key(str);
+        json.number(cnt);
+    }
+    cnt += h->_counts[h->_bound_cnt].load(std::memory_order_relaxed);
+    json.key("+Inf");
+    json.number(cnt);
+    json.end_object();
+    json.key("sum");
+    len = snprintf(str, sizeof(str), "%g", h->_sum.load(std::memory_order_relaxed) * h->_scale);
+    json.raw(str, len);
+    json.key("count");
+    json.number(cnt);
+    json.end_object();
+}
+
+void Metrics::write_json(JsonWriter &json)
+{
+    vector<struct metric>::iterator it;
+
+    json.begin_object();
+    for (it = _metrics.begin(); it != _metrics.end(); it++) {
+        if (it->label) {
+            if (it == _metrics.begin() || strcmp(it->name, (it - 1)->name) != 0) {
+                json.key(it->name);
+                json.begin_object();
+            }
+            json.key(it->label_value);
+        } else {
+            json.key(it->name);
+        }
+
+        if (it->type == METRIC_HISTOGRAM) {
+            write_histogram_json(json, *it);
+        } else {
+            json.number(get_value(*it));
+        }
+
+        if (it->label &&
+                (it + 1 == _metrics.end() || strcmp(it->name, (it + 1)->name) != 0)) {
+            json.end_object();
+        }
+    }
+    json.end_object();
+}
@@ -0,0 +1,231 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "mbed-cloud-client/MbedCloudClient.h"
+#include "json_writer.h"
+
+/* prefix of all of the connector's metric names */
+#define METRICS_PREFIX          "enebular_connector_"
+
+/* maximum number of histogram buckets (excluding +Inf) */
+#define METRICS_MAX_BUCKETS     (16)
+
+/**
+ * Value sampler for metrics kept by their owners. It is called from the
+ * connector's main loop when the metrics are exported.
+ */
+typedef FP0<uint64_t> MetricValueCB;
+
+/**
+ * A counter (a value that only goes up).
+ *
+ * This is lock-free and can be incremented from any thread.
+ */
+class MetricCounter {
+
+public:
+
+    /**
+     * Constructor
+     */
+    MetricCounter(): _value(0) {}
+
+    /**
+     * Increment the counter.
+     *
+     * @param n Amount to increment by
+     */
+    void inc(uint64_t n = 1)
+    {
+        _value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the counter's value.
+     */
+    uint64_t get()
+    {
+        return _value.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    std::atomic<uint64_t> _value;
+
+};
+
+/**
+ * A histogram with fixed buckets.
+ *
+ * Values are observed in integer units (e.g. us) and exported scaled to the
+ * metric's base unit (e.g. seconds). This is lock-free and values can be
+ * observed from any thread.
+ */
+class MetricHistogram {
+
+public:
+
+    /**
+     * Constructor
+     *
+     * @param bounds    Upper bounds of the buckets, in ascending order
+     * @param bound_cnt Number of bounds (up to METRICS_MAX_BUCKETS)
+     * @param scale     Scale of a unit, for export (e.g. 1e-6 for us)
+     */
+    MetricHistogram(const uint64_t *bounds, int bound_cnt, double scale);
+
+    /**
+     * Observe a value.
+     *
+     * @param val Value
+     */
+    void observe(uint64_t val);
+
+private:
+
+    friend class Metrics;
+
+    const uint64_t *_bounds;
+    int _bound_cnt;
+    double _scale;
+    /* per bucket (not cumulative), the last being +Inf */
+    std::atomic<uint64_t> _counts[METRICS_MAX_BUCKETS + 1];
+    std::atomic<uint64_t> _sum;
+
+};
+
+/**
+ * The connector's metrics registry.
+ *
+ * Modules add their metrics when they are constructed, and then update them
+ * directly (counters and histograms) or have them sampled when the metrics
+ * are exported (values they already keep, such as queue depths). The metrics
+ * are exported in the Prometheus text format, or as JSON for the agent.
+ *
+ * Metrics must be added from the main thread before they are used from other
+ * threads. A metric may have a label, in which case all the metrics with its
+ * name must be added one after another (with different label values).
+ * Names, help texts and labels must be static strings that need no escaping.
+ */
+class Metrics {
+
+public:
+
+    /**
+     * Constructor
+     */
+    Metrics();
+
+    /**
+     * Deconstructor
+     */
+    ~Metrics();
+
+    /**
+     * Add a counter.
+     *
+     * @param name        Name
+     * @param help        Help text
+     * @param label       Label name, or NULL
+     * @param label_value Label value
+     * @return The counter
+     */
+    MetricCounter *add_counter(const char *name, const char *help,
+        const char *label = NULL, const char *label_value = NULL);
+
+    /**
+     * Add a counter whose value is sampled when exported.
+     *
+     * @param name        Name
+     * @param help        Help text
+     * @param cb          Value sampler
+     * @param label       Label name, or NULL
+     * @param label_value Label value
+     */
+    void add_counter(const char *name, const char *help, MetricValueCB cb,
+        const char *label = NULL, const char *label_value = NULL);
+
+    /**
+     * Add a gauge whose value is sampled when exported.
+     *
+     * @param name Name
+     * @param help Help text
+     * @param cb   Value sampler
+     */
+    void add_gauge(const char *name, const char *help, MetricValueCB cb);
+
+    /**
+     * Add a histogram.
+     *
+     * @param name        Name
+     * @param help        Help text
+     * @param bounds      Upper bounds of the buckets (see MetricHistogram)
+     * @param bound_cnt   Number of bounds
+     * @param scale       Scale of a unit, for export
+     * @param label       Label name, or NULL
+     * @param label_value Label value
+     * @return The histogram
+     */
+    MetricHistogram *add_histogram(const char *name, const char *help,
+        const uint64_t *bounds, int bound_cnt, double scale,
+        const char *label = NULL, const char *label_value = NULL);
+
+    /**
+     * Write the metrics in the Prometheus text exposition format.
+     *
+     * This must be called from the connector's main loop.
+     *
+     * @param fp Stream to write to
+     */
+    void write_text(FILE *fp);
+
+    /**
+     * Write the metrics as a JSON object, keyed by name.
+     *
+     * Labelled metrics are objects keyed by label value, and histograms are
+     * objects with their count, sum and cumulative bucket counts.
+     *
+     * This must be called from the connector's main loop.
+     *
+     * @param json JSON writer
+     */
+    void write_json(JsonWriter &json);
+
+private:
+
+    enum metric_type {
+        METRIC_COUNTER,
+        METRIC_GAUGE,
+        METRIC_HISTOGRAM
+    };
+
+    struct metric {
+        const char *name;
+        const char *help;
+        const char *label;
+        const char *label_value;
+        metric_type type;
+        MetricCounter *counter;
+        MetricHistogram *histogram;
+        MetricValueCB value_cb;
+    };
+
+    vector<struct metric> _metrics;
+
+    void add(const char *name, const char *help, metric_type type,
+        const char *label, const char *label_value);
+    uint64_t get_value(struct metric &m);
+    void write_histogram_text(FILE *fp, struct metric &m);
+    void write_histogram_json(JsonWriter &json, struct metric &m);
+
+    /* not copyable */
+    Metrics(const Metrics &);
+    Metrics &operator=(const Metrics &);
+
+};
+
+#endif // METRICS_H
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "enebular_agent_mbed_cloud_connector.h"
+#include "metrics_server.h"
+
+#define DEFAULT_TCP_ADDRESS     "127.0.0.1"
+#define LISTEN_BACKLOG          (8)
+#define TIMEOUT_CHECK_MS        (1000)
+
+#define RESPONSE_HEADER \
+    "HTTP/1.0 200 OK\r\n" \
+    "Content-Type: text/plain; version=0.0.4\r\n" \
+    "Content-Length: %zu\r\n" \
+    "Connection: close\r\n" \
+    "\r\n"
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+MetricsServer::MetricsServer(EnebularAgentMbedCloudConnector *connector, Metrics *metrics):
+    _connector(connector),
+    _metrics(metrics),
+    _logger(Logger::get_instance()),
+    _listen_fd(-1),
+    _timeout_timer(0)
+{
+    _unix_path[0] = '\0';
+
+    for (int i = 0; i < METRICS_SERVER_MAX_CLIENTS; i++) {
+        _clients[i].server = this;
+        _clients[i].fd = -1;
+        _clients[i].resp = NULL;
+    }
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::listen_unix(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        _logger->log_console(ERROR, "Metrics: socket path too long");
+        return false;
+    }
+
+    _listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listen_fd < 0) {
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    unlink(path);
+
+    if (bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        return false;
+    }
+    strcpy(_unix_path, path);
+
+    return true;
+}
+
+bool MetricsServer::listen_tcp(const char *address)
+{
+    struct sockaddr_in addr;
+    char host[INET_ADDRSTRLEN] = DEFAULT_TCP_ADDRESS;
+    const char *port_str = address;
+    const char *sep = strrchr(address, ':');
+    unsigned long port;
+    char *end;
+    int on = 1;
+
+    if (sep) {
+        if ((size_t)(sep - address) >= sizeof(host)) {
+            return false;
+        }
+        memcpy(host, address, sep - address);
+        host[sep - address] = '\0';
+        port_str = sep + 1;
+    }
+
+    port = strtoul(port_str, &end, 10);
+    if (*port_str == '\0' || *end != '\0' || port == 0 || port > 65535) {
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        return false;
+    }
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listen_fd < 0) {
+        return false;
+    }
+
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    return bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+}
+
+bool MetricsServer::start(const char *address)
+{
+    bool ok;
+
+    stop();
+
+    errno = 0;
+    if (strchr(address, '/')) {
+        ok = listen_unix(address);
+    } else {
+        ok = listen_tcp(address);
+    }
+    if (!ok || listen(_listen_fd, LISTEN_BACKLOG) < 0) {
+        _logger->log_console(ERROR, "Metrics: failed to listen on %s: %s", address,
+            errno ? strerror(errno) : "invalid address");
+        stop();
+        return false;
+    }
+
+    if (!_connector->register_wait_fd(_listen_fd, "metrics",
+            WaitFdCB(this, &MetricsServer::listen_fd_cb))) {
+        stop();
+        return false;
+    }
+
+    _logger->log_console(INFO, "Metrics: listening on %s", address);
+
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    for (int i = 0; i < METRICS_SERVER_MAX_CLIENTS; i++) {
+        if (_clients[i].fd >= 0) {
+            close_client(&_clients[i]);
+        }
+    }
+
+    if (_timeout_timer) {
+        _connector->cancel_timer(_timeout_timer);
+        _timeout_timer = 0;
+    }
+
+    if (_listen_fd >= 0) {
+        _connector->deregister_wait_fd(_listen_fd);
+        close(_listen_fd);
+        _listen_fd = -1;
+    }
+    if (_unix_path[0] != '\0') {
+        unlink(_unix_path);
+        _unix_path[0] = '\0';
+    }
+}
+
+void MetricsServer::listen_fd_cb(uint32_t events)
+{
+    struct client *client;
+    int fd;
+
+    while ((fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+
+        client = NULL;
+        for (int i = 0; i < METRICS_SERVER_MAX_CLIENTS; i++) {
+            if (_clients[i].fd < 0) {
+                client = &_clients[i];
+                break;
+            }
+        }
+        if (!client) {
+            LOGGER_LOG_CONSOLE(_logger, DEBUG, "Metrics: too many clients");
+            close(fd);
+            continue;
+        }
+
+        /* edge-triggered, so a client that has hung up doesn't keep us busy */
+        if (!_connector->register_wait_fd(fd, "metrics-client",
+                WaitFdCB(client, &MetricsServer::client::fd_cb), true)) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->since_ms = now_ms();
+        client->resp = NULL;
+        client->resp_len = 0;
+        client->resp_off = 0;
+        client->responded = false;
+        client->eof = false;
+
+        if (!_timeout_timer) {
+            _timeout_timer = _connector->add_timer(TIMEOUT_CHECK_MS, TIMEOUT_CHECK_MS,
+                "metrics-timeout", TimerCB(this, &MetricsServer::timeout_timer_cb));
+        }
+    }
+}
+
+void MetricsServer::timeout_timer_cb()
+{
+    uint64_t now = now_ms();
+    bool active = false;
+
+    for (int i = 0; i < METRICS_SERVER_MAX_CLIENTS; i++) {
+        struct client *client = &_clients[i];
+        if (client->fd < 0) {
+            continue;
+        }
+        if (now - client->since_ms >= METRICS_SERVER_CLIENT_TIMEOUT_MS) {
+            LOGGER_LOG_CONSOLE(_logger, DEBUG, "Metrics: client timed out");
+            close_client(client);
+        } else {
+            active = true;
+        }
+    }
+
+    if (!active) {
+        _connector->cancel_timer(_timeout_timer);
+        _timeout_timer = 0;
+    }
+}
+
+void MetricsServer::client::fd_cb(uint32_t events)
+{
+    server->handle_client(this, events);
+}
+
+bool MetricsServer::build_response(struct client *client)
+{
+    char header[256];
+    char *body = NULL;
+    size_t body_len = 0;
+    int header_len;
+    FILE *fp;
+
+    fp = open_memstream(&body, &body_len);
+    if (!fp) {
+        return false;
+    }
+    _metrics->write_text(fp);
+    if (fclose(fp) != 0) {
+        free(body);
+        return false;
+    }
+
+    header_len = snprintf(header, sizeof(header), RESPONSE_HEADER, body_len);
+
+    client->resp = (char *)malloc(header_len + body_len);
+    if (!client->resp) {
+        free(body);
+        return false;
+    }
+    memcpy(client->resp, header, header_len);
+    memcpy(client->resp + header_len, body, body_len);
+    free(body);
+
+    client->resp_len = header_len + body_len;
+    client->resp_off = 0;
+    client->responded = true;
+
+    return true;
+}
+
+void MetricsServer::handle_client(struct client *client, uint32_t events)
+{
+    char buf[512];
+    ssize_t cnt;
+
+    /* the request itself doesn't matter, so it's just read and discarded */
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        while (1) {
+            cnt = read(client->fd, buf, sizeof(buf));
+            if (cnt > 0) {
+                continue;
+            }
+            if (cnt == 0) {
+                client->eof = true;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_client(client);
+                return;
+            }
+            break;
+        }
+        if (!client->responded && !build_response(client)) {
+            _logger->log_console(ERROR, "Metrics: oom");
+            close_client(client);
+            return;
+        }
+    }
+
+    if (client->resp) {
+        while (client->resp_off < client->resp_len) {
+            cnt = write(client->fd, client->resp + client->resp_off,
+                client->resp_len - client->resp_off);
+            if (cnt < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    _connector->set_wait_fd_writable(client->fd, true);
+                    return;
+                }
+                close_client(client);
+                return;
+            }
+            client->resp_off += cnt;
+        }
+        free(client->resp);
+        client->resp = NULL;
+        _connector->set_wait_fd_writable(client->fd, false);
+
+        /*
+         * closing with the request possibly unread would reset the connection
+         * (and could lose the response), so the client closes first
+         */
+        shutdown(client->fd, SHUT_WR);
+    }
+
+    if (client->eof && !client->resp) {
+        close_client(client);
+    }
+}
+
+void MetricsServer::close_client(struct client *client)
+{
+    _connector->deregister_wait_fd(client->fd);
+    close(client->fd);
+    client->fd = -1;
+    free(client->resp);
+    client->resp = NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <stdint.h>
+#include "metrics.h"
+#include "logger.h"
+
+class EnebularAgentMbedCloudConnector;
+class MetricsServer;
+
+/* maximum number of clients served at once (others are turned away) */
+#define METRICS_SERVER_MAX_CLIENTS      (4)
+/* time a client has to send its request and read the response */
+#define METRICS_SERVER_CLIENT_TIMEOUT_MS (5000)
+
+/**
+ * Serves the connector's metrics over HTTP, in the Prometheus text format,
+ * for scraping (e.g. curl --unix-socket <path> http://localhost/metrics).
+ *
+ * It listens on either a Unix socket or a TCP port, and is run from the
+ * connector's main loop along with everything else, so it never blocks. Any
+ * request is answered with the metrics, and the connection is then closed.
+ */
+class MetricsServer {
+
+public:
+
+    /**
+     * Constructor
+     *
+     * @param connector Connector (for its main loop)
+     * @param metrics   Metrics to serve
+     */
+    MetricsServer(EnebularAgentMbedCloudConnector *connector, Metrics *metrics);
+
+    /**
+     * Deconstructor
+     */
+    ~MetricsServer();
+
+    /**
+     * Start listening.
+     *
+     * @param address Unix socket path (containing a '/'), or a TCP port
+     *                optionally preceded by an IPv4 address ("[addr:]port",
+     *                the address being 127.0.0.1 by default)
+     * @return False if the address is invalid or could not be listened on
+     */
+    bool start(const char *address);
+
+    /**
+     * Stop listening and close all client connections.
+     */
+    void stop();
+
+private:
+
+    /* binds a client connection's wait fd callback to its state */
+    struct client {
+        MetricsServer *server;
+        int fd;
+        uint64_t since_ms;
+        char *resp;
+        size_t resp_len;
+        size_t resp_off;
+        bool responded;
+        /* the client has finished sending */
+        bool eof;
+        void fd_cb(uint32_t events);
+    };
+
+    EnebularAgentMbedCloudConnector *_connector;
+    Metrics *_metrics;
+    Logger *_logger;
+    int _listen_fd;
+    char _unix_path[108];
+    uint32_t _timeout_timer;
+    struct client _clients[METRICS_SERVER_MAX_CLIENTS];
+
+    bool listen_unix(const char *path);
+    bool listen_tcp(const char *address);
+    void listen_fd_cb(uint32_t events);
+    void timeout_timer_cb();
+    void handle_client(struct client *client, uint32_t events);
+    bool build_response(struct client *client);
+    void close_client(struct client *client);
+
+};
+
+#endif // METRICS_SERVER_H
@@ -0,0 +1,236 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+#define MPSC_RING_CACHE_LINE_SIZE   (64)
+
+/**
+ * A bounded, lock-free multi-producer/single-consumer ring of fixed-size
+ * records.
+ *
+ * Each slot has a sequence number which tells whether it is free, claimed or
+ * published, so producers only contend on claiming a slot, and a producer that
+ * is slow to publish its record does not hold up the others (the consumer
+ * simply waits for it). Records are written and read in place, so T should be
+ * a plain struct. When the ring is full, claims fail and are counted as
+ * overflows.
+ *
+ * Any number of threads may claim and publish, and only one thread may read
+ * and pop.
+ */
+template <typename T>
+class MpscRing {
+
+public:
+
+    /**
+     * Constructor
+     */
+    MpscRing():
+        _slots(NULL),
+        _mask(0),
+        _head(0),
+        _tail(0),
+        _overflow_cnt(0)
+    {
+    }
+
+    /**
+     * Deconstructor
+     */
+    ~MpscRing()
+    {
+        uninit();
+    }
+
+    /**
+     * Allocate the ring.
+     *
+     * @param capacity Capacity (rounded up to a power of two)
+     */
+    bool init(size_t capacity)
+    {
+        size_t size = 2;
+
+        uninit();
+
+        while (size < capacity) {
+            size *= 2;
+        }
+        _slots = (struct slot *)malloc(size * sizeof(struct slot));
+        if (!_slots) {
+            return false;
+        }
+        for (size_t i = 0; i < size; i++) {
+            new (&_slots[i].seq) std::atomic<size_t>(i);
+        }
+        _mask = size - 1;
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    /**
+     * Free the ring.
+     */
+    void uninit()
+    {
+        free(_slots);
+        _slots = NULL;
+        _mask = 0;
+    }
+
+    /**
+     * Claim a slot to write a record into (producers).
+     *
+     * The record must then be published with publish().
+     *
+     * @return The record, or NULL if the ring is full
+     */
+    T *claim()
+    {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+
+        if (!_slots) {
+            return NULL;
+        }
+
+        while (1) {
+            struct slot *slot = &_slots[pos & _mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return &slot->item;
+                }
+            } else if (diff < 0) {
+                /* the consumer hasn't popped this slot's previous record */
+                _overflow_cnt.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Publish a record claimed with claim() (producers).
+     *
+     * @param item Record
+     * @return True if the consumer had already popped all previous records.
+     *         The consumer only needs to be woken up if so.
+     */
+    bool publish(T *item)
+    {
+        struct slot *slot = reinterpret_cast<struct slot *>(item);
+        size_t pos = slot->seq.load(std::memory_order_relaxed);
+
+        /*
+         * sequentially consistent, so that either the consumer sees this record
+         * or we see that it has reached it (and needs waking up).
+         */
+        slot->seq.store(pos + 1, std::memory_order_seq_cst);
+
+        return _head.load(std::memory_order_seq_cst) == pos;
+    }
+
+    /**
+     * Get the oldest record (consumer only).
+     *
+     * @return The record, or NULL if there are no more published records
+     */
+    T *front()
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        struct slot *slot;
+
+        if (!_slots) {
+            return NULL;
+        }
+
+        slot = &_slots[head & _mask];
+        if (slot->seq.load(std::memory_order_seq_cst) != head + 1) {
+            return NULL;
+        }
+
+        return &slot->item;
+    }
+
+    /**
+     * Pop the record returned by front() (consumer only).
+     */
+    void pop()
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+
+        _slots[head & _mask].seq.store(head + _mask + 1, std::memory_order_release);
+        _head.store(head + 1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * Get the number of records claimed so far.
+     */
+    size_t get_claimed_cnt()
+    {
+        return _tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Get the number of records popped so far.
+     */
+    size_t get_popped_cnt()
+    {
+        return _head.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Get the ring's capacity.
+     */
+    size_t get_capacity()
+    {
+        return _slots ? _mask + 1 : 0;
+    }
+
+    /**
+     * Get the number of claims refused due to the ring being full.
+     */
+    uint32_t get_overflow_cnt()
+    {
+        return _overflow_cnt.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    /* the record comes first, so a record pointer is also its slot's */
+    struct slot {
+        T item;
+        std::atomic<size_t> seq;
+    };
+
+    /*
+     * The consumer and producer indexes are padded onto separate cache lines
+     * to avoid false sharing.
+     */
+    struct slot *_slots;
+    size_t _mask;
+    char _pad0[MPSC_RING_CACHE_LINE_SIZE];
+    std::atomic<size_t> _head;
+    char _pad1[MPSC_RING_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _tail;
+    std::atomic<uint32_t> _overflow_cnt;
+    char _pad2[MPSC_RING_CACHE_LINE_SIZE];
+
+    /* not copyable */
+    MpscRing(const MpscRing &);
+    MpscRing &operator=(const MpscRing &);
+
+};
+
+#endif // MPSC_RING_H
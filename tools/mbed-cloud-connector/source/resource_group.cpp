@@ -0,0 +1,171 @@
+
+#include <stdlib.h>
+#include "enebular_agent_mbed_cloud_connector.h"
+#include "resource_group.h"
+
+ResourceGroup::ResourceGroup(EnebularAgentMbedCloudConnector *connector, const char *name,
+        const char *const *keys, int key_cnt, uint32_t max_gap_ms):
+    _connector(connector),
+    _logger(Logger::get_instance()),
+    _name(name),
+    _members(new struct member[key_cnt]),
+    _member_cnt(key_cnt),
+    _max_gap_ms(max_gap_ms),
+    _expire_timer(0),
+    _completed_cnt(0),
+    _expired_cnt(0)
+{
+    for (int i = 0; i < _member_cnt; i++) {
+        _members[i].key = keys[i];
+        _members[i].value = NULL;
+        _members[i].time = 0;
+    }
+}
+
+ResourceGroup::~ResourceGroup()
+{
+    clear();
+    delete [] _members;
+}
+
+void ResourceGroup::on_complete(ResourceGroupCompleteCB cb)
+{
+    _complete_cb = cb;
+}
+
+void ResourceGroup::clear()
+{
+    for (int i = 0; i < _member_cnt; i++) {
+        if (_members[i].value) {
+            _members[i].value->unref();
+            _members[i].value = NULL;
+        }
+    }
+
+    if (_expire_timer) {
+        _connector->cancel_timer(_expire_timer);
+        _expire_timer = 0;
+    }
+}
+
+void ResourceGroup::expire_stale(uint64_t now)
+{
+    int set_cnt = 0;
+    int cnt = 0;
+
+    for (int i = 0; i < _member_cnt; i++) {
+        if (!_members[i].value) {
+            continue;
+        }
+        set_cnt++;
+        if (now - _members[i].time >= _max_gap_ms) {
+            _members[i].value->unref();
+            _members[i].value = NULL;
+            cnt++;
+        }
+    }
+
+    if (cnt > 0) {
+        _expired_cnt++;
+        _logger->log_console(INFO, "Client: %s: discarded incomplete update (%d of %d set, %u expired in total)",
+            _name, set_cnt, _member_cnt, _expired_cnt);
+    }
+}
+
+void ResourceGroup::update_expire_timer(uint64_t now)
+{
+    uint64_t oldest = 0;
+    uint64_t age;
+
+    if (_expire_timer) {
+        _connector->cancel_timer(_expire_timer);
+        _expire_timer = 0;
+    }
+
+    for (int i = 0; i < _member_cnt; i++) {
+        if (_members[i].value && (oldest == 0 || _members[i].time < oldest)) {
+            oldest = _members[i].time;
+        }
+    }
+    if (oldest == 0) {
+        return;
+    }
+
+    age = now - oldest;
+    _expire_timer = _connector->add_timer(
+        (age < _max_gap_ms) ? (uint32_t)(_max_gap_ms - age) : 0, 0, "resource-group",
+        TimerCB(this, &ResourceGroup::expire_timer_cb));
+}
+
+void ResourceGroup::expire_timer_cb()
+{
+    uint64_t now = EventTimers::now_ms();
+
+    _expire_timer = 0;
+
+    expire_stale(now);
+    update_expire_timer(now);
+}
+
+void ResourceGroup::set(int member, SharedBuffer *value)
+{
+    uint64_t now = EventTimers::now_ms();
+    int i;
+
+    if (member < 0 || member >= _member_cnt) {
+        value->unref();
+        return;
+    }
+
+    /* in case the expire timer is due but hasn't run yet */
+    expire_stale(now);
+
+    if (_members[member].value) {
+        _members[member].value->unref();
+    }
+    _members[member].value = value;
+    _members[member].time = now;
+
+    for (i = 0; i < _member_cnt; i++) {
+        if (!_members[i].value) {
+            break;
+        }
+    }
+
+    if (i < _member_cnt) {
+        /* the timer expires anything that falls out of the window */
+        update_expire_timer(now);
+        return;
+    }
+
+    /* all members are within the window */
+    _completed_cnt++;
+    _complete_cb.call(this);
+
+    clear();
+}
+
+void ResourceGroup::write_json(JsonWriter &json)
+{
+    json.begin_object();
+    for (int i = 0; i < _member_cnt; i++) {
+        SharedBuffer *value = _members[i].value;
+        json.member(_members[i].key, value ? value->data() : "", value ? value->len() : 0);
+    }
+    json.end_object();
+}
+
+const char *ResourceGroup::get_name()
+{
+    return _name;
+}
+
+uint64_t ResourceGroup::get_completed_cnt()
+{
+    return _completed_cnt;
+}
+
+uint64_t ResourceGroup::get_expired_cnt()
+{
+    return _expired_cnt;
+}
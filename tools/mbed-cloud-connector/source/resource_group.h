@@ -0,0 +1,119 @@
+#ifndef RESOURCE_GROUP_H
+#define RESOURCE_GROUP_H
+
+#include <stdint.h>
+#include "mbed-cloud-client/MbedCloudClient.h"
+#include "logger.h"
+#include "shared_buffer.h"
+#include "json_writer.h"
+
+class EnebularAgentMbedCloudConnector;
+class ResourceGroup;
+
+typedef FP1<void, ResourceGroup *> ResourceGroupCompleteCB;
+
+/**
+ * Aggregates a set of related resources that are updated together.
+ *
+ * Some messages from enebular are split over several resources, which Mbed
+ * Cloud updates one by one. A group collects the member values as they
+ * arrive and calls its complete callback as soon as every member has a value
+ * set within the maximum gap of the others. A partial set is expired (and
+ * counted) with a timer once its oldest value is older than the maximum gap,
+ * so a lost update never leaves stale values around.
+ *
+ * Times are taken from the monotonic clock. A group is only used from the
+ * connector's main loop.
+ */
+class ResourceGroup {
+
+public:
+
+    /**
+     * Constructor
+     *
+     * @param connector  Connector (for timers)
+     * @param name       Group name
+     * @param keys       Member keys
+     * @param key_cnt    Number of members
+     * @param max_gap_ms Maximum time between the first and last member updates
+     */
+    ResourceGroup(EnebularAgentMbedCloudConnector *connector, const char *name,
+            const char *const *keys, int key_cnt, uint32_t max_gap_ms);
+
+    /**
+     * Deconstructor
+     */
+    ~ResourceGroup();
+
+    /**
+     * Sets the complete callback.
+     *
+     * The member values are available from the callback (write_json()), and
+     * are cleared once it returns.
+     *
+     * @param cb Callback
+     */
+    void on_complete(ResourceGroupCompleteCB cb);
+
+    /**
+     * Sets a member's value.
+     *
+     * @param member Member index
+     * @param value  Value. The group takes over the reference.
+     */
+    void set(int member, SharedBuffer *value);
+
+    /**
+     * Discards all member values.
+     */
+    void clear();
+
+    /**
+     * Writes the members as a JSON object of strings.
+     *
+     * @param json JSON writer
+     */
+    void write_json(JsonWriter &json);
+
+    /**
+     * Gets the group's name.
+     */
+    const char *get_name();
+
+    /**
+     * Gets the number of times the group has completed.
+     */
+    uint64_t get_completed_cnt();
+
+    /**
+     * Gets the number of partial sets that have expired.
+     */
+    uint64_t get_expired_cnt();
+
+private:
+
+    struct member {
+        const char *key;
+        SharedBuffer *value;
+        uint64_t time;
+    };
+
+    EnebularAgentMbedCloudConnector *_connector;
+    Logger *_logger;
+    const char *_name;
+    struct member *_members;
+    int _member_cnt;
+    uint32_t _max_gap_ms;
+    uint32_t _expire_timer;
+    ResourceGroupCompleteCB _complete_cb;
+    uint32_t _completed_cnt;
+    uint32_t _expired_cnt;
+
+    void expire_stale(uint64_t now);
+    void update_expire_timer(uint64_t now);
+    void expire_timer_cb();
+
+};
+
+#endif // RESOURCE_GROUP_H
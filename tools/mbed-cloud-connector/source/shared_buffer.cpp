@@ -0,0 +1,53 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "shared_buffer.h"
+
+/* the data is stored directly after the object */
+#define BUFFER_DATA(b)  ((char *)((b) + 1))
+
+SharedBuffer *SharedBuffer::create(const void *data, size_t len)
+{
+    SharedBuffer *buf = (SharedBuffer *)malloc(sizeof(SharedBuffer) + len + 1);
+    if (!buf) {
+        return NULL;
+    }
+
+    buf->_refcnt = 1;
+    buf->_len = len;
+    if (len > 0) {
+        memcpy(BUFFER_DATA(buf), data, len);
+    }
+    BUFFER_DATA(buf)[len] = '\0';
+
+    return buf;
+}
+
+SharedBuffer *SharedBuffer::create(const char *str)
+{
+    return create(str, strlen(str));
+}
+
+SharedBuffer *SharedBuffer::ref()
+{
+    __atomic_add_fetch(&_refcnt, 1, __ATOMIC_RELAXED);
+
+    return this;
+}
+
+void SharedBuffer::unref()
+{
+    if (__atomic_sub_fetch(&_refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(this);
+    }
+}
+
+const char *SharedBuffer::data() const
+{
+    return BUFFER_DATA(this);
+}
+
+size_t SharedBuffer::len() const
+{
+    return _len;
+}
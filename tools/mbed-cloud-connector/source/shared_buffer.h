@@ -0,0 +1,66 @@
+#ifndef SHARED_BUFFER_H
+#define SHARED_BUFFER_H
+
+#include <stddef.h>
+
+/**
+ * A reference counted, immutable data buffer.
+ *
+ * This is used to capture message payloads once and then pass them through
+ * the connector (between threads, and into the agent send queue) without
+ * copying them again. The data is always NUL terminated.
+ *
+ * The reference count is atomic, so references can be passed between threads.
+ */
+class SharedBuffer {
+
+public:
+
+    /**
+     * Create a buffer holding a copy of the data.
+     *
+     * @param data Data
+     * @param len  Data length
+     * @return The buffer (with one reference), or NULL if out of memory
+     */
+    static SharedBuffer *create(const void *data, size_t len);
+
+    /**
+     * Create a buffer holding a copy of the string.
+     *
+     * @param str String
+     * @return The buffer (with one reference), or NULL if out of memory
+     */
+    static SharedBuffer *create(const char *str);
+
+    /**
+     * Add a reference.
+     */
+    SharedBuffer *ref();
+
+    /**
+     * Release a reference, freeing the buffer once the last one is released.
+     */
+    void unref();
+
+    /**
+     * Get the data (NUL terminated).
+     */
+    const char *data() const;
+
+    /**
+     * Get the data length.
+     */
+    size_t len() const;
+
+private:
+
+    int _refcnt;
+    size_t _len;
+
+    SharedBuffer();
+    ~SharedBuffer();
+
+};
+
+#endif // SHARED_BUFFER_H
@@ -0,0 +1,205 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <utility>
+#include <atomic>
+
+#define SPSC_RING_CACHE_LINE_SIZE   (64)
+
+/**
+ * A bounded, lock-free single-producer/single-consumer ring.
+ *
+ * The slots are allocated once by init(), so pushing and popping never touch
+ * the heap. Entries are moved in and out of the ring. When the ring is full,
+ * new entries are refused (the producer keeps ownership) and counted as
+ * overflows.
+ *
+ * Only one thread may push and only one (other) thread may pop.
+ */
+template <typename T>
+class SpscRing {
+
+public:
+
+    /**
+     * Constructor
+     */
+    SpscRing():
+        _slots(NULL),
+        _mask(0),
+        _head(0),
+        _tail(0),
+        _overflow_cnt(0)
+    {
+    }
+
+    /**
+     * Deconstructor
+     *
+     * Any entries still in the ring are destroyed.
+     */
+    ~SpscRing()
+    {
+        uninit();
+    }
+
+    /**
+     * Allocate the ring.
+     *
+     * @param capacity Capacity (rounded up to a power of two)
+     */
+    bool init(size_t capacity)
+    {
+        size_t size = 2;
+
+        uninit();
+
+        while (size < capacity) {
+            size *= 2;
+        }
+        _slots = (T *)malloc(size * sizeof(T));
+        if (!_slots) {
+            return false;
+        }
+        _mask = size - 1;
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    /**
+     * Destroy any remaining entries and free the ring.
+     */
+    void uninit()
+    {
+        T item;
+
+        if (!_slots) {
+            return;
+        }
+        while (pop(item)) {
+        }
+        free(_slots);
+        _slots = NULL;
+        _mask = 0;
+    }
+
+    /**
+     * Push an entry (producer only).
+     *
+     * @param item      Entry, moved into the ring on success
+     * @param was_empty If not NULL, set to whether the consumer had already
+     *                  popped all previous entries. The consumer only needs to
+     *                  be woken up if so.
+     * @return False if the ring is full (the entry is not moved)
+     */
+    bool push(T &item, bool *was_empty = NULL)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+
+        if (!_slots || tail - _head.load(std::memory_order_acquire) > _mask) {
+            _overflow_cnt.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        new (&_slots[tail & _mask]) T(std::move(item));
+
+        /*
+         * sequentially consistent, so that either the consumer sees this entry
+         * or we see that it has emptied the ring (and needs waking up).
+         */
+        _tail.store(tail + 1, std::memory_order_seq_cst);
+        if (was_empty) {
+            *was_empty = (_head.load(std::memory_order_seq_cst) == tail);
+        }
+
+        return true;
+    }
+
+    /**
+     * Pop an entry (consumer only).
+     *
+     * @param item Set to the entry
+     * @return False if the ring is empty
+     */
+    bool pop(T &item)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+
+        if (head == _tail.load(std::memory_order_seq_cst)) {
+            return false;
+        }
+
+        T *slot = &_slots[head & _mask];
+        item = std::move(*slot);
+        slot->~T();
+
+        _head.store(head + 1, std::memory_order_seq_cst);
+
+        return true;
+    }
+
+    /**
+     * Checks if the ring is empty or not.
+     */
+    bool is_empty()
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Get the number of entries in the ring.
+     *
+     * This may be called from any thread, so the count may already be out of
+     * date.
+     */
+    size_t get_cnt()
+    {
+        size_t head = _head.load(std::memory_order_acquire);
+
+        return _tail.load(std::memory_order_acquire) - head;
+    }
+
+    /**
+     * Get the ring's capacity.
+     */
+    size_t get_capacity()
+    {
+        return _slots ? _mask + 1 : 0;
+    }
+
+    /**
+     * Get the number of entries refused due to the ring being full.
+     */
+    uint32_t get_overflow_cnt()
+    {
+        return _overflow_cnt.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    /*
+     * The consumer and producer indexes are padded onto separate cache lines
+     * to avoid false sharing.
+     */
+    T *_slots;
+    size_t _mask;
+    char _pad0[SPSC_RING_CACHE_LINE_SIZE];
+    std::atomic<size_t> _head;
+    char _pad1[SPSC_RING_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _tail;
+    std::atomic<uint32_t> _overflow_cnt;
+    char _pad2[SPSC_RING_CACHE_LINE_SIZE];
+
+    /* not copyable */
+    SpscRing(const SpscRing &);
+    SpscRing &operator=(const SpscRing &);
+
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,157 @@
+/*
+ * Dumps the entries of a connector flight recorder file (see
+ * source/flight_recorder.h), oldest first.
+ *
+ * The file may be from a connector that crashed or is still running. Entries
+ * that were being written at the time are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include "flight_recorder.h"
+
+static const char *level_names[] = { "debug", "info", "error" };
+
+static char *data;
+static uint64_t data_mask;
+
+static void copy_out(void *dst, uint64_t pos, size_t len)
+{
+    size_t off = pos & data_mask;
+    size_t first = data_mask + 1 - off;
+
+    if (len <= first) {
+        memcpy(dst, data + off, len);
+    } else {
+        memcpy(dst, data + off, first);
+        memcpy((char *)dst + first, data, len - first);
+    }
+}
+
+static void print_entry(const struct flight_recorder_entry *entry, const char *msg, bool utc)
+{
+    time_t secs = entry->ts / 1000000000ULL;
+    struct tm tm;
+    char date[32];
+
+    if (utc) {
+        gmtime_r(&secs, &tm);
+    } else {
+        localtime_r(&secs, &tm);
+    }
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+    printf("%s.%06llu %-5s %.*s\n", date,
+        (unsigned long long)(entry->ts % 1000000000ULL) / 1000,
+        entry->level < sizeof(level_names) / sizeof(level_names[0]) ?
+            level_names[entry->level] : "?",
+        (int)entry->len, msg);
+}
+
+static void print_usage(const char *name)
+{
+    printf(
+        "Usage: %s [options] <file>\n"
+        "\n"
+        "Options:\n"
+        "  -u  Show times in UTC\n"
+        "  -h  Show this help\n",
+        name);
+}
+
+int main(int argc, char **argv)
+{
+    struct flight_recorder_header header;
+    struct flight_recorder_entry entry;
+    char msg[UINT16_MAX];
+    uint64_t start;
+    uint64_t end;
+    uint64_t pos;
+    uint64_t skipped = 0;
+    uint64_t cnt = 0;
+    bool utc = false;
+    FILE *fp;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "uh")) != -1) {
+        switch (opt) {
+            case 'u':
+                utc = true;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fp = fopen(argv[optind], "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+            memcmp(header.magic, FLIGHT_RECORDER_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != FLIGHT_RECORDER_VERSION) {
+        fprintf(stderr, "%s: not a flight recorder file (or an unsupported version)\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (header.data_size < FLIGHT_RECORDER_MIN_SIZE || (header.data_size & (header.data_size - 1))) {
+        fprintf(stderr, "%s: invalid ring size\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    data = (char *)malloc(header.data_size);
+    if (!data) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    if (fseek(fp, header.header_size, SEEK_SET) < 0 ||
+            fread(data, header.data_size, 1, fp) != 1) {
+        fprintf(stderr, "%s: truncated file\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    fclose(fp);
+    data_mask = header.data_size - 1;
+
+    end = header.write_pos;
+    start = (end > header.data_size) ? end - header.data_size : 0;
+
+    /*
+     * The oldest entry may have been partly overwritten, so the start isn't
+     * necessarily an entry's start. Entries are recognized by their magic and
+     * position, which also skips those never completed.
+     */
+    pos = start;
+    while (pos + sizeof(entry) <= end) {
+        copy_out(&entry, pos, sizeof(entry));
+        if (entry.magic != FLIGHT_RECORDER_ENTRY_MAGIC || entry.pos != pos ||
+                pos + FLIGHT_RECORDER_ENTRY_SIZE(entry.len) > end) {
+            pos += FLIGHT_RECORDER_ALIGN;
+            skipped += FLIGHT_RECORDER_ALIGN;
+            continue;
+        }
+        copy_out(msg, pos + sizeof(entry), entry.len);
+        print_entry(&entry, msg, utc);
+        pos += FLIGHT_RECORDER_ENTRY_SIZE(entry.len);
+        cnt++;
+    }
+
+    fprintf(stderr, "%llu entries (%u starts), %llu bytes skipped\n",
+        (unsigned long long)cnt, header.start_cnt, (unsigned long long)skipped);
+
+    free(data);
+
+    return EXIT_SUCCESS;
+}